@@ -0,0 +1,114 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cake
+
+#if !defined(_CAKE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CAKE_TRACE_H
+
+/* Sampled drop/mark events for perf and friends.
+ *
+ * With TCA_CAKE_SAMPLE set to N, one in every N drops or marks of an
+ * instance fires this tracepoint, carrying the first CAKE_SAMPLE_BYTES of
+ * the packet along with the tin, flow and sojourn time.  Capture with eg.
+ *	perf record -e cake:cake_sample -a
+ * Nothing is copied unless the tracepoint is enabled.
+ */
+
+#include <linux/tracepoint.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <net/sch_generic.h>
+
+#define CAKE_SAMPLE_BYTES	(128)
+#define CAKE_SAMPLE_OVERLOAD	(CODEL_SAMPLE_MARK + 1)
+
+TRACE_EVENT(cake_sample,
+
+	TP_PROTO(struct Qdisc *sch, const struct sk_buff *skb,
+		 u16 tin, u16 flow, u32 sojourn_us, u8 action),
+
+	TP_ARGS(sch, skb, tin, flow, sojourn_us, action),
+
+	TP_STRUCT__entry(
+		__field(int,	ifindex)
+		__field(u32,	handle)
+		__field(u16,	tin)
+		__field(u16,	flow)
+		__field(u32,	sojourn_us)
+		__field(u32,	len)
+		__field(u8,	action)
+		__field(u8,	caplen)
+		__array(u8,	hdr, CAKE_SAMPLE_BYTES)
+	),
+
+	TP_fast_assign(
+		__entry->ifindex    = qdisc_dev(sch)->ifindex;
+		__entry->handle     = sch->handle;
+		__entry->tin        = tin;
+		__entry->flow       = flow;
+		__entry->sojourn_us = sojourn_us;
+		__entry->len        = skb->len;
+		__entry->action     = action;
+		__entry->caplen     = min_t(u32, skb->len, CAKE_SAMPLE_BYTES);
+		if (skb_copy_bits(skb, 0, __entry->hdr, __entry->caplen))
+			__entry->caplen = 0;
+	),
+
+	TP_printk("dev=%d handle=%x tin=%u flow=%u sojourn=%uus %s len=%u hdr=%s",
+		  __entry->ifindex, __entry->handle, __entry->tin,
+		  __entry->flow, __entry->sojourn_us,
+		  __print_symbolic(__entry->action,
+				   { CODEL_SAMPLE_DROP,    "drop" },
+				   { CODEL_SAMPLE_MARK,    "mark" },
+				   { CAKE_SAMPLE_OVERLOAD, "overload" }),
+		  __entry->len,
+		  __print_hex(__entry->hdr, __entry->caplen))
+);
+
+/* Every drop, with the reason it is counted under in xstats drops[].
+ * The kfree_skb tracepoint carries no reason on the kernels this builds
+ * for, so this is where drop monitors should look for cake's:
+ *	perf record -e cake:cake_drop -a
+ */
+TRACE_EVENT(cake_drop,
+
+	TP_PROTO(struct Qdisc *sch, const struct sk_buff *skb,
+		 u16 tin, u16 flow, u8 reason),
+
+	TP_ARGS(sch, skb, tin, flow, reason),
+
+	TP_STRUCT__entry(
+		__field(int,	ifindex)
+		__field(u32,	handle)
+		__field(u16,	tin)
+		__field(u16,	flow)
+		__field(u32,	len)
+		__field(u8,	reason)
+	),
+
+	TP_fast_assign(
+		__entry->ifindex = qdisc_dev(sch)->ifindex;
+		__entry->handle  = sch->handle;
+		__entry->tin     = tin;
+		__entry->flow    = flow;
+		__entry->len     = skb->len;
+		__entry->reason  = reason;
+	),
+
+	TP_printk("dev=%d handle=%x tin=%u flow=%u len=%u %s",
+		  __entry->ifindex, __entry->handle, __entry->tin,
+		  __entry->flow, __entry->len,
+		  __print_symbolic(__entry->reason,
+				   { TC_CAKE_DROP_CODEL,     "codel" },
+				   { TC_CAKE_DROP_OVERLIMIT, "overlimit" },
+				   { TC_CAKE_DROP_POOL,      "pool" },
+				   { TC_CAKE_DROP_SHRINK,    "shrink" },
+				   { TC_CAKE_DROP_GSO,       "gso" }))
+);
+
+#endif /* _CAKE_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cake_trace
+#include <trace/define_trace.h>
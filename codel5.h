@@ -210,11 +210,27 @@ static bool codel_should_drop(const struct sk_buff *skb,
 	return false;
 }
 
-/* Forward declaration of this for use elsewhere */
+/* Forward declaration of these for use elsewhere */
 
 static inline struct sk_buff *custom_dequeue(struct codel_vars *vars,
 					     struct Qdisc *sch);
 
+/* Called just before a drop or just after a CE mark, so the qdisc can
+ * sample the packet.  Must be cheap when the qdisc isn't sampling.
+ */
+#define CODEL_SAMPLE_DROP	(0)
+#define CODEL_SAMPLE_MARK	(1)
+
+static inline void custom_sample(struct codel_vars *vars,
+				 struct Qdisc *sch,
+				 const struct sk_buff *skb,
+				 codel_time_t now, u8 action);
+
+/* Frees a packet CoDel has dropped and counts it in sch's qstats. */
+static inline void custom_drop(struct codel_vars *vars,
+			       struct Qdisc *sch,
+			       struct sk_buff *skb);
+
 static struct sk_buff *codel_dequeue(struct Qdisc *sch,
 				     struct codel_vars *vars,
 				     struct codel_params *p,
@@ -255,13 +271,17 @@ static struct sk_buff *codel_dequeue(struct Qdisc *sch,
 			do {
 				if (INET_ECN_set_ce(skb) && !overloaded) {
 					vars->ecn_mark++;
+					custom_sample(vars, sch, skb, now,
+						      CODEL_SAMPLE_MARK);
 					/* and schedule the next drop */
 					vars->drop_next = codel_control_law(
 						vars->drop_next, p->interval,
 						vars->rec_inv_sqrt);
 					goto end;
 				}
-				qdisc_drop(skb, sch);
+				custom_sample(vars, sch, skb, now,
+					      CODEL_SAMPLE_DROP);
+				custom_drop(vars, sch, skb);
 				vars->drop_count++;
 				skb = custom_dequeue(vars, sch);
 				if (skb && !codel_should_drop(skb, sch, vars,
@@ -278,20 +298,28 @@ static struct sk_buff *codel_dequeue(struct Qdisc *sch,
 				 vars->drop_next);
 
 			/* Mark the packet regardless */
-			if (skb && INET_ECN_set_ce(skb))
+			if (skb && INET_ECN_set_ce(skb)) {
 				vars->ecn_mark++;
+				custom_sample(vars, sch, skb, now,
+					      CODEL_SAMPLE_MARK);
+			}
 		}
 	} else if (drop) {
 		if (INET_ECN_set_ce(skb) && !overloaded) {
 			vars->ecn_mark++;
+			custom_sample(vars, sch, skb, now, CODEL_SAMPLE_MARK);
 		} else {
-			qdisc_drop(skb, sch);
+			custom_sample(vars, sch, skb, now, CODEL_SAMPLE_DROP);
+			custom_drop(vars, sch, skb);
 			vars->drop_count++;
 
 			skb = custom_dequeue(vars, sch);
 			drop = codel_should_drop(skb, sch, vars, p, now);
-			if (skb && INET_ECN_set_ce(skb))
+			if (skb && INET_ECN_set_ce(skb)) {
 				vars->ecn_mark++;
+				custom_sample(vars, sch, skb, now,
+					      CODEL_SAMPLE_MARK);
+			}
 		}
 		vars->dropping = true;
 		/* if min went above target close to when we last went below
@@ -864,6 +864,7 @@ enum {
 	TCA_CAKE_AUTORATE,
 	TCA_CAKE_MEMORY,
 	TCA_CAKE_WASH,
+	TCA_CAKE_SAMPLE,	/* trace 1 in N drops/marks, 0 = off */
 	__TCA_CAKE_MAX
 };
 #define TCA_CAKE_MAX	(__TCA_CAKE_MAX - 1)
@@ -874,9 +875,60 @@ struct tc_cake_traffic_stats {
 	__u64 bytes;
 };
 
+/* CPU cost buckets, only filled in when cake is built with CPUSTATS=1 */
+enum {
+	TC_CAKE_CPU_ENQUEUE,
+	TC_CAKE_CPU_DEQUEUE,
+	TC_CAKE_CPU_DROP,
+	TC_CAKE_CPU_GSO,
+	__TC_CAKE_CPU_MAX
+};
+#define TC_CAKE_CPU_MAX	(__TC_CAKE_CPU_MAX)
+
+struct tc_cake_cpu_cost {
+	__u64 cycles;
+	__u32 calls;
+	__u32 max_cycles;
+};
+
+/* Congestion episodes, kept in a small per-instance ring */
+enum {
+	TC_CAKE_EPISODE_CODEL,		/* flows in a tin in CoDel dropping state */
+	TC_CAKE_EPISODE_OVERLOAD,	/* memory limit hit, evicting fat flows */
+};
+#define TC_CAKE_EPISODE_ALL_TINS	(0xff)
+#define TC_CAKE_EPISODE_RING		(32)
+
+struct tc_cake_episode {
+	__u64 start_ns;      /* CLOCK_REALTIME */
+	__u32 seq;           /* position in the episode stream */
+	__u32 duration_us;
+	__u32 dropped;
+	__u32 marked;
+	__u32 peak_delay_us;
+	__u8  tin;           /* or TC_CAKE_EPISODE_ALL_TINS */
+	__u8  type;
+	__u16 peak_flows;    /* most flows in dropping state at once */
+};
+
+/* Why packets were dropped */
+enum {
+	TC_CAKE_DROP_CODEL,	/* AQM drop from a flow's head */
+	TC_CAKE_DROP_OVERLIMIT,	/* over memory_limit, or asked to by a parent */
+	TC_CAKE_DROP_POOL,	/* evicted to fit the shared memory pool */
+	TC_CAKE_DROP_SHRINK,	/* trimmed under system memory pressure */
+	TC_CAKE_DROP_GSO,	/* GSO packet that could not be segmented */
+	__TC_CAKE_DROP_MAX
+};
+#define TC_CAKE_DROP_MAX	(__TC_CAKE_DROP_MAX)
+
+/* Watchdog lateness histogram, log2 ns buckets */
+#define TC_CAKE_WD_BUCKETS	(24)
+
 #define TC_CAKE_MAX_TINS (8)
+
 struct tc_cake_xstats {
-	__u16 version;  /* == 3, increments when struct extended */
+	__u16 version;  /* == 10, increments when struct extended */
 	__u8  max_tins; /* == TC_CAKE_MAX_TINS */
 	__u8  tin_cnt;  /* <= TC_CAKE_MAX_TINS */
 
@@ -900,6 +952,36 @@ struct tc_cake_xstats {
 	__u32 capacity_estimate;  /* version 2 */
 	__u32 memory_limit;       /* version 3 */
 	__u32 memory_used;        /* version 3 */
+	__u32 cpu_stats;          /* version 4, nonzero if cpu[] is valid */
+	struct tc_cake_cpu_cost cpu[TC_CAKE_CPU_MAX]; /* version 4 */
+	__u32 episode_seq;        /* version 5, episodes completed so far */
+	__u32 episode_ring;       /* version 5, == TC_CAKE_EPISODE_RING */
+	/* version 5, episode n lives in episodes[n % episode_ring] */
+	struct tc_cake_episode episodes[TC_CAKE_EPISODE_RING];
+	__u32 wd_stats;           /* version 6, nonzero if wd_* are valid */
+	__u32 wd_wakes;           /* version 6, watchdog deadlines followed */
+	__u32 wd_late_max_ns;     /* version 6 */
+	/* version 6, dequeues wd_late[0] exactly on time, wd_late[i]
+	 * 2^(i-1) to 2^i - 1 ns late; the last bucket has everything later
+	 */
+	__u32 wd_late[TC_CAKE_WD_BUCKETS];
+	/* version 7, where the flow tables were allocated: the NUMA node
+	 * asked for (the TX queue's, -1 if unknown) and the one they are on
+	 * (-1 if split), and their bytes in the linear map and in vmalloc
+	 */
+	__s32 table_node_wanted;
+	__s32 table_node;
+	__u32 table_kmalloc;
+	__u32 table_vmalloc;
+	/* version 8, the memory pool shared by all instances, in bytes of
+	 * truesize; pool_limit is 0 if there is none
+	 */
+	__u32 pool_limit;
+	__u32 pool_min;
+	__u32 pool_used;
+	/* version 9, dropped[] packets by reason, drops[reason][tin] */
+	__u32 drops[TC_CAKE_DROP_MAX][TC_CAKE_MAX_TINS];
+	__u32 memory_max_used;    /* version 10, most memory_used after an enqueue */
 };
 
 #endif
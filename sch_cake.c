@@ -39,6 +39,7 @@
 #include <linux/types.h>
 #include <linux/kernel.h>
 #include <linux/jiffies.h>
+#include <linux/timer.h>
 #include <linux/string.h>
 #include <linux/in.h>
 #include <linux/errno.h>
@@ -46,10 +47,15 @@
 #include <linux/skbuff.h>
 #include <linux/jhash.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/vmalloc.h>
 #include <linux/reciprocal_div.h>
 #include <net/netlink.h>
+#include <net/sock.h>
 #include <linux/version.h>
+#ifdef CAKE_CPUSTATS
+#include <linux/timex.h>
+#endif
 #include "pkt_sched.h"
 #if LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0)
 #include <net/flow_keys.h>
@@ -58,6 +64,9 @@
 #endif
 #include "codel5.h"
 
+#define CREATE_TRACE_POINTS
+#include "cake_trace.h"
+
 /* The CAKE Principles:
  *				 (or, how to have your cake and eat it too)
  *
@@ -106,6 +115,7 @@
  */
 
 #define CAKE_MAX_TINS (8)
+#define CAKE_QUEUES (1024)
 
 #ifndef CAKE_VERSION
 #define CAKE_VERSION "unknown"
@@ -122,9 +132,17 @@ struct cake_flow {
 	struct codel_vars cvars;
 }; /* please try to keep this structure <= 64 bytes */
 
+struct cake_episode {
+	struct tc_cake_episode rec;	/* record under construction */
+	codel_time_t	start;
+	bool		open;
+};
+
 struct cake_tin_data {
 	struct cake_flow *flows;/* Flows table [flows_cnt] */
 	u32	*backlogs;	/* backlog table [flows_cnt] */
+	u16	*flow_tenant;	/* tenant slot of each flow [flows_cnt] */
+	u16	*tenant_bulk;	/* bulk flows per tenant slot [flows_cnt] */
 	u32	 flows_cnt;	/* number of flows - must be multiple of
 				 * CAKE_SET_WAYS
 				 */
@@ -132,7 +150,7 @@ struct cake_tin_data {
 	u16	quantum;	/* psched_mtu(qdisc_dev(sch)); */
 	u16	bulk_flow_count;
 
-	u32	drop_overlimit;
+	u32	drops[TC_CAKE_DROP_MAX];
 
 	struct list_head new_flows; /* list of new flows */
 	struct list_head old_flows; /* list of old flows */
@@ -152,6 +170,10 @@ struct cake_tin_data {
 
 	u32	packets;
 	u64	bytes;
+
+	/* a tin is congested while any of its flows is in dropping state */
+	u16	dropping_flows;
+	struct cake_episode episode;
 }; /* number of tins is small, so size of this struct doesn't matter much */
 
 struct cake_sched_data {
@@ -175,6 +197,21 @@ struct cake_sched_data {
 	u32		buffer_used;
 	u32		buffer_limit;
 	u32		buffer_config_limit;
+	u32		buffer_max_used;
+	struct list_head instance;	/* on cake_instances, for the shrinker */
+	struct Qdisc	*sch;
+	struct Qdisc	*successor;	/* replacing us, see cake_handover() */
+	struct timer_list kick;		/* see cake_kick() */
+
+	/* where cake_init() put the tables */
+	int		table_node_wanted;	/* the TX queue's NUMA node */
+	int		table_node;		/* -1 if spread over several */
+	u32		table_kmalloc;
+	u32		table_vmalloc;
+
+	/* 1-in-N drop/mark sampling, 0 = off */
+	u32		sample_rate;
+	u32		sample_countdown;
 
 	/* indices for dequeue */
 	u16		cur_tin;
@@ -183,6 +220,20 @@ struct cake_sched_data {
 	struct qdisc_watchdog watchdog;
 	u8		tin_index[64];
 
+#ifdef CAKE_CPUSTATS
+	struct tc_cake_cpu_cost cpu_cost[TC_CAKE_CPU_MAX];
+#endif
+#ifdef CAKE_WDSTATS
+	u64		wd_expect;	/* deadline of the armed watchdog, or 0 */
+	u32		wd_wakes;
+	u32		wd_late_max;
+	u32		wd_late[TC_CAKE_WD_BUCKETS];
+#endif
+
+	/* completed congestion episodes */
+	struct cake_episode overload;
+	u32		episode_seq;
+	struct tc_cake_episode episodes[TC_CAKE_EPISODE_RING];
 };
 
 enum {
@@ -208,11 +259,54 @@ enum {
 	CAKE_FLOW_DUAL_SRC, /* = CAKE_FLOW_SRC_IP | CAKE_FLOW_FLOWS */
 	CAKE_FLOW_DUAL_DST, /* = CAKE_FLOW_DST_IP | CAKE_FLOW_FLOWS */
 	CAKE_FLOW_DUAL,     /* = CAKE_FLOW_HOSTS  | CAKE_FLOW_FLOWS */
+	CAKE_FLOW_TENANTS,  /* flows, fair between tenants, see cake_tenant() */
 	CAKE_FLOW_MAX
 };
 
+/* Who a packet belongs to on a shared host: the net_cls cgroup of the
+ * socket that sent it, if it has a classid, else the socket's network
+ * namespace.  Forwarded packets have no socket by now, as crossing into
+ * another namespace orphans them, so they go by the interface they came
+ * in on, e.g. a container's veth or a VM's tap.  Each of a tenant's flows
+ * gets its own queue, as in flows mode; cake_flow_quantum() then shares
+ * one quantum between a tenant's bulk flows.
+ */
+static u32 cake_tenant(const struct sk_buff *skb)
+{
+	const struct sock *sk = skb->sk;
+
+	/* request and timewait sockets only get attached from 4.1 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	if (sk && !sk_fullsock(sk))
+		sk = NULL;
+#endif
+	if (!sk)
+		return skb->skb_iif;
+
+#ifdef CONFIG_CGROUP_NET_CLASSID
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+	if (sock_cgroup_classid(&sk->sk_cgrp_data))
+		return sock_cgroup_classid(&sk->sk_cgrp_data);
+#else
+	if (sk->sk_classid)
+		return sk->sk_classid;
+#endif
+#endif
+	return net_hash_mix(sock_net(sk));
+}
+
+/* The tenant to hash and activate a packet's flow with; 0 unless in tenants
+ * mode.  Taken before a GSO packet is split, as the segments are queued
+ * and the packet freed before its flow is activated.
+ */
+static inline u32 cake_skb_tenant(const struct sk_buff *skb, int flow_mode)
+{
+	return flow_mode == CAKE_FLOW_TENANTS ? cake_tenant(skb) : 0;
+}
+
 static inline u32
-cake_hash(struct cake_tin_data *q, const struct sk_buff *skb, int flow_mode)
+cake_hash(struct cake_tin_data *q, const struct sk_buff *skb, int flow_mode,
+	  u32 tenant)
 {
 #if KERNEL_VERSION(4, 2, 0) > LINUX_VERSION_CODE
 	struct flow_keys keys;
@@ -227,10 +321,18 @@ cake_hash(struct cake_tin_data *q, const struct sk_buff *skb, int flow_mode)
 #if KERNEL_VERSION(4, 2, 0) > LINUX_VERSION_CODE
 	skb_flow_dissect(skb, &keys);
 
-	flow_hash = jhash_3words(
-		(__force u32)((flow_mode & CAKE_FLOW_DST_IP) ? keys.dst : 0),
-		(__force u32)((flow_mode & CAKE_FLOW_SRC_IP) ? keys.src : 0),
-		(__force u32)0, q->perturbation);
+	if (flow_mode == CAKE_FLOW_TENANTS)
+		flow_hash = jhash_3words((__force u32)keys.dst,
+					 (__force u32)keys.src,
+					 (__force u32)keys.ports,
+					 q->perturbation);
+	else
+		flow_hash = jhash_3words(
+			(__force u32)((flow_mode & CAKE_FLOW_DST_IP) ?
+				      keys.dst : 0),
+			(__force u32)((flow_mode & CAKE_FLOW_SRC_IP) ?
+				      keys.src : 0),
+			(__force u32)0, q->perturbation);
 
 #else
 
@@ -245,10 +347,74 @@ cake_hash(struct cake_tin_data *q, const struct sk_buff *skb, int flow_mode)
 #endif
 	flow_hash = flow_hash_from_keys(&keys);
 #endif
+	if (flow_mode == CAKE_FLOW_TENANTS)
+		flow_hash = jhash_2words(flow_hash, tenant, q->perturbation);
 	reduced_hash = reciprocal_scale(flow_hash, q->flows_cnt);
 	return reduced_hash;
 }
 
+/* Put a flow that has just got a packet on the new flows list.  Its tenant
+ * slot is set while it is off the lists, so the bulk counts stay right
+ * across a change of flow mode.
+ */
+static inline void cake_flow_activate(struct cake_tin_data *b,
+				      struct cake_flow *flow,
+				      u32 tenant, int flow_mode)
+{
+	u32 slot = 0;
+
+	if (flow_mode == CAKE_FLOW_TENANTS)
+		slot = reciprocal_scale(jhash_1word(tenant, b->perturbation),
+					b->flows_cnt);
+	b->flow_tenant[flow - b->flows] = slot;
+
+	list_add_tail(&flow->flowchain, &b->new_flows);
+	flow->deficit = b->quantum;
+	flow->dropped = 0;
+}
+
+/* Moving a flow on and off the old (bulk) flows list. */
+static inline void cake_bulk_inc(struct cake_tin_data *b,
+				 const struct cake_flow *flow)
+{
+	b->bulk_flow_count++;
+	b->tenant_bulk[b->flow_tenant[flow - b->flows]]++;
+}
+
+static inline void cake_bulk_dec(struct cake_tin_data *b,
+				 const struct cake_flow *flow)
+{
+	b->bulk_flow_count--;
+	b->tenant_bulk[b->flow_tenant[flow - b->flows]]--;
+}
+
+/* 65535 / n, filled in at module load */
+static u16 quantum_div[CAKE_QUEUES + 1];
+
+/* A flow's DRR quantum.  In tenants mode a tenant's bulk flows share one
+ * between them, so a tenant can't take more of the link by opening more
+ * flows.  Its sparse flows still go first, as everyone's do.
+ *
+ * A share can be under a byte, as with a few hundred flows at a low rate,
+ * and adding 0 to every deficit would leave the dequeue rotating forever.
+ * So the share is in 1/65536ths of a byte and randomly rounded, which
+ * gives each flow its share on average.
+ */
+static inline u32 cake_flow_quantum(const struct cake_sched_data *q,
+				    const struct cake_tin_data *b,
+				    const struct cake_flow *flow)
+{
+	u16 load;
+
+	if (q->flow_mode != CAKE_FLOW_TENANTS)
+		return b->quantum;
+
+	load = b->tenant_bulk[b->flow_tenant[flow - b->flows]];
+	if (load <= 1)
+		return b->quantum;
+	return (b->quantum * quantum_div[load] + (prandom_u32() >> 16)) >> 16;
+}
+
 /* helper functions : might be changed when/if skb use a standard list_head */
 /* remove one skb from head of slot queue */
 
@@ -295,17 +461,197 @@ static inline codel_time_t cake_ewma(codel_time_t avg, codel_time_t sample,
 	return avg;
 }
 
+/* Optional accounting of the cycles cake itself burns, per instance.
+ * Build with "make CPUSTATS=1"; otherwise these helpers compile away.
+ */
+#ifdef CAKE_CPUSTATS
+typedef cycles_t cake_cycles_t;
+
+static inline cake_cycles_t cake_cycles(void)
+{
+	return get_cycles();
+}
+
+static inline void cake_cpu_account(struct cake_sched_data *q, int bucket,
+				    cake_cycles_t start)
+{
+	struct tc_cake_cpu_cost *c = &q->cpu_cost[bucket];
+	cake_cycles_t delta = get_cycles() - start;
+	u32 d = delta > U32_MAX ? U32_MAX : (u32)delta;
+
+	c->cycles += d;
+	c->calls++;
+	if (d > c->max_cycles)
+		c->max_cycles = d;
+}
+#else
+typedef u32 cake_cycles_t;
+
+static inline cake_cycles_t cake_cycles(void)
+{
+	return 0;
+}
+
+static inline void cake_cpu_account(struct cake_sched_data *q, int bucket,
+				    cake_cycles_t start)
+{
+}
+#endif
+
+/* Optional record of how late after the shaper's deadline the watchdog
+ * actually gets cake dequeued, as a log2 histogram in ns.  Build with
+ * "make WDSTATS=1"; otherwise these helpers compile away.
+ */
+#ifdef CAKE_WDSTATS
+static inline void cake_wd_armed(struct cake_sched_data *q, u64 expires)
+{
+	q->wd_expect = expires;
+}
+
+static inline void cake_wd_dequeue(struct cake_sched_data *q, u64 now)
+{
+	u32 late;
+
+	/* The watchdog didn't cause this dequeue if its timer is still
+	 * queued: an enqueue or a wake of the TX queue got here first.
+	 */
+	if (!q->wd_expect || now < q->wd_expect ||
+	    hrtimer_is_queued(&q->watchdog.timer))
+		return;
+
+	late = min_t(u64, now - q->wd_expect, U32_MAX);
+	q->wd_expect = 0;
+	q->wd_wakes++;
+	if (late > q->wd_late_max)
+		q->wd_late_max = late;
+	q->wd_late[min_t(u32, fls(late), TC_CAKE_WD_BUCKETS - 1)]++;
+}
+#else
+static inline void cake_wd_armed(struct cake_sched_data *q, u64 expires)
+{
+}
+
+static inline void cake_wd_dequeue(struct cake_sched_data *q, u64 now)
+{
+}
+#endif
+
+/* Congestion episodes are only opened and closed on state transitions,
+ * so the wall clock is read rarely; while open they are updated with the
+ * drop and mark deltas cake_dequeue() already computes.
+ */
+static void cake_episode_begin(struct cake_episode *ep, u8 tin, u8 type,
+			       codel_time_t now)
+{
+	memset(&ep->rec, 0, sizeof(ep->rec));
+	ep->rec.start_ns = ktime_to_ns(ktime_get_real());
+	ep->rec.tin      = tin;
+	ep->rec.type     = type;
+	ep->start        = now;
+	ep->open         = true;
+}
+
+static void cake_episode_end(struct cake_sched_data *q,
+			     struct cake_episode *ep, codel_time_t now)
+{
+	ep->rec.duration_us = codel_time_to_us(now - ep->start);
+	ep->rec.seq = q->episode_seq;
+	q->episodes[q->episode_seq++ % TC_CAKE_EPISODE_RING] = ep->rec;
+	ep->open = false;
+}
+
+static inline void cake_episode_delay(struct cake_episode *ep,
+				      const struct sk_buff *skb,
+				      codel_time_t now)
+{
+	u32 delay = codel_time_to_us(now - codel_get_enqueue_time(skb));
+
+	if (delay > ep->rec.peak_delay_us)
+		ep->rec.peak_delay_us = delay;
+}
+
+static void cake_sample(struct Qdisc *sch, const struct sk_buff *skb,
+			u16 tin, u16 flow, codel_time_t now, u8 action)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+
+	if (--q->sample_countdown)
+		return;
+
+	q->sample_countdown = q->sample_rate;
+	trace_cake_sample(sch, skb, tin, flow,
+			  codel_time_to_us(now - codel_get_enqueue_time(skb)),
+			  action);
+}
+
+/* Free a dropped packet, counted under its reason and traced first. */
+static void cake_drop_skb(struct Qdisc *sch, struct sk_buff *skb,
+			  u16 tin, u16 flow, u8 reason)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+
+	q->tins[tin].drops[reason]++;
+	trace_cake_drop(sch, skb, tin, flow, reason);
+	kfree_skb(skb);
+}
+
+/* All instances, for the shrinker and the memory pool.  Taken from
+ * enqueue, so with bottom halves off everywhere; nests inside a root lock,
+ * never the other way round.
+ */
+static LIST_HEAD(cake_instances);
+static DEFINE_SPINLOCK(cake_instances_lock);
+
+static void cake_instance_add(struct cake_sched_data *q)
+{
+	spin_lock_bh(&cake_instances_lock);
+	list_add_tail(&q->instance, &cake_instances);
+	spin_unlock_bh(&cake_instances_lock);
+}
+
+/* Optional memory pool shared by every instance.  With mem_pool set, the
+ * truesize queued by all of them together is kept under it by evicting
+ * from whichever instance is furthest over mem_min, its guarantee; each
+ * instance's own buffer_limit still applies on top.  Guarantees are not
+ * reserved, so keep mem_min * instances below mem_pool.  Both are fixed
+ * at load time since the pool only counts while it is enabled.
+ */
+static unsigned int cake_mem_pool;
+module_param_named(mem_pool, cake_mem_pool, uint, 0444);
+MODULE_PARM_DESC(mem_pool, "packet memory all instances share, 0 = no pool");
+
+static unsigned int cake_mem_min = 65536;
+module_param_named(mem_min, cake_mem_min, uint, 0444);
+MODULE_PARM_DESC(mem_min, "packet memory each instance keeps from the pool");
+
+static atomic_t cake_pool_used = ATOMIC_INIT(0);
+
+static inline void cake_mem_charge(struct cake_sched_data *q, u32 truesize)
+{
+	q->buffer_used += truesize;
+	if (cake_mem_pool)
+		atomic_add(truesize, &cake_pool_used);
+}
+
+static inline void cake_mem_uncharge(struct cake_sched_data *q, u32 truesize)
+{
+	q->buffer_used -= truesize;
+	if (cake_mem_pool)
+		atomic_sub(truesize, &cake_pool_used);
+}
+
 /* FIXME: In terms of speed this is a real hit and could be easily
  *  replaced with tail drop...  BUT it's a slow-path routine.
  */
 
-static unsigned int cake_drop(struct Qdisc *sch)
+static unsigned int __cake_drop(struct Qdisc *sch, u8 reason)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
 	struct sk_buff *skb;
 	u32 maxbacklog = 0, idx = 0, tin = 0, i, j, len;
 	struct cake_tin_data *b;
 	struct cake_flow *flow;
+	cake_cycles_t start = cake_cycles();
 
 	/* Queue is full; check across tins in use and
 	 * find the fat flow and drop a packet.
@@ -337,7 +683,7 @@ static unsigned int cake_drop(struct Qdisc *sch)
 	skb = dequeue_head(flow);
 	len = qdisc_pkt_len(skb);
 
-	q->buffer_used      -= skb->truesize;
+	cake_mem_uncharge(q, skb->truesize);
 	b->backlogs[idx]    -= len;
 	b->tin_backlog      -= len;
 	sch->qstats.backlog -= len;
@@ -346,12 +692,67 @@ static unsigned int cake_drop(struct Qdisc *sch)
 	sch->qstats.drops++;
 	flow->dropped++;
 
-	kfree_skb(skb);
+	if (unlikely(q->sample_rate))
+		cake_sample(sch, skb, tin, idx, codel_get_time(),
+			    CAKE_SAMPLE_OVERLOAD);
+
+	cake_drop_skb(sch, skb, tin, idx, reason);
 	sch->q.qlen--;
 
+	cake_cpu_account(q, TC_CAKE_CPU_DROP, start);
 	return idx + (tin << 16);
 }
 
+static unsigned int cake_drop(struct Qdisc *sch)
+{
+	return __cake_drop(sch, TC_CAKE_DROP_OVERLIMIT);
+}
+
+/* The pool is over: drop the fattest flow's head from whichever instance
+ * holds the most beyond mem_min, until it fits again.  Another instance's
+ * lock is only tried, as it may be enqueueing against us right now; if it
+ * is busy, this one gives way instead, down to its own guarantee.  The
+ * scan reads other instances' buffer_used unlocked, which is good enough
+ * to pick a victim.
+ */
+static void cake_pool_evict(struct Qdisc *sch)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	spinlock_t *own = qdisc_root_sleeping_lock(sch);
+
+	spin_lock(&cake_instances_lock);
+	while (atomic_read(&cake_pool_used) > cake_mem_pool) {
+		struct cake_sched_data *v, *victim = NULL;
+		u32 excess = 0;
+		spinlock_t *lock;
+
+		list_for_each_entry(v, &cake_instances, instance) {
+			if (v->buffer_used > cake_mem_min + excess) {
+				excess = v->buffer_used - cake_mem_min;
+				victim = v;
+			}
+		}
+		if (!victim)
+			break;
+
+		lock = qdisc_root_sleeping_lock(victim->sch);
+		if (lock != own && !spin_trylock(lock)) {
+			if (q->buffer_used <= cake_mem_min)
+				break;
+			victim = q;
+			lock = own;
+		}
+
+		if (victim->buffer_used > cake_mem_min) {
+			__cake_drop(victim->sch, TC_CAKE_DROP_POOL);
+			qdisc_tree_decrease_qlen(victim->sch, 1);
+		}
+		if (lock != own)
+			spin_unlock(lock);
+	}
+	spin_unlock(&cake_instances_lock);
+}
+
 static inline void cake_wash_diffserv(struct sk_buff *skb)
 {
 	switch (skb->protocol) {
@@ -391,10 +792,10 @@ static inline u32 cake_handle_diffserv(struct sk_buff *skb, u16 wash)
 
 static void cake_reconfigure(struct Qdisc *sch);
 
-static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+static s32 __cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
-	u32 idx, tin;
+	u32 idx, tin, tenant;
 	struct cake_tin_data *b;
 	struct cake_flow *flow;
 	u32 len = qdisc_pkt_len(skb);
@@ -416,7 +817,8 @@ static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 	b = &q->tins[tin];
 
 	/* choose flow to insert into */
-	idx = cake_hash(b, skb, q->flow_mode);
+	tenant = cake_skb_tenant(skb, q->flow_mode);
+	idx = cake_hash(b, skb, q->flow_mode, tenant);
 	flow = &b->flows[idx];
 
 	/* ensure shaper state isn't stale */
@@ -437,10 +839,17 @@ static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 		struct sk_buff *segs, *nskb;
 		netdev_features_t features = netif_skb_features(skb);
 		u32 slen = 0;
+		cake_cycles_t start = cake_cycles();
+
 		segs = skb_gso_segment(skb, features & ~NETIF_F_GSO_MASK);
+		cake_cpu_account(q, TC_CAKE_CPU_GSO, start);
 
-		if (IS_ERR_OR_NULL(segs))
-			return qdisc_reshape_fail(skb, sch);
+		if (IS_ERR_OR_NULL(segs)) {
+			b->tin_dropped++;
+			sch->qstats.drops++;
+			cake_drop_skb(sch, skb, tin, idx, TC_CAKE_DROP_GSO);
+			return NET_XMIT_DROP;
+		}
 
 		while (segs) {
 			nskb = segs->next;
@@ -452,7 +861,7 @@ static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 			sch->q.qlen++;
 			b->packets++;
 			slen += segs->len;
-			q->buffer_used      += segs->truesize;
+			cake_mem_charge(q, segs->truesize);
 			segs = nskb;
 		}
 
@@ -475,15 +884,12 @@ static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 		b->backlogs[idx]    += len;
 		b->tin_backlog      += len;
 		sch->qstats.backlog += len;
-		q->buffer_used      += skb->truesize;
+		cake_mem_charge(q, skb->truesize);
 	}
 
 	/* flowchain */
-	if (list_empty(&flow->flowchain)) {
-		list_add_tail(&flow->flowchain, &b->new_flows);
-		flow->deficit = b->quantum;
-		flow->dropped = 0;
-	}
+	if (list_empty(&flow->flowchain))
+		cake_flow_activate(b, flow, tenant, q->flow_mode);
 
 	if (q->buffer_used > q->buffer_limit) {
 		u32  dropped = 0;
@@ -492,12 +898,35 @@ static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
 			dropped++;
 			cake_drop(sch);
 		}
-		b->drop_overlimit += dropped;
 		qdisc_tree_decrease_qlen(sch, dropped);
+
+		if (!q->overload.open)
+			cake_episode_begin(&q->overload,
+					   TC_CAKE_EPISODE_ALL_TINS,
+					   TC_CAKE_EPISODE_OVERLOAD, now);
+		q->overload.rec.dropped += dropped;
 	}
+
+	if (cake_mem_pool &&
+	    atomic_read(&cake_pool_used) > cake_mem_pool)
+		cake_pool_evict(sch);
+
+	if (q->buffer_used > q->buffer_max_used)
+		q->buffer_max_used = q->buffer_used;
+
 	return NET_XMIT_SUCCESS;
 }
 
+static s32 cake_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	cake_cycles_t start = cake_cycles();
+	s32 ret = __cake_enqueue(skb, sch);
+
+	cake_cpu_account(q, TC_CAKE_CPU_ENQUEUE, start);
+	return ret;
+}
+
 /* Callback from codel_dequeue(); sch->qstats.backlog is already handled. */
 static struct sk_buff *custom_dequeue(struct codel_vars *vars,
 				      struct Qdisc *sch)
@@ -515,45 +944,147 @@ static struct sk_buff *custom_dequeue(struct codel_vars *vars,
 		len = qdisc_pkt_len(skb);
 		b->backlogs[q->cur_flow] -= len;
 		b->tin_backlog           -= len;
-		q->buffer_used           -= skb->truesize;
+		cake_mem_uncharge(q, skb->truesize);
 		sch->q.qlen--;
 	}
 	return skb;
 }
 
+/* Callback from codel_dequeue() on every drop and mark. */
+static inline void custom_sample(struct codel_vars *vars,
+				 struct Qdisc *sch,
+				 const struct sk_buff *skb,
+				 codel_time_t now, u8 action)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+
+	if (unlikely(q->sample_rate))
+		cake_sample(sch, skb, q->cur_tin, q->cur_flow, now, action);
+}
+
+/* Callback from codel_dequeue() on every drop. */
+static inline void custom_drop(struct codel_vars *vars,
+			       struct Qdisc *sch,
+			       struct sk_buff *skb)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+
+	cake_drop_skb(sch, skb, q->cur_tin, q->cur_flow, TC_CAKE_DROP_CODEL);
+	sch->qstats.drops++;
+}
+
 /* Discard leftover packets from a tin no longer in use. */
 static void cake_clear_tin(struct Qdisc *sch, u16 tin)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
 	struct cake_tin_data *b = &q->tins[tin];
+	struct sk_buff *skb;
 
 	q->cur_tin = tin;
-	for (q->cur_flow = 0; q->cur_flow < b->flows_cnt; q->cur_flow++)
-		while (custom_dequeue(NULL, sch))
-			;
+	for (q->cur_flow = 0; q->cur_flow < b->flows_cnt; q->cur_flow++) {
+		while ((skb = custom_dequeue(NULL, sch))) {
+			sch->qstats.backlog -= qdisc_pkt_len(skb);
+			kfree_skb(skb);
+		}
+		b->flows[q->cur_flow].cvars.dropping = false;
+	}
+
+	b->dropping_flows = 0;
+	if (b->episode.open)
+		cake_episode_end(q, &b->episode, codel_get_time());
 }
 
-static struct sk_buff *cake_dequeue(struct Qdisc *sch)
+/* After a change of diffserv or flow mode, move every queued packet to
+ * the tin and flow it would be enqueued to now.  Each queue is walked head
+ * to tail and its packets appended to their new queues in that order, so
+ * nothing is reordered within a queue; packets whose place is unchanged
+ * go back where they were.  Washed packets are placed by the DSCP they
+ * now carry.  Tins no longer in use end up empty.
+ */
+static void cake_rehome(struct Qdisc *sch)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	u64 now = codel_get_time();
+	u32 c, i;
+
+	for (c = 0; c < CAKE_MAX_TINS; c++) {
+		struct cake_tin_data *b = &q->tins[c];
+
+		for (i = 0; i < b->flows_cnt; i++) {
+			struct cake_flow *flow = &b->flows[i];
+			struct sk_buff *skb = flow->head, *next;
+
+			flow->head = NULL;
+			for (; skb; skb = next) {
+				struct cake_tin_data *nb;
+				struct cake_flow *nflow;
+				u32 len = qdisc_pkt_len(skb);
+				u32 tin = 0, idx, tenant;
+
+				next = skb->next;
+				if (q->tin_mode != CAKE_MODE_BESTEFFORT) {
+					tin = q->tin_index[
+						cake_handle_diffserv(skb, 0)];
+					if (unlikely(tin >= q->tin_cnt))
+						tin = 0;
+				}
+				nb = &q->tins[tin];
+				tenant = cake_skb_tenant(skb, q->flow_mode);
+				idx = cake_hash(nb, skb, q->flow_mode, tenant);
+				nflow = &nb->flows[idx];
+
+				if (nflow != flow &&
+				    !nb->tin_backlog &&
+				    nb->tin_time_next_packet < now)
+					nb->tin_time_next_packet = now;
+
+				flow_queue_add(nflow, skb);
+				if (nflow == flow)
+					continue;
+
+				b->backlogs[i]    -= len;
+				b->tin_backlog    -= len;
+				nb->backlogs[idx] += len;
+				nb->tin_backlog   += len;
+
+				if (list_empty(&nflow->flowchain))
+					cake_flow_activate(nb, nflow, tenant,
+							   q->flow_mode);
+			}
+		}
+	}
+
+	for (c = q->tin_cnt; c < CAKE_MAX_TINS; c++)
+		cake_clear_tin(sch, c);
+}
+
+static struct sk_buff *__cake_dequeue(struct Qdisc *sch)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
 	struct sk_buff *skb;
 	struct cake_tin_data *b = &q->tins[q->cur_tin];
 	struct cake_flow *flow;
 	struct list_head *head;
-	u16 prev_drop_count, prev_ecn_mark;
+	u16 prev_drop_count, prev_ecn_mark, prev_dropping;
 	u32 len;
 	codel_time_t now = ktime_get_ns();
 	s32 i;
 
+	cake_wd_dequeue(q, now);
+
 begin:
-	if (!sch->q.qlen)
+	if (!sch->q.qlen) {
+		if (unlikely(q->overload.open))
+			cake_episode_end(q, &q->overload, now);
 		return NULL;
+	}
 
 	/* global hard shaper */
 	if (q->time_next_packet > now) {
 		sch->qstats.overlimits++;
 		codel_watchdog_schedule_ns(&q->watchdog, q->time_next_packet,
 					   true);
+		cake_wd_armed(q, q->time_next_packet);
 		return NULL;
 	}
 
@@ -591,21 +1122,50 @@ retry:
 	q->cur_flow = flow - b->flows;
 
 	if (flow->deficit <= 0) {
-		flow->deficit += b->quantum;
+		flow->deficit += cake_flow_quantum(q, b, flow);
 		list_move_tail(&flow->flowchain, &b->old_flows);
 		if (head == &b->new_flows) {
-			b->bulk_flow_count++;
+			cake_bulk_inc(b, flow);
 		}
 		goto retry;
 	}
 
 	prev_drop_count = flow->cvars.drop_count;
 	prev_ecn_mark   = flow->cvars.ecn_mark;
+	prev_dropping   = flow->cvars.dropping;
 
 	skb = codel_dequeue(sch, &flow->cvars, &q->cparams, now,
 			    q->buffer_used >
 			    (q->buffer_limit >> 2) + (q->buffer_limit >> 1));
 
+	if (unlikely(flow->cvars.dropping && !prev_dropping)) {
+		if (!b->dropping_flows++)
+			cake_episode_begin(&b->episode, q->cur_tin,
+					   TC_CAKE_EPISODE_CODEL, now);
+		if (b->dropping_flows > b->episode.rec.peak_flows)
+			b->episode.rec.peak_flows = b->dropping_flows;
+	}
+
+	if (unlikely(b->episode.open)) {
+		b->episode.rec.dropped += flow->cvars.drop_count -
+					  prev_drop_count;
+		b->episode.rec.marked  += flow->cvars.ecn_mark - prev_ecn_mark;
+		if (skb)
+			cake_episode_delay(&b->episode, skb, now);
+	}
+
+	if (unlikely(prev_dropping && !flow->cvars.dropping) &&
+	    b->dropping_flows && !--b->dropping_flows)
+		cake_episode_end(q, &b->episode, now);
+
+	if (unlikely(q->overload.open)) {
+		if (skb)
+			cake_episode_delay(&q->overload, skb, now);
+		if (q->buffer_used <=
+		    (q->buffer_limit >> 2) + (q->buffer_limit >> 1))
+			cake_episode_end(q, &q->overload, now);
+	}
+
 	b->tin_dropped  += flow->cvars.drop_count - prev_drop_count;
 	b->tin_ecn_mark += flow->cvars.ecn_mark   - prev_ecn_mark;
 	flow->cvars.ecn_mark = 0;
@@ -616,11 +1176,11 @@ retry:
 		if ((head == &b->new_flows) &&
 		    !list_empty(&b->old_flows)) {
 			list_move_tail(&flow->flowchain, &b->old_flows);
-			b->bulk_flow_count++;
+			cake_bulk_inc(b, flow);
 		} else {
 			list_del_init(&flow->flowchain);
 			if (!(head == &b->new_flows))
-				b->bulk_flow_count--;
+				cake_bulk_dec(b, flow);
 		}
 		goto begin;
 	}
@@ -647,10 +1207,128 @@ retry:
 	return skb;
 }
 
+static struct sk_buff *cake_dequeue(struct Qdisc *sch)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	cake_cycles_t start = cake_cycles();
+	struct sk_buff *skb = __cake_dequeue(sch);
+
+	cake_cpu_account(q, TC_CAKE_CPU_DEQUEUE, start);
+	return skb;
+}
+
+/* The cake root that sch is about to replace, if any. */
+static struct cake_sched_data *cake_replacing(struct Qdisc *sch)
+{
+	struct Qdisc *old;
+
+	if (sch->parent != TC_H_ROOT)
+		return NULL;
+	old = sch->dev_queue->qdisc_sleeping;
+	if (!old || old == sch || old->ops != sch->ops)
+		return NULL;
+	return qdisc_priv(old);
+}
+
+/* A replace grafts the new root in and resets the old one under its root
+ * lock, before the new one has seen a packet.  When both are cake, the
+ * new one takes the queues over instead: queued packets, every flow's
+ * CoDel state and deficit, the DRR and shaper positions, and the hash
+ * perturbation, so arriving packets find their flows again.  All
+ * instances have the same tables, so these are swapped whole and the old
+ * one keeps the new one's empty ones.  The new configuration then applies
+ * as cake_change() would apply it.
+ */
+static void cake_handover(struct Qdisc *sch, struct Qdisc *to)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	struct cake_sched_data *n = qdisc_priv(to);
+	u32 c;
+
+	for (c = 0; c < CAKE_MAX_TINS; c++) {
+		struct cake_tin_data *ob = &q->tins[c];
+		struct cake_tin_data *nb = &n->tins[c];
+
+		swap(ob->flows, nb->flows);
+		swap(ob->backlogs, nb->backlogs);
+		swap(ob->flow_tenant, nb->flow_tenant);
+		swap(ob->tenant_bulk, nb->tenant_bulk);
+		list_splice_init(&ob->new_flows, &nb->new_flows);
+		list_splice_init(&ob->old_flows, &nb->old_flows);
+		swap(ob->episode, nb->episode);
+
+		nb->perturbation         = ob->perturbation;
+		nb->bulk_flow_count      = ob->bulk_flow_count;
+		nb->dropping_flows       = ob->dropping_flows;
+		nb->tin_backlog          = ob->tin_backlog;
+		nb->tin_deficit          = ob->tin_deficit;
+		nb->tin_time_next_packet = ob->tin_time_next_packet;
+
+		ob->bulk_flow_count = 0;
+		ob->dropping_flows  = 0;
+		ob->tin_backlog     = 0;
+	}
+	swap(q->table_node, n->table_node);
+	swap(q->table_kmalloc, n->table_kmalloc);
+	swap(q->table_vmalloc, n->table_vmalloc);
+	swap(q->overload, n->overload);
+
+	n->time_next_packet = q->time_next_packet;
+	n->cur_tin  = q->cur_tin < n->tin_cnt ? q->cur_tin : 0;
+	n->cur_flow = q->cur_flow;
+
+	/* the pool already counts it */
+	n->buffer_used       = q->buffer_used;
+	n->buffer_max_used   = q->buffer_max_used;
+	to->q.qlen           = sch->q.qlen;
+	to->qstats.backlog   = sch->qstats.backlog;
+	q->buffer_used       = 0;
+	sch->q.qlen          = 0;
+	sch->qstats.backlog  = 0;
+
+	if (n->tin_mode != q->tin_mode || n->flow_mode != q->flow_mode)
+		cake_rehome(to);
+	while (n->buffer_used > n->buffer_limit)
+		cake_drop(to);
+
+	/* only now is there anything for the shrinker and the pool to take */
+	cake_instance_add(n);
+
+	/* Nothing dequeues from the new root until something runs it, and
+	 * its watchdog can't be armed while the old root is deactivated.
+	 */
+	if (to->q.qlen)
+		mod_timer(&n->kick, jiffies + 1);
+}
+
+/* After a handover, run the new root once the graft has made it the TX
+ * queue's qdisc, so that what it took over goes out on an idle link too.
+ * Until then try again every jiffy, unless it was grafted onto a device
+ * that is down.
+ */
+static void cake_kick(unsigned long arg)
+{
+	struct Qdisc *sch = (struct Qdisc *)arg;
+	struct cake_sched_data *q = qdisc_priv(sch);
+	struct netdev_queue *txq = sch->dev_queue;
+
+	if (rcu_access_pointer(txq->qdisc) == sch)
+		__netif_schedule(sch);
+	else if (txq->qdisc_sleeping != sch ||
+		 netif_running(qdisc_dev(sch)))
+		mod_timer(&q->kick, jiffies + 1);
+}
+
 static void cake_reset(struct Qdisc *sch)
 {
+	struct cake_sched_data *q = qdisc_priv(sch);
 	u32 c;
 
+	if (q->successor) {
+		cake_handover(sch, q->successor);
+		q->successor = NULL;
+	}
+
 	for (c = 0; c < CAKE_MAX_TINS; c++)
 		cake_clear_tin(sch, c);
 }
@@ -665,6 +1343,7 @@ static const struct nla_policy cake_policy[TCA_CAKE_MAX + 1] = {
 	[TCA_CAKE_TARGET]        = { .type = NLA_U32 },
 	[TCA_CAKE_MEMORY]        = { .type = NLA_U32 },
 	[TCA_CAKE_WASH]          = { .type = NLA_U32 },
+	[TCA_CAKE_SAMPLE]        = { .type = NLA_U32 },
 };
 
 static void cake_set_rate(struct cake_tin_data *b, u64 rate)
@@ -921,7 +1600,6 @@ static void cake_config_diffserv4(struct Qdisc *sch)
 static void cake_reconfigure(struct Qdisc *sch)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
-	int c;
 
 	switch (q->tin_mode) {
 	case CAKE_MODE_BESTEFFORT:
@@ -943,8 +1621,6 @@ static void cake_reconfigure(struct Qdisc *sch)
 	};
 
 	BUG_ON(q->tin_cnt > CAKE_MAX_TINS);
-	for (c = q->tin_cnt; c < CAKE_MAX_TINS; c++)
-		cake_clear_tin(sch, c);
 
 	q->rate_ns   = q->tins[0].tin_rate_ns;
 	q->rate_shft = q->tins[0].tin_rate_shft;
@@ -978,6 +1654,7 @@ static int cake_change(struct Qdisc *sch, struct nlattr *opt)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
 	struct nlattr *tb[TCA_CAKE_MAX + 1];
+	u8 tin_mode = q->tin_mode, flow_mode = q->flow_mode;
 	int err;
 
 	if (!opt)
@@ -1037,21 +1714,56 @@ static int cake_change(struct Qdisc *sch, struct nlattr *opt)
 	if (tb[TCA_CAKE_MEMORY])
 		q->buffer_config_limit = nla_get_s32(tb[TCA_CAKE_MEMORY]);
 
+	if (tb[TCA_CAKE_SAMPLE]) {
+		q->sample_rate      = nla_get_u32(tb[TCA_CAKE_SAMPLE]);
+		q->sample_countdown = q->sample_rate;
+	}
+
 	if (q->tins) {
 		sch_tree_lock(sch);
 		cake_reconfigure(sch);
+		if (q->tin_mode != tin_mode || q->flow_mode != flow_mode)
+			cake_rehome(sch);
 		sch_tree_unlock(sch);
 	}
 
 	return 0;
 }
 
-static void *cake_zalloc(size_t sz)
+/* The linear map first: physically contiguous, and usually covered by
+ * huge pages, so flows[idx] costs no extra TLB entries.  vmalloc only
+ * when no such block is free, but on the same node either way.
+ */
+static void *cake_zalloc(size_t sz, int node)
 {
-	void *ptr = kzalloc(sz, GFP_KERNEL | __GFP_NOWARN);
+	void *ptr = kzalloc_node(sz, GFP_KERNEL | __GFP_NOWARN, node);
 
 	if (!ptr)
-		ptr = vzalloc(sz);
+		ptr = vzalloc_node(sz, node);
+	return ptr;
+}
+
+/* cake_zalloc() for the tin tables, noting where each one landed. */
+static void *cake_table_zalloc(struct cake_sched_data *q, size_t sz)
+{
+	void *ptr = cake_zalloc(sz, q->table_node_wanted);
+	int node;
+
+	if (!ptr)
+		return NULL;
+
+	if (is_vmalloc_addr(ptr)) {
+		node = page_to_nid(vmalloc_to_page(ptr));
+		q->table_vmalloc += sz;
+	} else {
+		node = page_to_nid(virt_to_page(ptr));
+		q->table_kmalloc += sz;
+	}
+
+	if (q->table_kmalloc + q->table_vmalloc == sz)
+		q->table_node = node;
+	else if (q->table_node != node)
+		q->table_node = NUMA_NO_NODE;
 	return ptr;
 }
 
@@ -1061,16 +1773,131 @@ static void cake_free(void *addr)
 		kvfree(addr);
 }
 
-static void cake_destroy(struct Qdisc *sch)
+/* Memory pressure.  The shrinker trims every instance on cake_instances
+ * through cake_drop(): the head of the fattest flow, which is the oldest
+ * packet of the flow furthest over target.  buffer_limit thus stays an
+ * upper bound rather than a reservation the system can't get back.
+ * Objects are pages of queued truesize, and every instance gives up its
+ * share of a scan.
+ */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 12, 0)
+/* Drop from the fattest flows until bytes of truesize are gone.  Called
+ * under cake_instances_lock, so an instance that is busy is skipped.
+ */
+static u32 cake_trim(struct Qdisc *sch, u32 bytes)
 {
 	struct cake_sched_data *q = qdisc_priv(sch);
+	spinlock_t *root_lock = qdisc_root_sleeping_lock(sch);
+	u32 before, dropped = 0;
+
+	if (!spin_trylock(root_lock))
+		return 0;
+	before = q->buffer_used;
+	while (q->buffer_used && before - q->buffer_used < bytes) {
+		__cake_drop(sch, TC_CAKE_DROP_SHRINK);
+		dropped++;
+	}
+	if (dropped)
+		qdisc_tree_decrease_qlen(sch, dropped);
+	spin_unlock(root_lock);
+
+	return before - q->buffer_used;
+}
+
+static unsigned long cake_shrink_count(struct shrinker *shrink,
+				       struct shrink_control *sc)
+{
+	struct cake_sched_data *q;
+	unsigned long pages = 0;
+
+	spin_lock_bh(&cake_instances_lock);
+	list_for_each_entry(q, &cake_instances, instance)
+		pages += q->buffer_used >> PAGE_SHIFT;
+	spin_unlock_bh(&cake_instances_lock);
+
+	return pages;
+}
+
+static unsigned long cake_shrink_scan(struct shrinker *shrink,
+				      struct shrink_control *sc)
+{
+	unsigned long total = 0, freed = 0, share;
+	struct cake_sched_data *q;
+
+	spin_lock_bh(&cake_instances_lock);
+	list_for_each_entry(q, &cake_instances, instance)
+		total += q->buffer_used >> PAGE_SHIFT;
+
+	list_for_each_entry(q, &cake_instances, instance) {
+		if (!total)
+			break;
+		share = sc->nr_to_scan * (q->buffer_used >> PAGE_SHIFT);
+		share = DIV_ROUND_UP(share, total);
+		if (share)
+			freed += cake_trim(q->sch, share << PAGE_SHIFT);
+	}
+	spin_unlock_bh(&cake_instances_lock);
+
+	return freed ? DIV_ROUND_UP(freed, PAGE_SIZE) : SHRINK_STOP;
+}
+
+static struct shrinker cake_shrinker = {
+	.count_objects	= cake_shrink_count,
+	.scan_objects	= cake_shrink_scan,
+	.seeks		= DEFAULT_SEEKS,
+};
+
+static int cake_shrinker_register(void)
+{
+	return register_shrinker(&cake_shrinker);
+}
+
+static void cake_shrinker_unregister(void)
+{
+	unregister_shrinker(&cake_shrinker);
+}
+#else
+/* the count/scan shrinker API is 3.12 and later */
+static int cake_shrinker_register(void)
+{
+	return 0;
+}
+
+static void cake_shrinker_unregister(void)
+{
+}
+#endif
+
+static void cake_destroy(struct Qdisc *sch)
+{
+	struct cake_sched_data *q = qdisc_priv(sch), *old;
 
 	qdisc_watchdog_cancel(&q->watchdog);
+	del_timer_sync(&q->kick);
+
+	/* a replace that never got grafted */
+	old = cake_replacing(sch);
+	if (old && old->successor == sch)
+		old->successor = NULL;
+
+	/* grafted without a reset to hand over at */
+	if (q->successor)
+		cake_instance_add(qdisc_priv(q->successor));
+
+	/* zeroed if cake_init() never got that far */
+	if (q->instance.next) {
+		spin_lock_bh(&cake_instances_lock);
+		list_del_init(&q->instance);
+		spin_unlock_bh(&cake_instances_lock);
+	}
 
 	if (q->tins) {
 		u32 i;
 
 		for (i = 0; i < CAKE_MAX_TINS; i++) {
+			cake_free(q->tins[i].tenant_bulk);
+			cake_free(q->tins[i].flow_tenant);
 			cake_free(q->tins[i].backlogs);
 			cake_free(q->tins[i].flows);
 		}
@@ -1080,9 +1907,11 @@ static void cake_destroy(struct Qdisc *sch)
 
 static int cake_init(struct Qdisc *sch, struct nlattr *opt)
 {
-	struct cake_sched_data *q = qdisc_priv(sch);
+	struct cake_sched_data *q = qdisc_priv(sch), *old;
 	int i, j;
 
+	setup_timer(&q->kick, cake_kick, (unsigned long)sch);
+
 	sch->limit = 10240;
 	q->tin_mode = CAKE_MODE_DIFFSERV4;
 	q->flow_mode  = CAKE_FLOW_FLOWS;
@@ -1106,24 +1935,34 @@ static int cake_init(struct Qdisc *sch, struct nlattr *opt)
 
 	qdisc_watchdog_init(&q->watchdog, sch);
 
-	q->tins = cake_zalloc(CAKE_MAX_TINS * sizeof(struct cake_tin_data));
+	/* next to the CPUs that transmit, where the driver has said so */
+	q->table_node_wanted = netdev_queue_numa_node_read(sch->dev_queue);
+	q->table_node = NUMA_NO_NODE;
+
+	q->tins = cake_table_zalloc(q, CAKE_MAX_TINS *
+				    sizeof(struct cake_tin_data));
 	if (!q->tins)
 		goto nomem;
 
 	for (i = 0; i < CAKE_MAX_TINS; i++) {
 		struct cake_tin_data *b = q->tins + i;
 
-		b->flows_cnt = 1024;
+		b->flows_cnt = CAKE_QUEUES;
 		b->perturbation = prandom_u32();
 		INIT_LIST_HEAD(&b->new_flows);
 		INIT_LIST_HEAD(&b->old_flows);
 		b->bulk_flow_count = 0;
 		/* codel_params_init(&b->cparams); */
 
-		b->flows    = cake_zalloc(b->flows_cnt *
-					     sizeof(struct cake_flow));
-		b->backlogs = cake_zalloc(b->flows_cnt * sizeof(u32));
-		if (!b->flows || !b->backlogs)
+		b->flows    = cake_table_zalloc(q, b->flows_cnt *
+						   sizeof(struct cake_flow));
+		b->backlogs = cake_table_zalloc(q, b->flows_cnt * sizeof(u32));
+		b->flow_tenant = cake_table_zalloc(q, b->flows_cnt *
+						      sizeof(u16));
+		b->tenant_bulk = cake_table_zalloc(q, b->flows_cnt *
+						      sizeof(u16));
+		if (!b->flows || !b->backlogs ||
+		    !b->flow_tenant || !b->tenant_bulk)
 			goto nomem;
 
 		for (j = 0; j < b->flows_cnt; j++) {
@@ -1135,6 +1974,15 @@ static int cake_init(struct Qdisc *sch, struct nlattr *opt)
 	}
 
 	cake_reconfigure(sch);
+
+	q->sch = sch;
+
+	/* a successor joins cake_instances when it takes the queues over */
+	old = cake_replacing(sch);
+	if (old)
+		old->successor = sch;
+	else
+		cake_instance_add(q);
 	return 0;
 
 nomem:
@@ -1183,6 +2031,9 @@ static int cake_dump(struct Qdisc *sch, struct sk_buff *skb)
 	if (nla_put_u32(skb, TCA_CAKE_MEMORY, q->buffer_config_limit))
 		goto nla_put_failure;
 
+	if (nla_put_u32(skb, TCA_CAKE_SAMPLE, q->sample_rate))
+		goto nla_put_failure;
+
 	return nla_nest_end(skb, opts);
 
 nla_put_failure:
@@ -1193,15 +2044,15 @@ static int cake_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
 {
 	/* reuse fq_codel stats format */
 	struct cake_sched_data *q = qdisc_priv(sch);
-	struct tc_cake_xstats *st = cake_zalloc(sizeof(*st));
-	int i;
+	struct tc_cake_xstats *st = cake_zalloc(sizeof(*st), NUMA_NO_NODE);
+	int i, j;
 
 	if (!st)
 		return -1;
 
 	BUG_ON(q->tin_cnt > TC_CAKE_MAX_TINS);
 
-	st->version = 3;
+	st->version = 10;
 	st->max_tins = TC_CAKE_MAX_TINS;
 	st->tin_cnt = q->tin_cnt;
 
@@ -1220,6 +2071,9 @@ static int cake_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
 		st->ecn_marked[i].packets = b->tin_ecn_mark;
 		st->backlog[i].bytes      = b->tin_backlog;
 
+		for (j = 0; j < TC_CAKE_DROP_MAX; j++)
+			st->drops[j][i] = b->drops[j];
+
 		st->peak_delay_us[i] = 0;
 		st->avge_delay_us[i] = 0;
 		st->base_delay_us[i] = 0;
@@ -1234,7 +2088,32 @@ static int cake_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
 		st->max_skblen[i]        = 0;
 	}
 	st->memory_limit      = q->buffer_limit;
-	st->memory_used       = 0;
+	st->memory_used       = q->buffer_used;
+	st->memory_max_used   = q->buffer_max_used;
+
+	st->table_node_wanted = q->table_node_wanted;
+	st->table_node        = q->table_node;
+	st->table_kmalloc     = q->table_kmalloc;
+	st->table_vmalloc     = q->table_vmalloc;
+
+	st->pool_limit        = cake_mem_pool;
+	st->pool_min          = cake_mem_min;
+	st->pool_used         = atomic_read(&cake_pool_used);
+
+#ifdef CAKE_CPUSTATS
+	st->cpu_stats = 1;
+	memcpy(st->cpu, q->cpu_cost, sizeof(st->cpu));
+#endif
+#ifdef CAKE_WDSTATS
+	st->wd_stats       = 1;
+	st->wd_wakes       = q->wd_wakes;
+	st->wd_late_max_ns = q->wd_late_max;
+	memcpy(st->wd_late, q->wd_late, sizeof(st->wd_late));
+#endif
+
+	st->episode_seq  = q->episode_seq;
+	st->episode_ring = TC_CAKE_EPISODE_RING;
+	memcpy(st->episodes, q->episodes, sizeof(st->episodes));
 
 	i = gnet_stats_copy_app(d, st, sizeof(*st));
 	cake_free(st);
@@ -1379,12 +2258,26 @@ static struct Qdisc_ops cake_qdisc_ops __read_mostly = {
 
 static int __init cake_module_init(void)
 {
-	return register_qdisc(&cake_qdisc_ops);
+	int i, err;
+
+	for (i = 1; i <= CAKE_QUEUES; i++)
+		quantum_div[i] = 65535 / i;
+
+	err = cake_shrinker_register();
+
+	if (err)
+		return err;
+
+	err = register_qdisc(&cake_qdisc_ops);
+	if (err)
+		cake_shrinker_unregister();
+	return err;
 }
 
 static void __exit cake_module_exit(void)
 {
 	unregister_qdisc(&cake_qdisc_ops);
+	cake_shrinker_unregister();
 }
 
 module_init(cake_module_init)
@@ -0,0 +1,454 @@
+/*
+ * cakebench - hot-path microbenchmarks for sch_cake.c
+ *
+ * Builds the qdisc against the kernel shim, like libcake, but in this
+ * translation unit so that its static helpers can be timed on their own:
+ * cake_hash(), cake_enqueue(), cake_dequeue(), cake_drop() and
+ * codel_dequeue().  Sweeps flow counts, tin modes and packet size mixes and
+ * prints one CSV row (or JSON line) per combination with ns/op and, where
+ * perf_event_open() is allowed, cycles, instructions, branch misses and
+ * LLC misses per op.
+ *
+ *	cakebench > before.csv; (apply patch); cakebench > after.csv
+ */
+
+#include <time.h>
+#include <getopt.h>
+#include "../sch_cake.c"
+#include "perfctr.h"
+#include "util.h"
+
+enum { MIX_SMALL, MIX_LARGE, MIX_IMIX, MIX_MAX };
+static const char * const mix_names[MIX_MAX] = { "64", "1500", "imix" };
+
+enum {
+	TEST_HASH, TEST_ENQUEUE, TEST_DEQUEUE, TEST_DROP, TEST_CODEL,
+	TEST_MAX
+};
+static const char * const test_names[TEST_MAX] = {
+	"cake_hash", "cake_enqueue", "cake_dequeue", "cake_drop",
+	"codel_dequeue",
+};
+
+static const char * const tin_names[CAKE_MODE_MAX] = {
+	[CAKE_MODE_BESTEFFORT] = "besteffort",
+	[CAKE_MODE_PRECEDENCE] = "precedence",
+	[CAKE_MODE_DIFFSERV8]  = "diffserv8",
+	[CAKE_MODE_DIFFSERV4]  = "diffserv4",
+};
+
+/* a spread of codepoints so that every tin mode uses several tins */
+static const u8 bench_dscp[] = { 0, 8, 10, 18, 26, 34, 46, 48 };
+
+static struct {
+	int		rounds;
+	int		json;
+	u32		min_pool;
+	u32		tests;		/* bitmask */
+} cfg = {
+	.rounds = 5, .min_pool = 16384, .tests = (1 << TEST_MAX) - 1,
+};
+
+static struct perfctr pc;
+static struct net_device bench_dev = {
+	.name = "bench0", .ifindex = 1, .mtu = 1500, .hard_header_len = 14,
+};
+
+struct result {
+	u64	ops;
+	u64	ns;
+	u64	ctr[PERFCTR_MAX];
+};
+
+static u64 wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void timer_start(struct result *r)
+{
+	perfctr_start(&pc);
+	r->ns -= wall_ns();
+}
+
+static void timer_stop(struct result *r, u64 ops)
+{
+	int i;
+
+	r->ns += wall_ns();
+	perfctr_stop(&pc);
+	r->ops += ops;
+	for (i = 0; i < PERFCTR_MAX; i++)
+		r->ctr[i] = (r->ctr[i] == PERFCTR_NONE ||
+			     pc.delta[i] == PERFCTR_NONE) ?
+			    PERFCTR_NONE : r->ctr[i] + pc.delta[i];
+}
+
+/* ---- setup ---- */
+
+static struct Qdisc *bench_qdisc(int tin_mode)
+{
+	struct sk_buff *msg = alloc_skb(64, GFP_KERNEL);
+	struct Qdisc *sch = calloc(1, QDISC_ALIGN(sizeof(struct Qdisc)) +
+				      cake_qdisc_ops.priv_size);
+	struct nlattr *nest;
+
+	if (!msg || !sch)
+		abort();
+
+	/* unshaped, and enough memory that nothing is evicted */
+	nest = nla_nest_start(msg, TCA_OPTIONS);
+	nla_put_u32(msg, TCA_CAKE_DIFFSERV_MODE, tin_mode);
+	nla_put_u32(msg, TCA_CAKE_MEMORY, 1U << 31);
+	nla_nest_end(msg, nest);
+
+	sch->ops = &cake_qdisc_ops;
+	sch->dev = &bench_dev;
+	sch->handle = 0x10000;
+	if (cake_qdisc_ops.init(sch, nest))
+		abort();
+	consume_skb(msg);
+	return sch;
+}
+
+static void bench_qdisc_free(struct Qdisc *sch)
+{
+	struct sk_buff *skb;
+
+	while ((skb = cake_qdisc_ops.dequeue(sch)))
+		consume_skb(skb);
+	cake_qdisc_ops.destroy(sch);
+	free(sch);
+}
+
+static u32 mix_len(int mix, u32 i)
+{
+	static const u32 imix[12] = { 64, 64, 64, 64, 64, 64, 64,
+				      576, 576, 576, 576, 1500 };
+
+	switch (mix) {
+	case MIX_SMALL:
+		return 64;
+	case MIX_LARGE:
+		return 1500;
+	default:
+		return imix[i % 12];
+	}
+}
+
+/* An IPv4/UDP packet belonging to flow f; ECT(0) so CoDel marks. */
+static struct sk_buff *bench_skb(u32 f, u32 len)
+{
+	struct sk_buff *skb = alloc_skb(len, GFP_KERNEL);
+	struct tuple t = { .proto = IPPROTO_UDP, .dport = 53 };
+
+	if (!skb)
+		abort();
+
+	tuple_v4(t.src, f);
+	tuple_v4(t.dst, 1);
+	t.sport = (0x80 | (f & 0x3f)) << 8 | (f >> 6 & 0xff);
+	build_pkt(skb->data, &t, (bench_dscp[f % sizeof(bench_dscp)] << 2) |
+		  INET_ECN_ECT_0, len);
+
+	skb->len      = len;
+	skb->dev      = &bench_dev;
+	skb->protocol = htons(ETH_P_IP);
+	return skb;
+}
+
+static void bench_prep(struct sk_buff *skb)
+{
+	skb->next = NULL;
+	qdisc_skb_cb(skb)->pkt_len = skb->len;
+}
+
+/* ---- tests ---- */
+
+static void run_hash(struct Qdisc *sch, struct sk_buff **pool, u32 n,
+		     struct result *r)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	volatile u32 sink = 0;
+	u32 i;
+
+	timer_start(r);
+	for (i = 0; i < n; i++)
+		sink += cake_hash(&q->tins[0], pool[i], q->flow_mode,
+				  cake_skb_tenant(pool[i], q->flow_mode));
+	timer_stop(r, n);
+	(void)sink;
+}
+
+static void run_enqueue_dequeue(struct Qdisc *sch, struct sk_buff **pool,
+				u32 n, struct result *enq,
+				struct result *deq)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++)
+		bench_prep(pool[i]);
+
+	timer_start(enq);
+	for (i = 0; i < n; i++)
+		cake_enqueue(pool[i], sch);
+	timer_stop(enq, n);
+
+	timer_start(deq);
+	for (i = 0; i < n; i++) {
+		pool[i] = cake_dequeue(sch);
+		if (!pool[i])
+			break;
+	}
+	timer_stop(deq, i);
+
+	if (i != n) {
+		fprintf(stderr, "dequeued %u of %u packets\n", i, n);
+		exit(1);
+	}
+}
+
+/* cake_drop() frees what it drops, so the pool is rebuilt afterwards. */
+static void run_drop(struct Qdisc *sch, struct sk_buff **pool, u32 n,
+		     u32 flows, int mix, struct result *r)
+{
+	u32 i, drops = min_t(u32, n / 2, 4096);
+
+	for (i = 0; i < n; i++) {
+		bench_prep(pool[i]);
+		cake_enqueue(pool[i], sch);
+	}
+
+	timer_start(r);
+	for (i = 0; i < drops; i++)
+		cake_drop(sch);
+	timer_stop(r, drops);
+
+	for (i = 0; i < n - drops; i++)
+		pool[i] = cake_dequeue(sch);
+	for (; i < n; i++)
+		pool[i] = bench_skb(i % flows, mix_len(mix, i));
+}
+
+/* One queue, every packet well past target, so each call runs the
+ * dropping-state control law and marks.
+ */
+static void run_codel(struct Qdisc *sch, struct sk_buff **pool, u32 n,
+		      struct result *r)
+{
+	struct cake_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *head = NULL;
+	struct cake_flow *flow;
+	u32 i, got = 0;
+
+	shim_now = 0;
+	for (i = 0; i < n; i++) {
+		bench_prep(pool[i]);
+		pool[i]->data[1] = INET_ECN_ECT_0;	/* same tin */
+		pool[i]->data[13] = pool[i]->data[14] = 0;
+		pool[i]->data[15] = pool[i]->data[20] = pool[i]->data[21] = 0;
+		cake_enqueue(pool[i], sch);
+	}
+	shim_now = 10 * NSEC_PER_SEC;
+
+	q->cur_tin = q->tin_mode == CAKE_MODE_BESTEFFORT ? 0 :
+		     q->tin_index[0];
+	q->cur_flow = cake_hash(&q->tins[q->cur_tin], pool[0], q->flow_mode,
+				cake_skb_tenant(pool[0], q->flow_mode));
+	flow = &q->tins[q->cur_tin].flows[q->cur_flow];
+
+	timer_start(r);
+	for (i = 0; i < n; i++) {
+		struct sk_buff *skb = codel_dequeue(sch, &flow->cvars,
+						    &q->cparams, shim_now,
+						    false);
+		if (!skb)
+			break;
+		skb->next = head;
+		head = skb;
+	}
+	timer_stop(r, i);
+
+	while (head) {
+		pool[got] = head;
+		head = head->next;
+		pool[got]->data[1] = INET_ECN_ECT_0;
+		got++;
+	}
+	shim_now = 0;
+	if (got != n) {
+		fprintf(stderr, "codel returned %u of %u packets\n", got, n);
+		exit(1);
+	}
+	list_del_init(&flow->flowchain);
+	codel_vars_init(&flow->cvars);
+}
+
+/* ---- driver ---- */
+
+static void print_result(int test, int tin_mode, u32 flows, int mix,
+			 const struct result *r)
+{
+	double ops = r->ops ? r->ops : 1;
+	int i;
+
+	if (cfg.json) {
+		printf("{\"test\":\"%s\",\"tin_mode\":\"%s\",\"flows\":%u,"
+		       "\"mix\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.2f",
+		       test_names[test], tin_names[tin_mode], flows,
+		       mix_names[mix], (unsigned long long)r->ops,
+		       r->ns / ops);
+		for (i = 0; i < PERFCTR_MAX; i++) {
+			if (r->ctr[i] == PERFCTR_NONE)
+				printf(",\"%s_per_op\":null",
+				       perfctr_names[i]);
+			else
+				printf(",\"%s_per_op\":%.2f",
+				       perfctr_names[i], r->ctr[i] / ops);
+		}
+		printf("}\n");
+		return;
+	}
+
+	printf("%s,%s,%u,%s,%llu,%.2f", test_names[test],
+	       tin_names[tin_mode], flows, mix_names[mix],
+	       (unsigned long long)r->ops, r->ns / ops);
+	for (i = 0; i < PERFCTR_MAX; i++) {
+		if (r->ctr[i] == PERFCTR_NONE)
+			printf(",");
+		else
+			printf(",%.2f", r->ctr[i] / ops);
+	}
+	printf("\n");
+}
+
+static void bench(int tin_mode, u32 flows, int mix)
+{
+	u32 n = max(flows, cfg.min_pool), i;
+	struct sk_buff **pool = calloc(n, sizeof(*pool));
+	struct result res[TEST_MAX];
+	struct Qdisc *sch;
+	int t, round;
+
+	if (!pool)
+		abort();
+
+	memset(res, 0, sizeof(res));
+	shim_seed(1);
+	sch = bench_qdisc(tin_mode);
+	for (i = 0; i < n; i++)
+		pool[i] = bench_skb(i % flows, mix_len(mix, i));
+
+	for (round = 0; round < cfg.rounds; round++) {
+		if (cfg.tests & (1 << TEST_HASH))
+			run_hash(sch, pool, n, &res[TEST_HASH]);
+		if (cfg.tests & (1 << TEST_ENQUEUE | 1 << TEST_DEQUEUE))
+			run_enqueue_dequeue(sch, pool, n, &res[TEST_ENQUEUE],
+					    &res[TEST_DEQUEUE]);
+		if (cfg.tests & (1 << TEST_DROP))
+			run_drop(sch, pool, n, flows, mix, &res[TEST_DROP]);
+	}
+
+	/* CoDel only ever sees one queue, so flows don't matter to it */
+	if ((cfg.tests & (1 << TEST_CODEL)) && flows == 16)
+		for (round = 0; round < cfg.rounds; round++)
+			run_codel(sch, pool, n, &res[TEST_CODEL]);
+
+	for (t = 0; t < TEST_MAX; t++)
+		if (res[t].ops)
+			print_result(t, tin_mode, flows, mix, &res[t]);
+	fflush(stdout);
+
+	bench_qdisc_free(sch);
+	for (i = 0; i < n; i++)
+		consume_skb(pool[i]);
+	free(pool);
+}
+
+static u32 parse_list(char *arg, const char * const *names, int n)
+{
+	u32 mask = 0;
+	char *tok;
+	int i;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		for (i = 0; i < n; i++)
+			if (names[i] && !strcmp(tok, names[i]))
+				break;
+		if (i == n) {
+			fprintf(stderr, "unknown '%s'\n", tok);
+			exit(2);
+		}
+		mask |= 1 << i;
+	}
+	return mask;
+}
+
+int main(int argc, char **argv)
+{
+	u32 flow_counts[16] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+	int nflows = 7, f, c, m, d;
+	u32 modes = 1 << CAKE_MODE_BESTEFFORT | 1 << CAKE_MODE_DIFFSERV4 |
+		    1 << CAKE_MODE_DIFFSERV8 | 1 << CAKE_MODE_PRECEDENCE;
+	u32 mixes = (1 << MIX_MAX) - 1;
+
+	while ((c = getopt(argc, argv, "f:d:m:t:r:p:jh")) != -1) {
+		switch (c) {
+		case 'f': {
+			char *tok;
+
+			nflows = 0;
+			for (tok = strtok(optarg, ","); tok && nflows < 16;
+			     tok = strtok(NULL, ","))
+				flow_counts[nflows++] = max(atoi(tok), 1);
+			break;
+		}
+		case 'd':
+			modes = parse_list(optarg, tin_names, CAKE_MODE_MAX);
+			break;
+		case 'm':
+			mixes = parse_list(optarg, mix_names, MIX_MAX);
+			break;
+		case 't':
+			cfg.tests = parse_list(optarg, test_names, TEST_MAX);
+			break;
+		case 'r':
+			cfg.rounds = max(atoi(optarg), 1);
+			break;
+		case 'p':
+			cfg.min_pool = max(atoi(optarg), 16);
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-f flows,...] [-d tinmodes] "
+				"[-m 64,1500,imix] [-t tests] [-r rounds] "
+				"[-p pool] [-j]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	perfctr_open(&pc);
+	cake_module_init();
+
+	if (!cfg.json) {
+		printf("test,tin_mode,flows,mix,ops,ns_per_op");
+		for (c = 0; c < PERFCTR_MAX; c++)
+			printf(",%s_per_op", perfctr_names[c]);
+		printf("\n");
+	}
+
+	for (d = 0; d < CAKE_MODE_MAX; d++)
+		for (m = 0; m < MIX_MAX; m++)
+			for (f = 0; f < nflows; f++)
+				if ((modes & (1 << d)) && (mixes & (1 << m)))
+					bench(d, flow_counts[f], m);
+
+	perfctr_close(&pc);
+	return 0;
+}
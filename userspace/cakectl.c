@@ -0,0 +1,673 @@
+/*
+ * cakectl - configure cake and read its statistics over rtnetlink
+ *
+ * Talks to the module directly using the TCA_CAKE_* attributes and
+ * struct tc_cake_xstats from this tree's pkt_sched.h, so a freshly built
+ * sch_cake.ko can be driven without a matching tc binary.
+ *
+ *	cakectl add dev eth0 bandwidth 20mbit diffserv diffserv4 flows flows
+ *	cakectl stats dev eth0 [json]
+ *	cakectl del dev eth0
+ *
+ * "stats sock PATH" reads the same statistics from a caked instance.
+ */
+
+#include "../pkt_sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/gen_stats.h>
+#include "util.h"
+
+static const char * const drop_names[TC_CAKE_DROP_MAX] = {
+	"codel", "overlimit", "pool", "shrink", "gso",
+};
+static const char * const cpu_names[TC_CAKE_CPU_MAX] = {
+	"enqueue", "dequeue", "drop", "gso",
+};
+static const char * const episode_names[] = { "codel", "overload" };
+
+struct nlreq {
+	struct nlmsghdr	n;
+	struct tcmsg	t;
+	char		buf[1024];
+};
+
+static int nl_fd = -1;
+static uint32_t nl_seq;
+
+static void die(const char *msg)
+{
+	fprintf(stderr, "cakectl: %s\n", msg);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: cakectl {add|change|replace} dev IFACE [parent X:Y] "
+		"[handle X:] [options]\n"
+		"       cakectl del dev IFACE [parent X:Y]\n"
+		"       cakectl stats {dev IFACE | sock PATH} [json]\n"
+		"options: bandwidth RATE | unlimited, diffserv MODE, "
+		"flows MODE,\n"
+		"         atm | noatm, overhead BYTES, rtt US, target US, "
+		"autorate,\n"
+		"         memlimit BYTES, wash | nowash, sample N\n");
+	exit(2);
+}
+
+static struct rtattr *addattr(struct nlmsghdr *n, unsigned int maxlen,
+			      int type, const void *data, unsigned int len)
+{
+	struct rtattr *rta = (void *)n + NLMSG_ALIGN(n->nlmsg_len);
+
+	if (NLMSG_ALIGN(n->nlmsg_len) + RTA_LENGTH(len) > maxlen)
+		die("message too long");
+
+	rta->rta_type = type;
+	rta->rta_len  = RTA_LENGTH(len);
+	if (len)
+		memcpy(RTA_DATA(rta), data, len);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return rta;
+}
+
+static void addattr32(struct nlmsghdr *n, unsigned int maxlen, int type,
+		      uint32_t v)
+{
+	addattr(n, maxlen, type, &v, sizeof(v));
+}
+
+static void nl_open(void)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl_fd < 0 || bind(nl_fd, (struct sockaddr *)&sa, sizeof(sa)))
+		die(strerror(errno));
+	nl_seq = time(NULL);
+}
+
+static void nl_send(struct nlmsghdr *n)
+{
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	n->nlmsg_seq = ++nl_seq;
+	if (sendto(nl_fd, n, n->nlmsg_len, 0, (struct sockaddr *)&sa,
+		   sizeof(sa)) < 0)
+		die(strerror(errno));
+}
+
+/* Read replies to the last request, handing each RTM_NEWQDISC to fn.
+ * Returns the kernel's error code, 0 on success.
+ */
+static int nl_recv(void (*fn)(struct nlmsghdr *, void *), void *arg)
+{
+	static char buf[32768];
+
+	for (;;) {
+		struct nlmsghdr *n;
+		ssize_t len = recv(nl_fd, buf, sizeof(buf), 0);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			die(strerror(errno));
+		}
+
+		for (n = (void *)buf; NLMSG_OK(n, len);
+		     n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_seq != nl_seq)
+				continue;
+			if (n->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (n->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(n);
+
+				return e->error;
+			}
+			if (fn)
+				fn(n, arg);
+		}
+	}
+}
+
+static uint32_t parse_handle(const char *s)
+{
+	char *end;
+	uint32_t maj = strtoul(s, &end, 16), min = 0;
+
+	if (*end == ':' && end[1])
+		min = strtoul(end + 1, &end, 16);
+	else if (*end == ':')
+		end++;
+	if (*end)
+		usage();
+	return TC_H_MAKE(maj << 16, min);
+}
+
+/* in bytes/s, as TCA_CAKE_BASE_RATE takes it */
+static uint32_t rate_arg(const char *s)
+{
+	double v = parse_rate(s);
+
+	if (v < 0)
+		usage();
+	if (v / 8 > UINT32_MAX)
+		die("rate out of range");
+	return v / 8;
+}
+
+/* a name from names[], which the module range-checks */
+static int mode_arg(const char *name, const char * const *names, int n)
+{
+	int i = lookup(name, names, n);
+
+	if (i < 0)
+		usage();
+	return i;
+}
+
+#define NEXT_ARG() do { if (!*++argv) usage(); } while (0)
+
+static int cmd_modify(int cmd, int flags, char **argv)
+{
+	struct nlreq req;
+	struct rtattr *opts;
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len   = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.n.nlmsg_type  = cmd;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	req.t.tcm_family  = AF_UNSPEC;
+	req.t.tcm_parent  = TC_H_ROOT;
+
+	addattr(&req.n, sizeof(req), TCA_KIND, "cake", sizeof("cake"));
+	opts = addattr(&req.n, sizeof(req), TCA_OPTIONS, NULL, 0);
+
+	for (; *argv; argv++) {
+		if (!strcmp(*argv, "dev")) {
+			NEXT_ARG();
+			req.t.tcm_ifindex = if_nametoindex(*argv);
+			if (!req.t.tcm_ifindex)
+				die("no such device");
+		} else if (!strcmp(*argv, "parent")) {
+			NEXT_ARG();
+			req.t.tcm_parent = parse_handle(*argv);
+		} else if (!strcmp(*argv, "root")) {
+			req.t.tcm_parent = TC_H_ROOT;
+		} else if (!strcmp(*argv, "handle")) {
+			NEXT_ARG();
+			req.t.tcm_handle = parse_handle(*argv);
+		} else if (!strcmp(*argv, "bandwidth")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_BASE_RATE,
+				  rate_arg(*argv));
+		} else if (!strcmp(*argv, "unlimited")) {
+			addattr32(&req.n, sizeof(req), TCA_CAKE_BASE_RATE, 0);
+		} else if (!strcmp(*argv, "diffserv")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_DIFFSERV_MODE,
+				  mode_arg(*argv, diffserv_names,
+					   CAKE_DIFFSERV_NAMES));
+		} else if (!strcmp(*argv, "flows")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_FLOW_MODE,
+				  mode_arg(*argv, flow_names,
+					   CAKE_FLOW_NAMES));
+		} else if (!strcmp(*argv, "atm") || !strcmp(*argv, "noatm")) {
+			addattr32(&req.n, sizeof(req), TCA_CAKE_ATM,
+				  **argv == 'a');
+		} else if (!strcmp(*argv, "wash") || !strcmp(*argv, "nowash")) {
+			addattr32(&req.n, sizeof(req), TCA_CAKE_WASH,
+				  **argv == 'w');
+		} else if (!strcmp(*argv, "autorate")) {
+			addattr32(&req.n, sizeof(req), TCA_CAKE_AUTORATE, 1);
+		} else if (!strcmp(*argv, "overhead")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_OVERHEAD,
+				  (int32_t)strtol(*argv, NULL, 0));
+		} else if (!strcmp(*argv, "rtt")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_RTT,
+				  strtoul(*argv, NULL, 0));
+		} else if (!strcmp(*argv, "target")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_TARGET,
+				  strtoul(*argv, NULL, 0));
+		} else if (!strcmp(*argv, "memlimit")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_MEMORY,
+				  strtoul(*argv, NULL, 0));
+		} else if (!strcmp(*argv, "sample")) {
+			NEXT_ARG();
+			addattr32(&req.n, sizeof(req), TCA_CAKE_SAMPLE,
+				  strtoul(*argv, NULL, 0));
+		} else {
+			usage();
+		}
+	}
+	if (!req.t.tcm_ifindex)
+		usage();
+
+	opts->rta_len = (void *)&req.n + req.n.nlmsg_len - (void *)opts;
+	if (cmd == RTM_DELQDISC)
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+
+	nl_send(&req.n);
+	return nl_recv(NULL, NULL);
+}
+
+/* ---- stats ---- */
+
+struct stats {
+	int				ifindex;
+	int				json;
+	int				found;
+	struct gnet_stats_basic		bstats;
+	struct gnet_stats_queue		qstats;
+	struct tc_cake_xstats		xstats;
+	unsigned int			xstats_len;
+};
+
+/* The attributes inside TCA_STATS2, which caked sends as they are. */
+static void parse_stats2(struct stats *st, struct rtattr *s, int slen)
+{
+	for (; RTA_OK(s, slen); s = RTA_NEXT(s, slen)) {
+		unsigned int plen = RTA_PAYLOAD(s);
+
+		switch (s->rta_type) {
+		case TCA_STATS_BASIC:
+			memcpy(&st->bstats, RTA_DATA(s),
+			       plen < sizeof(st->bstats) ?
+			       plen : sizeof(st->bstats));
+			break;
+		case TCA_STATS_QUEUE:
+			memcpy(&st->qstats, RTA_DATA(s),
+			       plen < sizeof(st->qstats) ?
+			       plen : sizeof(st->qstats));
+			break;
+		case TCA_STATS_APP:
+			st->xstats_len = plen < sizeof(st->xstats) ?
+					 plen : sizeof(st->xstats);
+			memcpy(&st->xstats, RTA_DATA(s), st->xstats_len);
+			break;
+		}
+	}
+}
+
+static void parse_stats(struct nlmsghdr *n, void *arg)
+{
+	struct stats *st = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *rta = TCA_RTA(t);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+
+	if (n->nlmsg_type != RTM_NEWQDISC || t->tcm_ifindex != st->ifindex)
+		return;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == TCA_KIND &&
+		    strcmp(RTA_DATA(rta), "cake"))
+			return;
+		if (rta->rta_type != TCA_STATS2)
+			continue;
+
+		st->found = 1;
+		parse_stats2(st, RTA_DATA(rta), RTA_PAYLOAD(rta));
+	}
+}
+
+static void sock_stats(struct stats *st, const char *path)
+{
+	static char buf[8192];
+	struct sockaddr_un sun;
+	struct timeval tv = { .tv_sec = 1 };
+	sa_family_t af = AF_UNIX;
+	int fd, len;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+	/* autobind, so that there is an address to answer to */
+	if (bind(fd, (struct sockaddr *)&af, sizeof(af)) < 0)
+		die("bind");
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+	if (sendto(fd, "", 1, 0, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		die("no caked listening on that socket");
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0)
+		die("no answer from caked");
+	close(fd);
+
+	st->found = 1;
+	parse_stats2(st, (struct rtattr *)buf, len);
+}
+
+#define XSTATS_HAS(st, field) \
+	((st)->xstats_len >= offsetof(struct tc_cake_xstats, field) + \
+			     sizeof((st)->xstats.field))
+
+/* The ring as the sender sized it, within the one we know of. */
+static uint32_t episode_ring(const struct tc_cake_xstats *x)
+{
+	return x->episode_ring && x->episode_ring <= TC_CAKE_EPISODE_RING ?
+	       x->episode_ring : TC_CAKE_EPISODE_RING;
+}
+
+/* The oldest episode still in the ring, and one past the newest. */
+static void episode_range(const struct tc_cake_xstats *x, uint32_t *first,
+			  uint32_t *end)
+{
+	*end = x->episode_seq;
+	*first = *end > episode_ring(x) ? *end - episode_ring(x) : 0;
+}
+
+static const struct tc_cake_episode *
+episode_at(const struct tc_cake_xstats *x, uint32_t n)
+{
+	return &x->episodes[n % episode_ring(x)];
+}
+
+static const char *episode_name(const struct tc_cake_episode *e)
+{
+	return e->type < sizeof(episode_names) / sizeof(episode_names[0]) ?
+	       episode_names[e->type] : "unknown";
+}
+
+static void print_stats_json(const struct stats *st)
+{
+	const struct tc_cake_xstats *x = &st->xstats;
+	int i, j;
+
+	printf("{\"bytes\":%llu,\"packets\":%u,\"drops\":%u,"
+	       "\"overlimits\":%u,\"backlog\":%u,\"qlen\":%u",
+	       (unsigned long long)st->bstats.bytes, st->bstats.packets,
+	       st->qstats.drops, st->qstats.overlimits, st->qstats.backlog,
+	       st->qstats.qlen);
+	if (XSTATS_HAS(st, memory_used))
+		printf(",\"memory_used\":%u,\"memory_limit\":%u",
+		       x->memory_used, x->memory_limit);
+	if (XSTATS_HAS(st, memory_max_used))
+		printf(",\"memory_max_used\":%u", x->memory_max_used);
+	if (XSTATS_HAS(st, table_vmalloc))
+		printf(",\"table_node_wanted\":%d,\"table_node\":%d,"
+		       "\"table_kmalloc\":%u,\"table_vmalloc\":%u",
+		       x->table_node_wanted, x->table_node,
+		       x->table_kmalloc, x->table_vmalloc);
+	if (XSTATS_HAS(st, pool_used) && x->pool_limit)
+		printf(",\"pool_limit\":%u,\"pool_min\":%u,\"pool_used\":%u",
+		       x->pool_limit, x->pool_min, x->pool_used);
+	printf(",\"tins\":[");
+	for (i = 0; i < x->tin_cnt && i < TC_CAKE_MAX_TINS; i++) {
+		printf("%s{\"sent_packets\":%u,\"sent_bytes\":%llu,"
+		       "\"dropped\":%u,\"marked\":%u,\"peak_delay_us\":%u,"
+		       "\"avg_delay_us\":%u,\"base_delay_us\":%u,"
+		       "\"sparse_flows\":%u,\"bulk_flows\":%u",
+		       i ? "," : "", x->sent[i].packets,
+		       (unsigned long long)x->sent[i].bytes,
+		       x->dropped[i].packets, x->ecn_marked[i].packets,
+		       x->peak_delay_us[i], x->avge_delay_us[i],
+		       x->base_delay_us[i], x->sparse_flows[i],
+		       x->bulk_flows[i]);
+		if (XSTATS_HAS(st, drops)) {
+			printf(",\"drop_reasons\":{");
+			for (j = 0; j < TC_CAKE_DROP_MAX; j++)
+				printf("%s\"%s\":%u", j ? "," : "",
+				       drop_names[j], x->drops[j][i]);
+			printf("}");
+		}
+		printf("}");
+	}
+	printf("]");
+	if (XSTATS_HAS(st, cpu) && x->cpu_stats) {
+		printf(",\"cpu\":{");
+		for (i = 0; i < TC_CAKE_CPU_MAX; i++)
+			printf("%s\"%s\":{\"calls\":%u,\"cycles\":%llu,"
+			       "\"max_cycles\":%u}", i ? "," : "",
+			       cpu_names[i], x->cpu[i].calls,
+			       (unsigned long long)x->cpu[i].cycles,
+			       x->cpu[i].max_cycles);
+		printf("}");
+	}
+	if (XSTATS_HAS(st, episodes)) {
+		uint32_t n, first, end;
+
+		episode_range(x, &first, &end);
+		printf(",\"episode_seq\":%u,\"episodes\":[", x->episode_seq);
+		for (n = first; n != end; n++) {
+			const struct tc_cake_episode *e = episode_at(x, n);
+
+			printf("%s{\"seq\":%u,\"type\":\"%s\",\"tin\":%d,"
+			       "\"start_ns\":%llu,\"duration_us\":%u,"
+			       "\"dropped\":%u,\"marked\":%u,"
+			       "\"peak_delay_us\":%u,\"peak_flows\":%u}",
+			       n != first ? "," : "", e->seq, episode_name(e),
+			       e->tin == TC_CAKE_EPISODE_ALL_TINS ? -1 : e->tin,
+			       (unsigned long long)e->start_ns, e->duration_us,
+			       e->dropped, e->marked, e->peak_delay_us,
+			       e->peak_flows);
+		}
+		printf("]");
+	}
+	if (XSTATS_HAS(st, wd_late) && x->wd_stats) {
+		printf(",\"wd_wakes\":%u,\"wd_late_max_ns\":%u,\"wd_late\":[",
+		       x->wd_wakes, x->wd_late_max_ns);
+		for (i = 0; i < TC_CAKE_WD_BUCKETS; i++)
+			printf("%s%u", i ? "," : "", x->wd_late[i]);
+		printf("]");
+	}
+	printf("}\n");
+}
+
+static void print_stats(const struct stats *st)
+{
+	const struct tc_cake_xstats *x = &st->xstats;
+	int i;
+
+	printf("sent %llu bytes %u pkt (dropped %u, overlimits %u) "
+	       "backlog %ub %up\n",
+	       (unsigned long long)st->bstats.bytes, st->bstats.packets,
+	       st->qstats.drops, st->qstats.overlimits, st->qstats.backlog,
+	       st->qstats.qlen);
+	if (!st->xstats_len)
+		return;
+	if (XSTATS_HAS(st, memory_used))
+		printf("memory used %u of %u\n", x->memory_used,
+		       x->memory_limit);
+	if (XSTATS_HAS(st, memory_max_used))
+		printf("memory max used %u\n", x->memory_max_used);
+	if (XSTATS_HAS(st, table_vmalloc))
+		printf("tables %u KB contiguous, %u KB vmalloc, node %d "
+		       "(tx queue %d)\n", x->table_kmalloc / 1024,
+		       x->table_vmalloc / 1024, x->table_node,
+		       x->table_node_wanted);
+	if (XSTATS_HAS(st, pool_used) && x->pool_limit)
+		printf("pool used %u of %u, %u kept per instance\n",
+		       x->pool_used, x->pool_limit, x->pool_min);
+
+	printf("%-12s", "");
+	for (i = 0; i < x->tin_cnt && i < TC_CAKE_MAX_TINS; i++)
+		printf(" %10s%d", "Tin ", i);
+	printf("\n");
+
+#define ROW(name, expr) do {					\
+		printf("%-12s", name);				\
+		for (i = 0; i < x->tin_cnt && i < TC_CAKE_MAX_TINS; i++) \
+			printf(" %11u", (unsigned int)(expr));	\
+		printf("\n");					\
+	} while (0)
+
+	ROW("thresh B/s", x->threshold_rate[i]);
+	ROW("target us", x->target_us[i]);
+	ROW("interval us", x->interval_us[i]);
+	ROW("pk_delay us", x->peak_delay_us[i]);
+	ROW("av_delay us", x->avge_delay_us[i]);
+	ROW("sp_delay us", x->base_delay_us[i]);
+	ROW("pkts", x->sent[i].packets);
+	ROW("drops", x->dropped[i].packets);
+	if (XSTATS_HAS(st, drops)) {
+		char name[16];
+		int j;
+
+		for (j = 0; j < TC_CAKE_DROP_MAX; j++) {
+			snprintf(name, sizeof(name), "  %s", drop_names[j]);
+			ROW(name, x->drops[j][i]);
+		}
+	}
+	ROW("marks", x->ecn_marked[i].packets);
+	ROW("sp_flows", x->sparse_flows[i]);
+	ROW("bk_flows", x->bulk_flows[i]);
+	ROW("way_inds", x->way_indirect_hits[i]);
+	ROW("way_miss", x->way_misses[i]);
+	ROW("way_cols", x->way_collisions[i]);
+#undef ROW
+
+	if (XSTATS_HAS(st, cpu) && x->cpu_stats) {
+		printf("%-12s %11s %11s %11s\n", "cpu", "calls",
+		       "cycles/call", "max cycles");
+		for (i = 0; i < TC_CAKE_CPU_MAX; i++)
+			printf("  %-10s %11u %11llu %11u\n", cpu_names[i],
+			       x->cpu[i].calls, x->cpu[i].calls ?
+			       (unsigned long long)x->cpu[i].cycles /
+			       x->cpu[i].calls : 0, x->cpu[i].max_cycles);
+	}
+
+	if (XSTATS_HAS(st, episodes) && x->episode_seq) {
+		uint32_t n, first, end;
+
+		episode_range(x, &first, &end);
+		printf("%u episodes, last %u:\n", x->episode_seq, end - first);
+		for (n = first; n != end; n++) {
+			const struct tc_cake_episode *e = episode_at(x, n);
+			time_t t = e->start_ns / 1000000000ULL;
+			char when[32], tin[8];
+
+			strftime(when, sizeof(when), "%F %T", localtime(&t));
+			if (e->tin == TC_CAKE_EPISODE_ALL_TINS)
+				snprintf(tin, sizeof(tin), "all");
+			else
+				snprintf(tin, sizeof(tin), "%u", e->tin);
+			printf("  #%-6u %s.%03u %-8s tin %-3s %8u us, "
+			       "%u dropped, %u marked, peak %u us, "
+			       "%u flows\n", e->seq, when,
+			       (unsigned int)(e->start_ns / 1000000 % 1000),
+			       episode_name(e), tin, e->duration_us,
+			       e->dropped, e->marked, e->peak_delay_us,
+			       e->peak_flows);
+		}
+	}
+
+	if (!XSTATS_HAS(st, wd_late) || !x->wd_stats)
+		return;
+	printf("watchdog %u wakes, at most %u ns late\n", x->wd_wakes,
+	       x->wd_late_max_ns);
+	for (i = 0; i < TC_CAKE_WD_BUCKETS; i++) {
+		if (!x->wd_late[i])
+			continue;
+		if (!i)
+			printf("  %16s %u\n", "on time", x->wd_late[i]);
+		else if (i == TC_CAKE_WD_BUCKETS - 1)
+			printf("  >= %10u ns %u\n", 1U << (i - 1),
+			       x->wd_late[i]);
+		else
+			printf("  <  %10u ns %u\n", 1U << i, x->wd_late[i]);
+	}
+}
+
+static int cmd_stats(char **argv)
+{
+	const char *sock = NULL;
+	struct stats st;
+	struct nlreq req;
+
+	memset(&st, 0, sizeof(st));
+	for (; *argv; argv++) {
+		if (!strcmp(*argv, "dev")) {
+			NEXT_ARG();
+			st.ifindex = if_nametoindex(*argv);
+			if (!st.ifindex)
+				die("no such device");
+		} else if (!strcmp(*argv, "sock")) {
+			NEXT_ARG();
+			sock = *argv;
+		} else if (!strcmp(*argv, "json")) {
+			st.json = 1;
+		} else {
+			usage();
+		}
+	}
+	if (!st.ifindex == !sock)
+		usage();
+
+	if (sock) {
+		sock_stats(&st, sock);
+		goto print;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.n.nlmsg_len   = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req.n.nlmsg_type  = RTM_GETQDISC;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.t.tcm_family  = AF_UNSPEC;
+	req.t.tcm_ifindex = st.ifindex;
+
+	nl_send(&req.n);
+	if (nl_recv(parse_stats, &st))
+		return -EIO;
+	if (!st.found)
+		die("no cake qdisc on that device");
+
+print:
+	if (st.json)
+		print_stats_json(&st);
+	else
+		print_stats(&st);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int err;
+
+	if (argc < 2)
+		usage();
+
+	nl_open();
+	if (!strcmp(argv[1], "add"))
+		err = cmd_modify(RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL,
+				 argv + 2);
+	else if (!strcmp(argv[1], "change"))
+		err = cmd_modify(RTM_NEWQDISC, 0, argv + 2);
+	else if (!strcmp(argv[1], "replace"))
+		err = cmd_modify(RTM_NEWQDISC, NLM_F_CREATE | NLM_F_REPLACE,
+				 argv + 2);
+	else if (!strcmp(argv[1], "del"))
+		err = cmd_modify(RTM_DELQDISC, 0, argv + 2);
+	else if (!strcmp(argv[1], "stats"))
+		err = cmd_stats(argv + 2);
+	else
+		usage();
+
+	if (err) {
+		fprintf(stderr, "cakectl: %s\n", strerror(-err));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,569 @@
+/*
+ * caked - cake as a userspace shaper between two interfaces
+ *
+ * For machines that can't load sch_cake.ko: the qdisc runs in libcake,
+ * on real time, and caked bridges two interfaces through it:
+ *
+ *	-i in  --> cake (shaped) -->  -o out
+ *	-i in  <------ as is ------   -o out
+ *
+ * Interfaces are read and written with packet sockets, a batch of frames
+ * per recvmmsg()/sendmmsg(); "tap:name" creates or attaches a TAP device
+ * instead.  Frames go into a fixed pool of buffers that cake works on in
+ * place.  Between packets caked sleeps on a timerfd armed for the
+ * shaper's next deadline, or with -b spins on the rings.
+ *
+ *	caked -i veth1 -o veth2 -r 100 -d diffserv4
+ *	caked -i tap:cake0 -o eth1 -r 20 -b
+ *	cakectl stats sock /run/caked.veth1.sock [json]
+ *
+ * The stats socket answers any datagram with the same TCA_STATS_BASIC,
+ * TCA_STATS_QUEUE and TCA_STATS_APP (struct tc_cake_xstats) attributes the
+ * kernel puts in TCA_STATS2.  Offloads that hand packet sockets frames
+ * larger than the MTU (GRO, TSO) or without checksums (tx-checksumming)
+ * have to be off on the interfaces and their peers.
+ */
+
+#define _GNU_SOURCE	/* recvmmsg, sendmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include "libcake.h"
+#include "util.h"
+#include "../pkt_sched.h"
+#include <linux/rtnetlink.h>
+#include <linux/gen_stats.h>
+
+#define FRAME_SIZE	2048
+#define MAX_BATCH	256
+#define MAX_OPTS	32
+
+struct port {
+	const char	*name;
+	int		fd;
+	int		tap;
+};
+
+static struct {
+	struct port	in, out;
+	double		rate;		/* Mbit/s, 0 = unlimited */
+	int		diffserv;
+	int		flow_mode;
+	struct cake_sim_opt extra[MAX_OPTS];
+	int		nextra;
+	uint32_t	frames;
+	int		batch;
+	int		busy;
+	const char	*sock_path;
+} cfg = { .diffserv = 4, .flow_mode = 4, .frames = 4096, .batch = 32 };
+
+/* the frame pool: a stack of free buffer indices */
+static uint8_t (*pool)[FRAME_SIZE];
+static uint32_t *pool_len;
+static uint32_t *pool_free;
+static uint32_t pool_nfree;
+
+static struct cake_sim *cake;
+static volatile sig_atomic_t stop;
+static uint64_t nonip, truncated;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static uint32_t frame_get(void)
+{
+	return pool_free[--pool_nfree];
+}
+
+static void frame_put(uint32_t i)
+{
+	pool_free[pool_nfree++] = i;
+}
+
+/* ---- ports ---- */
+
+static void port_open(struct port *p)
+{
+	if (!strncmp(p->name, "tap:", 4)) {
+		struct ifreq ifr;
+
+		p->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+		if (p->fd < 0)
+			die("/dev/net/tun");
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+		snprintf(ifr.ifr_name, IFNAMSIZ, "%s", p->name + 4);
+		if (ioctl(p->fd, TUNSETIFF, &ifr) < 0)
+			die("TUNSETIFF");
+		p->tap = 1;
+	} else {
+		struct sockaddr_ll sll;
+		struct packet_mreq mr;
+		int one = 1;
+
+		p->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+		if (p->fd < 0)
+			die("socket");
+		memset(&sll, 0, sizeof(sll));
+		sll.sll_family   = AF_PACKET;
+		sll.sll_protocol = htons(ETH_P_ALL);
+		sll.sll_ifindex  = if_nametoindex(p->name);
+		if (!sll.sll_ifindex)
+			die(p->name);
+		if (bind(p->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+			die("bind");
+
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = sll.sll_ifindex;
+		mr.mr_type    = PACKET_MR_PROMISC;
+		if (setsockopt(p->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+			       &mr, sizeof(mr)) < 0)
+			die("PACKET_ADD_MEMBERSHIP");
+#ifdef PACKET_IGNORE_OUTGOING
+		/* what we send out of a port must not come back in (4.20+);
+		 * port_recv() checks the packet type as well
+		 */
+		setsockopt(p->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+			   &one, sizeof(one));
+#endif
+	}
+}
+
+static unsigned int port_mtu(const struct port *p)
+{
+	struct ifreq ifr;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s",
+		 p->tap ? p->name + 4 : p->name);
+	if (fd < 0 || ioctl(fd, SIOCGIFMTU, &ifr) < 0)
+		ifr.ifr_mtu = 1500;
+	if (fd >= 0)
+		close(fd);
+	return ifr.ifr_mtu;
+}
+
+/* Read up to n frames into buffers from the pool; returns how many. */
+static int port_recv(struct port *p, uint32_t *idx, int n)
+{
+	struct mmsghdr msg[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	struct sockaddr_ll sll[MAX_BATCH];
+	int i, got, kept = 0;
+
+	if (n > pool_nfree)
+		n = pool_nfree;
+	for (i = 0; i < n; i++)
+		idx[i] = frame_get();
+
+	if (p->tap) {
+		for (got = 0; got < n; got++) {
+			ssize_t len = read(p->fd, pool[idx[got]], FRAME_SIZE);
+
+			if (len <= 0)
+				break;
+			pool_len[idx[got]] = len;
+		}
+		kept = got;
+	} else {
+		memset(msg, 0, sizeof(*msg) * n);
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = pool[idx[i]];
+			iov[i].iov_len  = FRAME_SIZE;
+			msg[i].msg_hdr.msg_iov     = &iov[i];
+			msg[i].msg_hdr.msg_iovlen  = 1;
+			msg[i].msg_hdr.msg_name    = &sll[i];
+			msg[i].msg_hdr.msg_namelen = sizeof(sll[i]);
+		}
+		got = recvmmsg(p->fd, msg, n, MSG_DONTWAIT | MSG_TRUNC, NULL);
+		if (got < 0)
+			got = 0;
+		for (i = 0; i < got; i++) {
+			uint32_t f = idx[i];
+
+			if (sll[i].sll_pkttype == PACKET_OUTGOING) {
+				frame_put(f);
+				continue;
+			}
+			if (msg[i].msg_len > FRAME_SIZE) {
+				truncated++;
+				frame_put(f);
+				continue;
+			}
+			pool_len[f] = msg[i].msg_len;
+			idx[kept++] = f;
+		}
+	}
+
+	for (i = got; i < n; i++)
+		frame_put(idx[i]);
+	return kept;
+}
+
+/* Send n frames and give their buffers back to the pool. */
+static void port_send(struct port *p, const uint32_t *idx, int n)
+{
+	struct mmsghdr msg[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	int i, sent;
+
+	if (p->tap) {
+		for (i = 0; i < n; i++)
+			if (write(p->fd, pool[idx[i]], pool_len[idx[i]]) < 0)
+				break;
+	} else {
+		memset(msg, 0, sizeof(*msg) * n);
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = pool[idx[i]];
+			iov[i].iov_len  = pool_len[idx[i]];
+			msg[i].msg_hdr.msg_iov    = &iov[i];
+			msg[i].msg_hdr.msg_iovlen = 1;
+		}
+		for (i = 0; i < n; i += sent) {
+			sent = sendmmsg(p->fd, msg + i, n - i, 0);
+			if (sent <= 0)
+				break;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		frame_put(idx[i]);
+}
+
+/* ---- shaping ---- */
+
+static void dropped(void *arg, const struct cake_pkt *pkt)
+{
+	frame_put(pkt->cookie);
+}
+
+/* Offset of the IP header, or 0 for frames cake can't classify. */
+static unsigned int l3_offset(const uint8_t *f, uint32_t len)
+{
+	unsigned int off = ETH_HLEN;
+	uint16_t proto;
+
+	if (len < ETH_HLEN + 4)
+		return 0;
+	proto = f[12] << 8 | f[13];
+	if (proto == ETH_P_8021Q) {
+		proto = f[16] << 8 | f[17];
+		off += 4;
+	}
+	if (proto != ETH_P_IP && proto != ETH_P_IPV6)
+		return 0;
+	return len > off ? off : 0;
+}
+
+static void shape_rx(void)
+{
+	uint32_t idx[MAX_BATCH], bypass[MAX_BATCH];
+	int i, n, nbypass = 0;
+
+	n = port_recv(&cfg.in, idx, cfg.batch);
+	cake_sim_set_time(now_ns());
+	for (i = 0; i < n; i++) {
+		uint32_t f = idx[i];
+		unsigned int off = l3_offset(pool[f], pool_len[f]);
+
+		if (!off) {
+			nonip++;
+			bypass[nbypass++] = f;
+			continue;
+		}
+		if (cake_sim_enqueue_buf(cake, pool[f] + off,
+					 pool_len[f] - off,
+					 FRAME_SIZE - off, f) < 0)
+			frame_put(f);
+	}
+	if (nbypass)
+		port_send(&cfg.out, bypass, nbypass);
+}
+
+static void shape_tx(void)
+{
+	uint32_t idx[MAX_BATCH];
+	struct cake_pkt pkt;
+	int n = 0;
+
+	cake_sim_set_time(now_ns());
+	while (cake_sim_dequeue(cake, &pkt)) {
+		idx[n++] = pkt.cookie;
+		if (n == cfg.batch) {
+			port_send(&cfg.out, idx, n);
+			n = 0;
+		}
+	}
+	if (n)
+		port_send(&cfg.out, idx, n);
+}
+
+static void forward(struct port *from, struct port *to)
+{
+	uint32_t idx[MAX_BATCH];
+	int n = port_recv(from, idx, cfg.batch);
+
+	if (n)
+		port_send(to, idx, n);
+}
+
+/* ---- stats ---- */
+
+static int stats_open(void)
+{
+	struct sockaddr_un sun;
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+	if (fd < 0)
+		die("socket");
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", cfg.sock_path);
+	unlink(cfg.sock_path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		die(cfg.sock_path);
+	return fd;
+}
+
+static void put_attr(char *buf, unsigned int *len, int type,
+		     const void *data, unsigned int dlen)
+{
+	struct rtattr *rta = (struct rtattr *)(buf + *len);
+
+	rta->rta_type = type;
+	rta->rta_len  = RTA_LENGTH(dlen);
+	memcpy(RTA_DATA(rta), data, dlen);
+	*len += RTA_ALIGN(rta->rta_len);
+}
+
+/* Answer whoever asked with the attributes of a TCA_STATS2 nest. */
+static void stats_serve(int fd)
+{
+	static struct tc_cake_xstats x;
+	static char req[64], buf[RTA_SPACE(sizeof(x)) + 256];
+	struct gnet_stats_basic bs;
+	struct gnet_stats_queue qs;
+	struct cake_sim_counters c;
+	struct sockaddr_un from;
+	socklen_t flen = sizeof(from);
+	unsigned int len = 0;
+	int xlen;
+
+	if (recvfrom(fd, req, sizeof(req), 0, (struct sockaddr *)&from,
+		     &flen) < 0)
+		return;
+
+	cake_sim_counters(cake, &c);
+	memset(&bs, 0, sizeof(bs));
+	bs.bytes   = c.bytes;
+	bs.packets = c.packets;
+	memset(&qs, 0, sizeof(qs));
+	qs.qlen       = c.qlen;
+	qs.backlog    = c.backlog;
+	qs.drops      = c.drops;
+	qs.overlimits = c.overlimits;
+	put_attr(buf, &len, TCA_STATS_BASIC, &bs, sizeof(bs));
+	put_attr(buf, &len, TCA_STATS_QUEUE, &qs, sizeof(qs));
+
+	xlen = cake_sim_xstats(cake, &x, sizeof(x));
+	if (xlen > 0)
+		put_attr(buf, &len, TCA_STATS_APP, &x,
+			 xlen < sizeof(x) ? xlen : sizeof(x));
+
+	sendto(fd, buf, len, 0, (struct sockaddr *)&from, flen);
+}
+
+/* ---- main ---- */
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -i dev -o dev [options]\n"
+		"  -i dev    shaped side: what arrives here leaves by -o\n"
+		"  -o dev    other side, forwarded back to -i unshaped;\n"
+		"            tap:name for a TAP device on either side\n"
+		"  -r mbit   shaped rate, 0 = unlimited (0)\n"
+		"  -d mode   diffserv mode (diffserv4)\n"
+		"  -f mode   flow mode (flows)\n"
+		"  -O a=v    extra TCA_CAKE_* attribute, by number\n"
+		"  -n bufs   packet buffers (4096), -B n frames per batch (32)\n"
+		"  -b        busy-poll instead of sleeping on a timerfd\n"
+		"  -S path   stats socket (/run/caked.<in>.sock)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct cake_sim_opt opt[MAX_OPTS + 3];
+	static char sock_path[108];
+	struct pollfd pfd[4];
+	struct itimerspec its;
+	uint64_t last_wake = 0;
+	int c, i, n = 0, tfd, sfd;
+
+	while ((c = getopt(argc, argv, "i:o:r:d:f:O:n:B:bS:h")) != -1) {
+		switch (c) {
+		case 'i':
+			cfg.in.name = optarg;
+			break;
+		case 'o':
+			cfg.out.name = optarg;
+			break;
+		case 'r':
+			cfg.rate = atof(optarg);
+			break;
+		case 'd':
+			cfg.diffserv = lookup(optarg, diffserv_names,
+					      CAKE_DIFFSERV_NAMES);
+			break;
+		case 'f':
+			cfg.flow_mode = lookup(optarg, flow_names,
+					       CAKE_FLOW_NAMES);
+			break;
+		case 'O':
+			if (cfg.nextra == MAX_OPTS || !strchr(optarg, '='))
+				usage(argv[0]);
+			cfg.extra[cfg.nextra].type = atoi(optarg);
+			cfg.extra[cfg.nextra].value =
+				strtoul(strchr(optarg, '=') + 1, NULL, 0);
+			cfg.nextra++;
+			break;
+		case 'n':
+			cfg.frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			cfg.batch = atoi(optarg);
+			break;
+		case 'b':
+			cfg.busy = 1;
+			break;
+		case 'S':
+			cfg.sock_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!cfg.in.name || !cfg.out.name || cfg.rate < 0 ||
+	    cfg.diffserv < 1 || cfg.diffserv >= CAKE_DIFFSERV_NAMES ||
+	    cfg.flow_mode < 0 || cfg.flow_mode >= CAKE_FLOW_NAMES ||
+	    cfg.frames < MAX_BATCH ||
+	    cfg.batch < 1 || cfg.batch > MAX_BATCH)
+		usage(argv[0]);
+
+	pool      = calloc(cfg.frames, FRAME_SIZE);
+	pool_len  = calloc(cfg.frames, sizeof(*pool_len));
+	pool_free = calloc(cfg.frames, sizeof(*pool_free));
+	if (!pool || !pool_len || !pool_free)
+		die("calloc");
+	for (i = cfg.frames; i > 0; i--)
+		frame_put(i - 1);
+
+	port_open(&cfg.in);
+	port_open(&cfg.out);
+	if (!cfg.sock_path) {
+		snprintf(sock_path, sizeof(sock_path), "/run/caked.%s.sock",
+			 cfg.in.tap ? cfg.in.name + 4 : cfg.in.name);
+		cfg.sock_path = sock_path;
+	}
+
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE,
+					  cfg.rate * 1e6 / 8 };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE,
+					  cfg.diffserv };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_FLOW_MODE, cfg.flow_mode };
+	for (i = 0; i < cfg.nextra; i++)
+		opt[n++] = cfg.extra[i];
+
+	cake_sim_set_time(now_ns());
+	cake = cake_sim_create(opt, n, port_mtu(&cfg.out));
+	if (!cake) {
+		fprintf(stderr, "cake_sim_create failed\n");
+		return 1;
+	}
+	cake_sim_on_drop(cake, dropped, NULL);
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (tfd < 0)
+		die("timerfd_create");
+	sfd = stats_open();
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while (!stop) {
+		uint64_t wake = cake_sim_qlen(cake) ? cake_sim_wakeup(cake) : 0;
+
+		if (!cfg.busy && wake != last_wake) {
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec  = wake / 1000000000ULL;
+			its.it_value.tv_nsec = wake % 1000000000ULL;
+			timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+			last_wake = wake;
+		}
+
+		/* without buffers, leave new frames in the socket for now */
+		pfd[0] = (struct pollfd){ cfg.in.fd,
+			  pool_nfree >= cfg.batch ? POLLIN : 0 };
+		pfd[1] = (struct pollfd){ cfg.out.fd,
+			  pool_nfree >= cfg.batch ? POLLIN : 0 };
+		pfd[2] = (struct pollfd){ tfd, POLLIN };
+		pfd[3] = (struct pollfd){ sfd, POLLIN };
+
+		if (poll(pfd, 4, cfg.busy ? 0 :
+			 cake_sim_qlen(cake) && !wake ? 1 : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+
+		if (pfd[2].revents & POLLIN) {
+			uint64_t ticks;
+
+			if (read(tfd, &ticks, sizeof(ticks)) < 0)
+				ticks = 0;
+			last_wake = 0;
+		}
+		if (pfd[0].revents & POLLIN || (cfg.busy && pfd[0].events))
+			shape_rx();
+		if (pfd[1].revents & POLLIN || (cfg.busy && pfd[1].events))
+			forward(&cfg.out, &cfg.in);
+		shape_tx();
+		if (pfd[3].revents & POLLIN)
+			stats_serve(sfd);
+	}
+
+	fprintf(stderr, "caked: %u packets dropped, %llu non-IP, "
+		"%llu too large\n", cake_sim_drops(cake),
+		(unsigned long long)nonip, (unsigned long long)truncated);
+	unlink(cfg.sock_path);
+	cake_sim_destroy(cake);
+	return 0;
+}
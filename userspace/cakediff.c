@@ -0,0 +1,818 @@
+/*
+ * cakediff - differential test of sch_cake.c against the cakeref model
+ *
+ * Each run draws a random configuration (tin mode, rate, overhead, ATM,
+ * CoDel parameters, memory limit) and a random mix of flows, then plays
+ * the same random sequence of arrivals and dequeue polls into libcake and
+ * into the reference model.  After every step the packets each one sent,
+ * marked and dropped are compared; the first difference is reported with
+ * the seed that reproduces it.
+ *
+ *	cakediff -n 1000		# 1000 random runs
+ *	cakediff -s 1234 -n 1 -v	# replay one, tracing every step
+ *
+ * -c runs libcake alone through one of its operations instead and checks
+ * what must hold across it, see check_run():
+ *
+ *	cakediff -c shrink -n 100
+ *	cakediff -c pool -n 100
+ *	cakediff -c replace -n 100
+ *	cakediff -c change -n 100
+ *	cakediff -c tenants -n 100
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include "libcake.h"
+#include "util.h"
+#include "cakeref.h"
+#include "../pkt_sched.h"
+
+#define NSEC_PER_USEC	1000ULL
+#define MAX_FLOWS	64
+#define MAX_LOG		4096
+
+static const uint8_t dscps[] = { 0, 8, 10, 18, 26, 34, 46, 48, 56, 1, 4 };
+
+struct flow {
+	uint32_t	src;
+	uint16_t	sport;
+	uint8_t		dscp;
+	uint8_t		ecn;
+	uint16_t	size;
+};
+
+enum { EV_SENT, EV_MARKED, EV_DROPPED };
+static const char * const ev_names[] = { "sent", "marked", "dropped" };
+
+struct log {
+	struct {
+		uint64_t	cookie;
+		int		ev;
+	} e[MAX_LOG];
+	unsigned int n;
+};
+
+static struct {
+	int		runs;
+	uint32_t	seed;
+	int		steps;
+	int		verbose;
+	int		check;
+} cfg = { .runs = 100, .seed = 1, .steps = 20000 };
+
+static uint32_t rnd_range(uint32_t n)
+{
+	return n ? rnd() % n : 0;
+}
+
+static void log_add(struct log *l, uint64_t cookie, int ev)
+{
+	if (l->n < MAX_LOG) {
+		l->e[l->n].cookie = cookie;
+		l->e[l->n].ev     = ev;
+	}
+	l->n++;
+}
+
+static void cake_dropped(void *arg, const struct cake_pkt *pkt)
+{
+	log_add(arg, pkt->cookie, EV_DROPPED);
+}
+
+static void ref_dropped(void *arg, const struct cake_ref_pkt *pkt)
+{
+	log_add(arg, pkt->cookie, EV_DROPPED);
+}
+
+static unsigned int flow_pkt(uint8_t *p, const struct flow *f)
+{
+	struct tuple t = {
+		.proto = IPPROTO_UDP,
+		.sport = f->sport,
+		.dport = 53,
+	};
+
+	tuple_v4(t.src, f->src);
+	tuple_v4(t.dst, 1);
+	return build_pkt(p, &t, f->dscp << 2 | f->ecn, f->size);
+}
+
+static void print_log(const char *who, const struct log *l)
+{
+	unsigned int i;
+
+	printf("  %-5s:", who);
+	if (!l->n)
+		printf(" nothing");
+	for (i = 0; i < l->n && i < MAX_LOG; i++)
+		printf(" %llu:%s", (unsigned long long)l->e[i].cookie,
+		       ev_names[l->e[i].ev]);
+	printf("\n");
+}
+
+static int log_equal(const struct log *a, const struct log *b)
+{
+	unsigned int i;
+
+	if (a->n != b->n)
+		return 0;
+	for (i = 0; i < a->n && i < MAX_LOG; i++)
+		if (a->e[i].cookie != b->e[i].cookie ||
+		    a->e[i].ev != b->e[i].ev)
+			return 0;
+	return 1;
+}
+
+/* A random configuration, as options for libcake and for the model. */
+static int draw_config(struct cake_ref_cfg *rc, struct cake_sim_opt *opt)
+{
+	static const uint32_t rates_mbit[] = { 0, 1, 4, 20, 100, 1000 };
+	static const uint32_t limits[] = { 65536, 262144, 1 << 20, 1 << 24 };
+	int n = 0;
+
+	memset(rc, 0, sizeof(*rc));
+	rc->tin_mode     = 1 + rnd_range(4);
+	rc->rate         = rates_mbit[rnd_range(6)] * 125000;
+	rc->overhead     = rnd_range(4) ? 0 : (int)rnd_range(64) - 16;
+	rc->atm          = !rnd_range(4);
+	rc->target_us    = rnd_range(2) ? 5000 : 500 + rnd_range(5000);
+	rc->interval_us  = rc->target_us * (4 + rnd_range(36));
+	rc->buffer_limit = limits[rnd_range(4)];
+
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE, rc->rate };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE,
+					  rc->tin_mode };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_OVERHEAD, rc->overhead };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_ATM, rc->atm };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_TARGET, rc->target_us };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_RTT, rc->interval_us };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_MEMORY, rc->buffer_limit };
+	return n;
+}
+
+static int draw_flows(struct flow *flows)
+{
+	int i, nflows = 1 + rnd_range(MAX_FLOWS);
+
+	for (i = 0; i < nflows; i++) {
+		flows[i].src   = rnd_range(4096);
+		flows[i].sport = 1024 + rnd_range(60000);
+		flows[i].dscp  = dscps[rnd_range(sizeof(dscps))];
+		flows[i].ecn   = rnd_range(3) ? 0 : (rnd_range(8) ? 2 : 3);
+		flows[i].size  = rnd_range(2) ? 1500 : 64 + rnd_range(1437);
+	}
+	return nflows;
+}
+
+/* offered load between about 1x and 3.5x the shaped rate */
+static uint64_t draw_gap(const struct cake_ref_cfg *rc)
+{
+	return rc->rate ? 1000000000ULL * 2000 / rc->rate / (1 + rnd_range(4))
+			: 2000;
+}
+
+static int run(uint32_t seed)
+{
+	static struct log clog, rlog;
+	static struct cake_ref ref;
+	struct cake_ref_cfg rc;
+	struct flow flows[MAX_FLOWS];
+	struct cake_sim_opt opt[8];
+	struct cake_sim *cake;
+	uint8_t buf[1600];
+	uint64_t now = 0, cookie = 0, mean_gap;
+	int nflows, step, i, n;
+	int ret = 0;
+
+	rnd_seed(seed * 0x9e3779b9U);
+	n = draw_config(&rc, opt);
+
+	cake_sim_seed(seed);
+	cake_sim_set_time(0);
+	cake = cake_sim_create(opt, n, 1500);
+	if (!cake) {
+		fprintf(stderr, "cake_sim_create failed\n");
+		return -1;
+	}
+	cake_sim_on_drop(cake, cake_dropped, &clog);
+	cake_ref_init(&ref, &rc, ref_dropped, &rlog);
+
+	nflows = draw_flows(flows);
+	mean_gap = draw_gap(&rc);
+
+	if (cfg.verbose)
+		printf("seed %u: mode %d rate %u B/s overhead %d atm %d "
+		       "target %u interval %u limit %u flows %d\n",
+		       seed, rc.tin_mode, rc.rate, rc.overhead, rc.atm,
+		       rc.target_us, rc.interval_us, rc.buffer_limit, nflows);
+
+	for (step = 0; step < cfg.steps; step++) {
+		const char *what;
+		uint32_t r = rnd_range(100);
+
+		clog.n = rlog.n = 0;
+		now += rnd_range(2 * mean_gap + 1);
+
+		if (r < 55) {
+			/* a burst from one flow */
+			struct flow *f = &flows[rnd_range(nflows)];
+			int burst = 1 + (rnd_range(4) ? 0 : rnd_range(16));
+
+			what = "enqueue";
+			cake_sim_set_time(now);
+			for (i = 0; i < burst; i++, cookie++) {
+				unsigned int len = flow_pkt(buf, f);
+				struct cake_ref_pkt rp;
+				struct cake_pkt cls;
+
+				if (cake_sim_classify_pkt(cake, buf, len, &cls))
+					abort();
+				memset(&rp, 0, sizeof(rp));
+				rp.cookie   = cookie;
+				rp.len      = len;
+				rp.truesize = cls.truesize;
+				rp.ecn      = f->ecn;
+				rp.tin      = cls.tin;
+				rp.queue    = cls.flow;
+
+				cake_ref_enqueue(&ref, now, &rp);
+				cake_sim_enqueue(cake, buf, len, 0, cookie);
+			}
+		} else {
+			/* poll: once, or drain whatever is due */
+			int polls = r < 85 ? 1 : 1 << 30;
+			struct cake_ref_pkt *rp;
+			struct cake_pkt cp;
+
+			if (r >= 95 && cake_sim_wakeup(cake) > now)
+				now = cake_sim_wakeup(cake);
+			what = polls == 1 ? "dequeue" : "drain";
+			cake_sim_set_time(now);
+
+			for (i = 0; i < polls; i++) {
+				int got = 0;
+
+				if (cake_sim_dequeue(cake, &cp)) {
+					log_add(&clog, cp.cookie,
+						cp.ce ? EV_MARKED : EV_SENT);
+					got = 1;
+				}
+				rp = cake_ref_dequeue(&ref, now);
+				if (rp) {
+					log_add(&rlog, rp->cookie,
+						rp->ce ? EV_MARKED : EV_SENT);
+					free(rp);
+					got = 1;
+				}
+				if (!got)
+					break;
+			}
+		}
+
+		if (cfg.verbose && (clog.n || rlog.n)) {
+			printf("step %d t=%llu %s\n", step,
+			       (unsigned long long)now, what);
+			print_log("cake", &clog);
+		}
+
+		if (!log_equal(&clog, &rlog)) {
+			printf("DIVERGED seed %u step %d t=%llu ns (%s): "
+			       "mode %d rate %u B/s overhead %d atm %d "
+			       "target %u us interval %u us limit %u "
+			       "flows %d\n",
+			       seed, step, (unsigned long long)now, what,
+			       rc.tin_mode, rc.rate, rc.overhead, rc.atm,
+			       rc.target_us, rc.interval_us, rc.buffer_limit,
+			       nflows);
+			print_log("cake", &clog);
+			print_log("model", &rlog);
+			ret = 1;
+			break;
+		}
+	}
+
+	cake_sim_destroy(cake);
+	cake_ref_destroy(&ref);
+	return ret;
+}
+
+/* ---- invariant checks ----
+ *
+ * With -c, libcake runs alone and is put through one operation at random
+ * points of the same kind of traffic.  A ledger of every packet checks
+ * what must hold across it: each packet is sent, dropped or still
+ * queued; the qdisc's qlen, backlog and memory agree with the ledger; and
+ * a flow's packets leave in the order they came.
+ */
+
+#define MAX_INST	4
+#define PAGE_BYTES	4096
+#define MANY_FLOWS	1000
+
+enum {
+	CHECK_MODEL, CHECK_SHRINK, CHECK_POOL, CHECK_REPLACE, CHECK_CHANGE,
+	CHECK_TENANTS,
+};
+static const char * const check_names[] = {
+	"model", "shrink", "pool", "replace", "change", "tenants",
+};
+
+enum { PKT_SENT, PKT_DROPPED };
+
+/* A GSO packet comes back as segs segments of len bytes, with its cookie. */
+struct pkt_rec {
+	uint32_t	len, truesize;
+	uint16_t	flow;
+	uint8_t		inst, segs;	/* segs still queued */
+};
+
+struct inst {
+	struct cake_sim	*cake;
+	uint8_t		idx;
+	uint32_t	qlen, backlog, mem;	/* queued, as the ledger has it */
+};
+
+static struct {
+	struct pkt_rec	*pkts;
+	uint64_t	npkts, cap;
+	struct inst	inst[MAX_INST];
+	int		ninst;
+	int		busy;		/* instance being enqueued to, or -1 */
+	uint32_t	pool, pool_min;
+	long long	last_sent[MANY_FLOWS];
+	int		shrinking;
+	unsigned long long shrunk;	/* truesize the shrink dropped */
+	int		tenants;	/* flow f comes from tenant f % tenants */
+	char		err[160];	/* the first broken invariant */
+} led;
+
+static void check_fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (led.err[0])
+		return;
+	va_start(ap, fmt);
+	vsnprintf(led.err, sizeof(led.err), fmt, ap);
+	va_end(ap);
+}
+
+static void led_gone(struct inst *in, const struct cake_pkt *pkt, int state)
+{
+	unsigned long long id = pkt->cookie;
+	struct pkt_rec *r;
+
+	if (id >= led.npkts) {
+		check_fail("unknown packet %llu", id);
+		return;
+	}
+	r = &led.pkts[id];
+	if (!r->segs || r->inst != in->idx) {
+		check_fail("packet %llu left instance %u twice or from the "
+			   "wrong one", id, in->idx);
+		return;
+	}
+	if (pkt->len != r->len || pkt->truesize != r->truesize)
+		check_fail("packet %llu came back as %u/%u bytes, not %u/%u",
+			   id, pkt->len, pkt->truesize, r->len,
+			   r->truesize);
+	if (state == PKT_SENT) {
+		if ((long long)id < led.last_sent[r->flow])
+			check_fail("flow %u sent %llu after %lld", r->flow,
+				   id, led.last_sent[r->flow]);
+		led.last_sent[r->flow] = id;
+	}
+	r->segs--;
+	in->qlen--;
+	in->backlog -= r->len;
+	in->mem     -= r->truesize;
+}
+
+static void check_dropped(void *arg, const struct cake_pkt *pkt)
+{
+	struct inst *in = arg;
+
+	led_gone(in, pkt, PKT_DROPPED);
+	if (led.shrinking)
+		led.shrunk += pkt->truesize;
+
+	/* another instance's enqueue can only be the pool evicting, which
+	 * takes from instances above their guarantee
+	 */
+	if (led.pool && led.busy >= 0 && in->idx != led.busy &&
+	    in->mem + pkt->truesize <= led.pool_min)
+		check_fail("pool evicted from instance %u at %u of %u kept",
+			   in->idx, in->mem + pkt->truesize, led.pool_min);
+}
+
+/* The qdiscs against the ledger, after every step. */
+static void led_verify(void)
+{
+	struct tc_cake_xstats st;
+	uint32_t total = 0;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	for (i = 0; i < led.ninst; i++) {
+		struct inst *in = &led.inst[i];
+
+		cake_sim_xstats(in->cake, &st, sizeof(st));
+		if (cake_sim_qlen(in->cake) != in->qlen ||
+		    cake_sim_backlog(in->cake) != in->backlog ||
+		    st.memory_used != in->mem)
+			check_fail("instance %d holds %u pkts %u bytes %u "
+				   "truesize, the ledger %u %u %u", i,
+				   cake_sim_qlen(in->cake),
+				   cake_sim_backlog(in->cake), st.memory_used,
+				   in->qlen, in->backlog, in->mem);
+		total += in->mem;
+	}
+	if (!led.pool)
+		return;
+	if (st.pool_used != total)
+		check_fail("pool_used %u, the ledger %u", st.pool_used, total);
+	if (total > led.pool)
+		check_fail("instances hold %u truesize, over the %u pool",
+			   total, led.pool);
+}
+
+/* f's packet, or with segs > 1 a GSO packet of that many of them */
+static void check_enqueue(struct inst *in, const struct flow *f, int flow,
+			  int segs)
+{
+	static uint8_t buf[65536];
+	unsigned int len = flow_pkt(buf, f), gso_size = 0;
+	unsigned int hlen = 28;		/* IPv4 and UDP */
+	struct cake_pkt cls;
+	struct pkt_rec *r;
+
+	if (led.npkts == led.cap) {
+		led.cap = led.cap ? led.cap * 2 : 65536;
+		led.pkts = realloc(led.pkts, led.cap * sizeof(*led.pkts));
+		if (!led.pkts) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+	if (led.tenants)
+		cake_sim_set_iif(in->cake, flow % led.tenants);
+	if (cake_sim_classify_pkt(in->cake, buf, len, &cls))
+		abort();
+
+	r = &led.pkts[led.npkts];
+	r->len      = len;
+	r->truesize = cls.truesize;
+	r->inst     = in->idx;
+	r->flow     = flow;
+	r->segs     = segs;
+	in->qlen    += segs;
+	in->backlog += segs * len;
+	in->mem     += segs * cls.truesize;
+
+	/* the same UDP header, then segs payloads of a whole segment */
+	if (segs > 1) {
+		gso_size = len - hlen;
+		len = hlen + segs * gso_size;
+		memset(buf + hlen, 0, len - hlen);
+	}
+	led.busy = in->idx;
+	cake_sim_enqueue(in->cake, buf, len, gso_size, led.npkts++);
+	led.busy = -1;
+}
+
+static int check_dequeue(struct inst *in)
+{
+	struct cake_pkt cp;
+
+	if (!cake_sim_dequeue(in->cake, &cp))
+		return 0;
+	led_gone(in, &cp, PKT_SENT);
+	return 1;
+}
+
+/* Asked for pages, the shrinker must free at least that much of what
+ * the instances hold, and report what it dropped, rounded up to pages.
+ */
+static void check_shrink(void)
+{
+	unsigned long long held = 0, want, freed;
+	int i;
+
+	for (i = 0; i < led.ninst; i++)
+		held += led.inst[i].mem / PAGE_BYTES;
+	want = rnd_range(2 * held + 2);
+
+	led.shrinking = 1;
+	led.shrunk = 0;
+	freed = cake_sim_shrink(want);
+	led.shrinking = 0;
+
+	if (freed != (led.shrunk + PAGE_BYTES - 1) / PAGE_BYTES)
+		check_fail("shrink of %llu pages reported %llu, dropped %llu "
+			   "bytes", want, freed, led.shrunk);
+	if (freed < (want < held ? want : held))
+		check_fail("shrink of %llu pages freed only %llu of %llu",
+			   want, freed, held);
+}
+
+static uint32_t memory_limit(struct inst *in)
+{
+	struct tc_cake_xstats st;
+
+	memset(&st, 0, sizeof(st));
+	cake_sim_xstats(in->cake, &st, sizeof(st));
+	return st.memory_limit;
+}
+
+/* Replaced by a new instance with another configuration, the queue must
+ * carry over: nothing is dropped unless it no longer fits the new memory
+ * limit, and the new root has to be running to send what it took over.
+ */
+static void check_replace(struct inst *in)
+{
+	struct cake_ref_cfg rc;
+	struct cake_sim_opt opt[8];
+	uint32_t qlen = in->qlen, mem = in->mem;
+	int n = draw_config(&rc, opt);
+
+	if (cake_sim_replace(in->cake, opt, n)) {
+		check_fail("replace failed");
+		return;
+	}
+	if (mem <= memory_limit(in) ? in->qlen != qlen
+				    : in->mem > memory_limit(in))
+		check_fail("replace kept %u of %u pkts, %u of %u truesize "
+			   "under a %u limit", in->qlen, qlen, in->mem, mem,
+			   memory_limit(in));
+	if (in->qlen && !cake_sim_wakeup(in->cake))
+		check_fail("replace left %u pkts and nothing to run them",
+			   in->qlen);
+}
+
+/* A change of diffserv or flow mode re-homes the queue and must lose
+ * nothing; now and then the instance is reset instead, which must hand
+ * every packet back as dropped.
+ */
+static void check_change(struct inst *in)
+{
+	struct cake_sim_opt opt[2];
+	uint32_t qlen = in->qlen;
+
+	if (!rnd_range(4)) {
+		cake_sim_reset(in->cake);
+		if (in->qlen)
+			check_fail("reset left %u of %u pkts", in->qlen, qlen);
+		return;
+	}
+
+	opt[0] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE,
+					1 + rnd_range(CAKE_DIFFSERV_NAMES - 1) };
+	opt[1] = (struct cake_sim_opt){ TCA_CAKE_FLOW_MODE,
+					rnd_range(CAKE_FLOW_NAMES) };
+	if (cake_sim_change(in->cake, opt, 2)) {
+		check_fail("change failed");
+		return;
+	}
+	if (in->qlen != qlen)
+		check_fail("change to %s/%s kept %u of %u pkts",
+			   diffserv_names[opt[0].value],
+			   flow_names[opt[1].value], in->qlen, qlen);
+}
+
+/* One tenant's 800 to 1000 flows at 8 Mbit, besteffort: with hundreds of
+ * them bulk, each one's share of the 300 byte quantum is under a byte.
+ */
+static int draw_many(struct cake_ref_cfg *rc, struct cake_sim_opt *opt,
+		     int n, struct flow *flows)
+{
+	int i, nflows = 800 + rnd_range(MANY_FLOWS - 800 + 1);
+
+	rc->rate = 1000000;
+	for (i = 0; i < n; i++)
+		if (opt[i].type == TCA_CAKE_BASE_RATE)
+			opt[i].value = rc->rate;
+		else if (opt[i].type == TCA_CAKE_DIFFSERV_MODE)
+			opt[i].value = lookup("besteffort", diffserv_names,
+					      CAKE_DIFFSERV_NAMES);
+		else if (opt[i].type == TCA_CAKE_MEMORY)
+			opt[i].value = 1 << 24;
+
+	for (i = 0; i < nflows; i++) {
+		flows[i].src   = rnd_range(4096);
+		flows[i].sport = 1024 + i;
+		flows[i].dscp  = 0;
+		flows[i].ecn   = rnd_range(2) ? 0 : 2;
+		flows[i].size  = 1500;
+	}
+	return nflows;
+}
+
+static int check_run(uint32_t seed)
+{
+	struct cake_ref_cfg rc;
+	struct flow flows[MANY_FLOWS];
+	struct cake_sim_opt opt[8];
+	uint64_t now = 0, mean_gap;
+	const char *what = "";
+	int nflows = 0, step, i, n, ret = 0;
+
+	rnd_seed(seed * 0x9e3779b9U);
+	n = draw_config(&rc, opt);
+	cake_sim_seed(seed);
+	cake_sim_set_time(0);
+
+	memset(led.last_sent, 0xff, sizeof(led.last_sent));
+	led.npkts = 0;
+	led.err[0] = 0;
+	led.ninst = 1;
+	led.busy = -1;
+	led.pool = 0;
+	led.tenants = 0;
+	if (cfg.check == CHECK_TENANTS) {
+		led.tenants = 1 + rnd_range(4);
+		opt[n++] = (struct cake_sim_opt){
+			TCA_CAKE_FLOW_MODE,
+			lookup("tenants", flow_names, CAKE_FLOW_NAMES) };
+		/* now and then, many flows of one tenant */
+		if (!rnd_range(4)) {
+			led.tenants = 1;
+			nflows = draw_many(&rc, opt, n, flows);
+		}
+	}
+	if (cfg.check == CHECK_SHRINK)
+		led.ninst = 1 + rnd_range(MAX_INST);
+	if (cfg.check == CHECK_POOL) {
+		/* guarantees that fit, and a pool some buffer_limits don't */
+		led.ninst = 2 + rnd_range(MAX_INST - 1);
+		led.pool_min = 16384 << rnd_range(3);
+		led.pool = led.pool_min * (led.ninst + rnd_range(4 * led.ninst));
+		cake_sim_mem_pool(led.pool, led.pool_min);
+	}
+	for (i = 0; i < led.ninst; i++) {
+		struct inst *in = &led.inst[i];
+
+		memset(in, 0, sizeof(*in));
+		in->idx  = i;
+		in->cake = cake_sim_create(opt, n, 1500);
+		if (!in->cake) {
+			fprintf(stderr, "cake_sim_create failed\n");
+			return -1;
+		}
+		cake_sim_on_drop(in->cake, check_dropped, in);
+	}
+
+	if (!nflows)
+		nflows = draw_flows(flows);
+	mean_gap = draw_gap(&rc);
+
+	for (step = 0; step < cfg.steps && !led.err[0]; step++) {
+		uint32_t r = rnd_range(100);
+		struct inst *in;
+
+		now += rnd_range(2 * mean_gap + 1);
+		cake_sim_set_time(now);
+
+		if (r < 55) {
+			int f = rnd_range(nflows);
+			int burst = 1 + (rnd_range(4) ? 0 : rnd_range(16));
+
+			what = "enqueue";
+			in = &led.inst[f % led.ninst];
+			for (i = 0; i < burst; i++)
+				check_enqueue(in, &flows[f], f, 1);
+		} else if (r < 95) {
+			int polls = r < 85 ? 1 : 1 << 30;
+
+			what = "dequeue";
+			in = &led.inst[rnd_range(led.ninst)];
+			for (i = 0; i < polls && check_dequeue(in); i++)
+				;
+		} else {
+			what = check_names[cfg.check];
+			switch (cfg.check) {
+			case CHECK_SHRINK:
+				check_shrink();
+				break;
+			case CHECK_REPLACE:
+				check_replace(&led.inst[0]);
+				break;
+			case CHECK_CHANGE:
+				check_change(&led.inst[0]);
+				break;
+			case CHECK_TENANTS:
+				/* a GSO packet, split by tenant */
+				i = rnd_range(nflows);
+				check_enqueue(&led.inst[0], &flows[i], i,
+					      2 + rnd_range(15));
+				break;
+			case CHECK_POOL:
+				/* checked on every step; drain one instance */
+				in = &led.inst[rnd_range(led.ninst)];
+				now = cake_sim_wakeup(in->cake) > now ?
+				      cake_sim_wakeup(in->cake) : now;
+				cake_sim_set_time(now);
+				while (check_dequeue(in))
+					;
+				break;
+			}
+		}
+		led_verify();
+	}
+
+	/* then everything still queued has to come out */
+	for (i = 0; i < led.ninst && !led.err[0]; i++) {
+		struct inst *in = &led.inst[i];
+
+		what = "drain";
+		while (in->qlen && !led.err[0]) {
+			uint64_t wake = cake_sim_wakeup(in->cake);
+
+			now = wake > now ? wake : now + 1;
+			cake_sim_set_time(now);
+			while (check_dequeue(in))
+				;
+			led_verify();
+			if (in->qlen && !cake_sim_wakeup(in->cake))
+				check_fail("instance %u stuck with %u pkts",
+					   in->idx, in->qlen);
+		}
+	}
+
+	if (led.err[0]) {
+		printf("BROKEN seed %u step %d t=%llu ns (%s): %s\n", seed,
+		       step, (unsigned long long)now, what, led.err);
+		ret = 1;
+	}
+	for (i = 0; i < led.ninst; i++)
+		cake_sim_destroy(led.inst[i].cake);
+	if (led.pool)
+		cake_sim_mem_pool(0, 65536);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n runs] [-s first_seed] [-e steps] [-v]\n"
+		"       %s -c shrink|pool|replace|change|tenants [-n runs] "
+		"[-s first_seed] [-e steps]\n",
+		prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int c, i, bad = 0;
+
+	while ((c = getopt(argc, argv, "c:n:s:e:vh")) != -1) {
+		switch (c) {
+		case 'c':
+			cfg.check = lookup(optarg, check_names,
+					   sizeof(check_names) /
+					   sizeof(check_names[0]));
+			if (cfg.check < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			cfg.runs = atoi(optarg);
+			break;
+		case 's':
+			cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			cfg.steps = atoi(optarg);
+			break;
+		case 'v':
+			cfg.verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	for (i = 0; i < cfg.runs; i++) {
+		int ret = cfg.check ? check_run(cfg.seed + i)
+				    : run(cfg.seed + i);
+
+		if (ret < 0)
+			return 2;
+		if (ret) {
+			bad = 1;
+			break;
+		}
+	}
+
+	if (!bad && cfg.check)
+		printf("%d runs of %d steps, %s checks held\n", cfg.runs,
+		       cfg.steps, check_names[cfg.check]);
+	else if (!bad)
+		printf("%d runs of %d steps, no divergence\n", cfg.runs,
+		       cfg.steps);
+	return bad;
+}
@@ -0,0 +1,188 @@
+#!/bin/sh
+#
+# cakedrig.sh - run caked between veth pairs in namespaces
+#
+#	ns cakedrig-tx: tx0 --- br0 [caked] br1 --- rx0 :ns cakedrig-rx
+#	                        ns cakedrig-br
+#
+# No module needed: caked shapes tx -> rx in userspace and passes rx -> tx
+# as is.  For every rate and for both the timerfd and the busy-poll
+# shaper it measures:
+#   udp    goodput of a UDP flood at twice the shaped rate, against it;
+#   load   ping RTT percentiles while TCP bulk senders fill the link,
+#          plus their goodput.
+#
+#	make userspace && sudo userspace/cakedrig.sh
+#	sudo userspace/cakedrig.sh -r "20 200" -d besteffort -t 20
+#
+# Rates are in Mbit/s, as caked takes them.  Results go to stdout as one
+# whitespace-separated line per measurement, followed by caked's stats.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+CAKED=$HERE/caked
+CAKECTL=$HERE/cakectl
+
+RATES="10 100"
+MODE=diffserv4
+FLOWS=flows
+SECS=10
+POLLS="timerfd busy"
+TCP_STREAMS=4
+
+TX=cakedrig-tx
+BR=cakedrig-br
+RX=cakedrig-rx
+TX_IP=10.254.81.1
+RX_IP=10.254.81.2
+SOCK=/run/caked.cakedrig.sock
+
+usage() {
+	cat >&2 <<EOF
+usage: $0 [options]
+  -r rates  shaped rates in Mbit/s ("$RATES")
+  -d mode   diffserv mode ($MODE)
+  -f mode   flow mode ($FLOWS)
+  -t secs   duration of each measurement ($SECS)
+  -p polls  "timerfd", "busy" or both ("$POLLS")
+  -P n      TCP streams in the load test ($TCP_STREAMS)
+EOF
+	exit 2
+}
+
+while getopts "r:d:f:t:p:P:h" opt; do
+	case $opt in
+	r) RATES=$OPTARG ;;
+	d) MODE=$OPTARG ;;
+	f) FLOWS=$OPTARG ;;
+	t) SECS=$OPTARG ;;
+	p) POLLS=$OPTARG ;;
+	P) TCP_STREAMS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+die() {
+	echo "cakedrig: $*" >&2
+	exit 1
+}
+
+[ "$(id -u)" = 0 ] || die "must be run as root"
+[ -x "$CAKED" ] && [ -x "$CAKECTL" ] ||
+	die "caked or cakectl missing, run 'make userspace' first"
+command -v iperf3 >/dev/null || die "needs iperf3"
+command -v ethtool >/dev/null || die "needs ethtool"
+
+tx() { ip netns exec $TX "$@"; }
+br() { ip netns exec $BR "$@"; }
+rx() { ip netns exec $RX "$@"; }
+
+CAKED_PID=
+
+cleanup() {
+	set +e
+	[ -n "$CAKED_PID" ] && kill $CAKED_PID 2>/dev/null
+	ip netns pids $RX 2>/dev/null | xargs -r kill 2>/dev/null
+	ip netns del $TX 2>/dev/null
+	ip netns del $BR 2>/dev/null
+	ip netns del $RX 2>/dev/null
+	rm -f $SOCK
+}
+trap cleanup EXIT INT TERM
+
+# ---- topology ----
+
+for ns in $TX $BR $RX; do
+	ip netns del $ns 2>/dev/null || true
+	ip netns add $ns
+	ip netns exec $ns ip link set lo up
+done
+ip link add tx0 netns $TX type veth peer name br0 netns $BR
+ip link add rx0 netns $RX type veth peer name br1 netns $BR
+tx ip addr add $TX_IP/24 dev tx0
+rx ip addr add $RX_IP/24 dev rx0
+
+# packet sockets need whole, checksummed frames no larger than the MTU
+for dev in "tx tx0" "br br0" "br br1" "rx rx0"; do
+	set -- $dev
+	$1 ethtool -K $2 tso off gso off gro off tx off rx off >/dev/null 2>&1
+	$1 ip link set $2 up
+done
+
+rx iperf3 -s -D -p 5201 >/dev/null
+
+# ---- one rate ----
+
+start_caked() {
+	poll=$1
+	rate=$2
+
+	br "$CAKED" -i br0 -o br1 -r $rate -d $MODE -f $FLOWS -S $SOCK \
+		$([ $poll = busy ] && echo -b) &
+	CAKED_PID=$!
+	sleep 0.5
+	kill -0 $CAKED_PID 2>/dev/null || die "caked didn't start"
+	tx ping -c 1 -W 2 $RX_IP >/dev/null || die "no traffic through caked"
+}
+
+stop_caked() {
+	br "$CAKECTL" stats sock $SOCK json | sed "s/^/stats $tag /"
+	kill $CAKED_PID
+	wait $CAKED_PID 2>/dev/null || true
+	CAKED_PID=
+}
+
+percentiles() {
+	# stdin: one RTT (ms) per line
+	sort -n | awk '{ v[NR] = $1 }
+	END {
+		if (!NR) { print "n=0"; exit }
+		printf "n=%d p50=%s p90=%s p99=%s max=%s\n", NR,
+		       v[int(NR * 0.50) + 1 > NR ? NR : int(NR * 0.50) + 1],
+		       v[int(NR * 0.90) + 1 > NR ? NR : int(NR * 0.90) + 1],
+		       v[int(NR * 0.99) + 1 > NR ? NR : int(NR * 0.99) + 1],
+		       v[NR]
+	}'
+}
+
+goodput() {
+	# the receiver's Mbits/sec; UDP reports add jitter and loss after it
+	awk '/receiver/ {
+		for (i = 2; i < NF; i++)
+			if ($i == "Mbits/sec")
+				v = $(i - 1)
+	}
+	END { print v + 0 }' "$1"
+}
+
+run() {
+	poll=$1
+	rate=$2
+	tag="poll=$poll rate=$rate mode=$MODE flows=$FLOWS"
+
+	start_caked $poll $rate
+	tx iperf3 -c $RX_IP -p 5201 -u -b $((rate * 2))M -l 1400 -t $SECS \
+		-f m > /tmp/cakedrig.udp.$$ 2>&1 || true
+	echo "udp $tag mbit=$(goodput /tmp/cakedrig.udp.$$)"
+	stop_caked
+
+	start_caked $poll $rate
+	tx iperf3 -c $RX_IP -p 5201 -t $SECS -P $TCP_STREAMS -f m \
+		> /tmp/cakedrig.tcp.$$ 2>&1 &
+	tcp=$!
+	sleep 1
+	tx ping -n -i 0.1 -w $((SECS - 2)) $RX_IP 2>/dev/null |
+		sed -n 's/.*time=\([0-9.]*\).*/\1/p' > /tmp/cakedrig.rtt.$$
+	wait $tcp || true
+	echo "load $tag mbit=$(goodput /tmp/cakedrig.tcp.$$)" \
+	     "rtt_ms $(percentiles < /tmp/cakedrig.rtt.$$)"
+	stop_caked
+	rm -f /tmp/cakedrig.*.$$
+}
+
+for poll in $POLLS; do
+	for rate in $RATES; do
+		run $poll $rate
+	done
+done
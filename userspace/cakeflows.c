@@ -0,0 +1,491 @@
+/*
+ * cakeflows - flow table collisions and scaling
+ *
+ * cake_hash() maps each flow straight onto one of flows_cnt queues per
+ * tin.  For every number of concurrent flows asked for, this classifies
+ * that many distinct 5-tuples through libcake and reports:
+ *   - the share of flows that have to share a queue, next to what a
+ *     uniform hash would give and what an 8-way set-associative table
+ *     (a flow takes any free way in its set of eight) would give for
+ *     the very same queue indices;
+ *   - the sojourn time of sparse flows that are alone in their queue and
+ *     of those that share one with a bulk flow, under a 2x overload of
+ *     bulk traffic, and the ratio between the two medians (0 when no
+ *     flow is left alone to compare with);
+ *   - the instance's static memory, the flow table per tin, and what a
+ *     set-associative (tags) or a dynamically sized table would cost.
+ *
+ * Flows are random 5-tuples, or the distinct 5-tuples of a capture:
+ *
+ *	cakeflows -n 10,100,1000,10000,100000
+ *	cakeflows -p edge.pcapng -n 1000,10000 -j
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include "libcake.h"
+#include "util.h"
+#include "pcapread.h"
+#include "../pkt_sched.h"
+
+#define NSEC_PER_SEC	1000000000ULL
+#define MAX_COUNTS	32
+#define WAYS		8
+#define BULK_LEN	1500
+#define SPARSE_LEN	200
+
+enum { CAT_SOLO, CAT_SPARSE, CAT_BULK };
+
+struct flow {
+	struct tuple	t;
+	uint16_t	queue;
+	uint8_t		bulk;
+	uint8_t		cat;	/* sparse flows: who shares their queue */
+};
+
+static struct {
+	uint32_t	counts[MAX_COUNTS];
+	int		ncounts;
+	const char	*pcap;
+	double		rate_mbit;
+	double		seconds;
+	int		bulk_pct;
+	uint32_t	seed;
+	int		json;
+} cfg = { .rate_mbit = 100, .seconds = 5, .bulk_pct = 10, .seed = 1 };
+
+static struct tuple *tuples;
+static size_t ntuples;
+
+static uint64_t sparse_sent[3], sparse_dropped[3], warmup;
+static struct flow *flows;
+
+/* ---- utilities ---- */
+
+/* in microseconds, from nanosecond samples */
+static double percentile_us(struct samples *s, double p)
+{
+	return percentile(s, p) / 1e3;
+}
+
+/* ---- 5-tuples ---- */
+
+static uint32_t tuple_hash(const struct tuple *t)
+{
+	const uint8_t *p = (const uint8_t *)t;
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(*t); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h;
+}
+
+/* Collect up to max distinct tuples from next(); returns how many. */
+static size_t collect(size_t max, int (*next)(void *, struct tuple *),
+		      void *arg)
+{
+	size_t cap = 1, i;
+	uint32_t *slot;
+	struct tuple t;
+
+	while (cap < 2 * max)
+		cap <<= 1;
+	slot = calloc(cap, sizeof(*slot));	/* index + 1, 0 = empty */
+	tuples = calloc(max, sizeof(*tuples));
+	if (!slot || !tuples) {
+		perror("calloc");
+		exit(1);
+	}
+
+	while (ntuples < max && next(arg, &t) > 0) {
+		for (i = tuple_hash(&t) & (cap - 1); slot[i];
+		     i = (i + 1) & (cap - 1))
+			if (!memcmp(&tuples[slot[i] - 1], &t, sizeof(t)))
+				break;
+		if (!slot[i]) {
+			tuples[ntuples++] = t;
+			slot[i] = ntuples;
+		}
+	}
+	free(slot);
+	return ntuples;
+}
+
+static int next_random(void *arg, struct tuple *t)
+{
+	static const uint16_t ports[] = { 443, 443, 443, 80, 53, 22, 8080 };
+
+	(void)arg;
+	memset(t, 0, sizeof(*t));
+	t->proto  = rnd() % 4 ? IPPROTO_TCP : IPPROTO_UDP;
+	t->src[0] = 10;
+	t->src[1] = rnd() & 15;
+	t->src[2] = rnd();
+	t->src[3] = rnd();
+	t->dst[0] = 1 + rnd() % 223;
+	t->dst[1] = rnd();
+	t->dst[2] = rnd();
+	t->dst[3] = rnd();
+	t->sport  = 1024 + rnd() % 64512;
+	t->dport  = ports[rnd() % 7];
+	return 1;
+}
+
+static int next_pcap(void *arg, struct tuple *t)
+{
+	struct pcap_pkt pkt;
+	int ret;
+
+	while ((ret = pcap_next_ip(arg, &pkt)) > 0) {
+		const uint8_t *p = pkt.data;
+		unsigned int hl;
+
+		memset(t, 0, sizeof(*t));
+		if (pkt.caplen >= 20 && p[0] >> 4 == 4) {
+			hl = (p[0] & 15) * 4;
+			t->proto = p[9];
+			memcpy(t->src, p + 12, 4);
+			memcpy(t->dst, p + 16, 4);
+			/* later fragments carry no ports */
+			if ((p[6] & 0x1f) || p[7])
+				hl = 0;
+		} else if (pkt.caplen >= 40 && p[0] >> 4 == 6) {
+			hl = 40;
+			t->v6 = 1;
+			t->proto = p[6];
+			memcpy(t->src, p + 8, 16);
+			memcpy(t->dst, p + 24, 16);
+		} else {
+			continue;
+		}
+		if ((t->proto == IPPROTO_TCP || t->proto == IPPROTO_UDP) &&
+		    hl && pkt.caplen >= hl + 4) {
+			t->sport = p[hl] << 8 | p[hl + 1];
+			t->dport = p[hl + 2] << 8 | p[hl + 3];
+		}
+		return 1;
+	}
+	return ret;
+}
+
+/* ---- one flow count ---- */
+
+static void on_drop(void *arg, const struct cake_pkt *pkt)
+{
+	const struct flow *f = &flows[pkt->cookie];
+
+	(void)arg;
+	if (!f->bulk && cake_sim_time() >= warmup)
+		sparse_dropped[f->cat]++;
+}
+
+static void record(struct samples *sojourn, const struct cake_pkt *pkt,
+		   uint64_t now)
+{
+	const struct flow *f = &flows[pkt->cookie];
+
+	if (f->bulk || now < warmup)
+		return;
+	samples_add(&sojourn[f->cat], now - pkt->enqueue_ns);
+}
+
+/* Bulk flows offer twice the shaped rate, sparse ones a tenth of it. */
+static void run_traffic(struct cake_sim *cake, const uint32_t *bulk,
+			uint32_t nbulk, const uint32_t *sparse,
+			uint32_t nsparse, struct samples *sojourn)
+{
+	double rate = cfg.rate_mbit * 1e6 / 8;
+	double bulk_gap = NSEC_PER_SEC * BULK_LEN / (2 * rate);
+	double sparse_gap = NSEC_PER_SEC * SPARSE_LEN / (0.1 * rate);
+	uint64_t end = cfg.seconds * NSEC_PER_SEC;
+	uint64_t now = 0, next_bulk, next_sparse;
+	struct cake_pkt pkt;
+	uint8_t buf[BULK_LEN];
+
+	warmup = end / 5;
+	next_bulk = rnd_exp(bulk_gap);
+	next_sparse = rnd_exp(sparse_gap);
+
+	while (now < end) {
+		uint64_t t = next_bulk < next_sparse ? next_bulk : next_sparse;
+		uint64_t wake = cake_sim_qlen(cake) ? cake_sim_wakeup(cake) : 0;
+
+		if (wake && wake <= t) {
+			now = wake > now ? wake : now + 1;
+		} else {
+			uint32_t id;
+
+			now = t;
+			cake_sim_set_time(now);
+			if (t == next_bulk) {
+				id = bulk[rnd() % nbulk];
+				build_pkt(buf, &flows[id].t, 0, BULK_LEN);
+				cake_sim_enqueue(cake, buf, BULK_LEN, 0, id);
+				next_bulk += rnd_exp(bulk_gap) + 1;
+			} else {
+				id = sparse[rnd() % nsparse];
+				build_pkt(buf, &flows[id].t, 0, SPARSE_LEN);
+				if (now >= warmup)
+					sparse_sent[flows[id].cat]++;
+				cake_sim_enqueue(cake, buf, SPARSE_LEN, 0, id);
+				next_sparse += rnd_exp(sparse_gap) + 1;
+			}
+		}
+
+		cake_sim_set_time(now);
+		while (cake_sim_dequeue(cake, &pkt))
+			record(sojourn, &pkt, now);
+	}
+}
+
+static double pct(uint64_t a, uint64_t b)
+{
+	return b ? 100.0 * a / b : 0;
+}
+
+static void measure(uint32_t n)
+{
+	static struct samples sojourn[3];
+	struct cake_sim_opt opt[4];
+	struct cake_sim_mem mem;
+	struct cake_sim *cake;
+	uint32_t *occ, *bulk, *sparse, nbulk = 0, nsparse = 0, used = 0;
+	uint32_t i, q, max = 0, shared = 0, shared8 = 0;
+	uint8_t *has_bulk, buf[BULK_LEN];
+	double uniform, table, solo_p50, bulk_p50;
+	int k = 0;
+
+	rnd_seed(cfg.seed);
+	cake_sim_seed(cfg.seed);
+	cake_sim_set_time(0);
+	opt[k++] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE,
+					  cfg.rate_mbit * 1e6 / 8 };
+	opt[k++] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE, 1 };
+	opt[k++] = (struct cake_sim_opt){ TCA_CAKE_FLOW_MODE, 4 };
+	cake = cake_sim_create(opt, k, 1500);
+	if (!cake) {
+		fprintf(stderr, "cake_sim_create failed\n");
+		exit(1);
+	}
+	cake_sim_on_drop(cake, on_drop, NULL);
+	cake_sim_mem(cake, &mem);
+
+	flows    = calloc(n, sizeof(*flows));
+	occ      = calloc(mem.queues, sizeof(*occ));
+	has_bulk = calloc(mem.queues, 1);
+	bulk     = calloc(n, sizeof(*bulk));
+	sparse   = calloc(n, sizeof(*sparse));
+	if (!flows || !occ || !has_bulk || !bulk || !sparse) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct flow *f = &flows[i];
+		struct cake_pkt cls;
+
+		f->t = tuples[i];
+		build_pkt(buf, &f->t, 0, SPARSE_LEN);
+		if (cake_sim_classify_pkt(cake, buf, SPARSE_LEN, &cls))
+			abort();
+		f->queue = cls.flow;
+		f->bulk = (int)(rnd() % 100) < cfg.bulk_pct || (!i && n > 1);
+		if (f->bulk) {
+			bulk[nbulk++] = i;
+			has_bulk[f->queue] = 1;
+		}
+		occ[f->queue]++;
+	}
+
+	for (q = 0; q < mem.queues; q++) {
+		used += !!occ[q];
+		if (occ[q] > max)
+			max = occ[q];
+		if (occ[q] > 1)
+			shared += occ[q];
+	}
+
+	/* the same indices into sets of WAYS: a set only overflows once it
+	 * has more flows than ways, and then the extras pile onto ways
+	 * that are already taken
+	 */
+	for (q = 0; q < mem.queues; q += WAYS) {
+		uint32_t c = 0, e;
+
+		for (i = q; i < q + WAYS; i++)
+			c += occ[i];
+		if (c > WAYS) {
+			e = c - WAYS;
+			shared8 += e + (e < WAYS ? e : WAYS);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		struct flow *f = &flows[i];
+
+		if (f->bulk)
+			continue;
+		f->cat = occ[f->queue] == 1 ? CAT_SOLO :
+			 has_bulk[f->queue] ? CAT_BULK : CAT_SPARSE;
+		sparse[nsparse++] = i;
+	}
+
+	memset(sparse_sent, 0, sizeof(sparse_sent));
+	memset(sparse_dropped, 0, sizeof(sparse_dropped));
+	for (k = 0; k < 3; k++)
+		sojourn[k].n = 0;
+	if (nbulk && nsparse)
+		run_traffic(cake, bulk, nbulk, sparse, nsparse, sojourn);
+	for (k = 0; k < 3; k++)
+		samples_sort(&sojourn[k]);
+
+	uniform = 100 * (1 - pow(1 - 1.0 / mem.queues, n - 1));
+	table = mem.queues * (mem.flow_bytes + 4.0);
+	solo_p50 = percentile_us(&sojourn[CAT_SOLO], 0.5);
+	bulk_p50 = percentile_us(&sojourn[CAT_BULK], 0.5);
+
+	if (cfg.json)
+		printf("{\"flows\":%u,\"source\":\"%s\",\"queues\":%u,"
+		       "\"queues_used\":%u,\"shared_pct\":%.2f,"
+		       "\"uniform_pct\":%.2f,\"shared_8way_pct\":%.2f,"
+		       "\"max_per_queue\":%u,\"solo_p50_us\":%.1f,"
+		       "\"solo_p99_us\":%.1f,\"bulk_shared_p50_us\":%.1f,"
+		       "\"bulk_shared_p99_us\":%.1f,\"inflation\":%.2f,"
+		       "\"solo_loss_pct\":%.2f,\"bulk_shared_loss_pct\":%.2f,"
+		       "\"instance_kb\":%.1f,\"table_kb\":%.1f,"
+		       "\"table_8way_kb\":%.1f,\"table_dynamic_kb\":%.1f}\n",
+		       n, cfg.pcap ? cfg.pcap : "random", mem.queues, used,
+		       pct(shared, n), uniform, pct(shared8, n), max,
+		       solo_p50, percentile_us(&sojourn[CAT_SOLO], 0.99),
+		       bulk_p50, percentile_us(&sojourn[CAT_BULK], 0.99),
+		       solo_p50 > 0 ? bulk_p50 / solo_p50 : 0,
+		       pct(sparse_dropped[CAT_SOLO], sparse_sent[CAT_SOLO]),
+		       pct(sparse_dropped[CAT_BULK], sparse_sent[CAT_BULK]),
+		       (mem.kmalloc_bytes + mem.vmalloc_bytes) / 1024.0,
+		       table / 1024, (table + mem.queues * 4.0) / 1024,
+		       n * (mem.flow_bytes + 4 + 16.0) / 1024);
+	else
+		printf("%u,%s,%u,%u,%.2f,%.2f,%.2f,%u,%.1f,%.1f,%.1f,%.1f,"
+		       "%.2f,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f\n",
+		       n, cfg.pcap ? cfg.pcap : "random", mem.queues, used,
+		       pct(shared, n), uniform, pct(shared8, n), max,
+		       solo_p50, percentile_us(&sojourn[CAT_SOLO], 0.99),
+		       bulk_p50, percentile_us(&sojourn[CAT_BULK], 0.99),
+		       solo_p50 > 0 ? bulk_p50 / solo_p50 : 0,
+		       pct(sparse_dropped[CAT_SOLO], sparse_sent[CAT_SOLO]),
+		       pct(sparse_dropped[CAT_BULK], sparse_sent[CAT_BULK]),
+		       (mem.kmalloc_bytes + mem.vmalloc_bytes) / 1024.0,
+		       table / 1024, (table + mem.queues * 4.0) / 1024,
+		       n * (mem.flow_bytes + 4 + 16.0) / 1024);
+
+	cake_sim_destroy(cake);
+	free(flows);
+	free(occ);
+	free(has_bulk);
+	free(bulk);
+	free(sparse);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -n counts  concurrent flows, comma-separated\n"
+		"             (10,100,1000,10000,100000)\n"
+		"  -p file    take distinct 5-tuples from a pcap/pcapng\n"
+		"  -r mbit    shaped rate for the latency run (100)\n"
+		"  -t secs    simulated time of each latency run (5)\n"
+		"  -b pct     share of flows that are bulk (10)\n"
+		"  -s seed, -j JSON lines\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t counts_default[] = {
+		10, 100, 1000, 10000, 100000,
+	};
+	uint32_t max = 0;
+	char *tok;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:p:r:t:b:s:jh")) != -1) {
+		switch (c) {
+		case 'n':
+			for (tok = strtok(optarg, ","); tok &&
+			     cfg.ncounts < MAX_COUNTS; tok = strtok(NULL, ","))
+				cfg.counts[cfg.ncounts++] = atoi(tok);
+			break;
+		case 'p':
+			cfg.pcap = optarg;
+			break;
+		case 'r':
+			cfg.rate_mbit = atof(optarg);
+			break;
+		case 't':
+			cfg.seconds = atof(optarg);
+			break;
+		case 'b':
+			cfg.bulk_pct = atoi(optarg);
+			break;
+		case 's':
+			cfg.seed = atoi(optarg);
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!cfg.ncounts) {
+		memcpy(cfg.counts, counts_default, sizeof(counts_default));
+		cfg.ncounts = 5;
+	}
+	for (i = 0; i < cfg.ncounts; i++) {
+		if (!cfg.counts[i])
+			usage(argv[0]);
+		if (cfg.counts[i] > max)
+			max = cfg.counts[i];
+	}
+	if (cfg.rate_mbit <= 0 || cfg.seconds <= 0 || cfg.bulk_pct < 0 ||
+	    cfg.bulk_pct > 100)
+		usage(argv[0]);
+	if (!cfg.seed)
+		cfg.seed = 1;
+
+	rnd_seed(cfg.seed);
+	if (cfg.pcap) {
+		struct pcap_reader *r = pcap_open(cfg.pcap);
+
+		if (!r)
+			return 1;
+		collect(max, next_pcap, r);
+		pcap_close(r);
+		if (ntuples < max)
+			fprintf(stderr, "cakeflows: %s has only %zu distinct "
+				"5-tuples\n", cfg.pcap, ntuples);
+	} else {
+		collect(max, next_random, NULL);
+	}
+
+	if (!cfg.json)
+		printf("flows,source,queues,queues_used,shared_pct,"
+		       "uniform_pct,shared_8way_pct,max_per_queue,"
+		       "solo_p50_us,solo_p99_us,bulk_shared_p50_us,"
+		       "bulk_shared_p99_us,inflation,solo_loss_pct,"
+		       "bulk_shared_loss_pct,instance_kb,table_kb,"
+		       "table_8way_kb,table_dynamic_kb\n");
+
+	for (i = 0; i < cfg.ncounts; i++)
+		measure(cfg.counts[i] < ntuples ? cfg.counts[i] : ntuples);
+	free(tuples);
+	return 0;
+}
@@ -0,0 +1,452 @@
+/*
+ * cakemath - accuracy and cost of the fixed-point helpers in sch_cake.c
+ *
+ * Checks codel_Newton_step(), codel_control_law(), cake_set_rate() and
+ * cake_overhead() against exact arithmetic over their input ranges, then
+ * times each of them per call the way cakebench does.  Prints one CSV row
+ * (or JSON line) per check: inputs covered, how many were out of bounds,
+ * the worst error and the bound it is held to, and for the timed rows
+ * ns/call and, where perf_event_open() is allowed, hardware counters per
+ * call.  Exits 1 if any check failed, so that a micro-optimisation of one
+ * of these helpers can be judged by
+ *
+ *	cakemath > before.csv; (apply patch); cakemath > after.csv
+ *
+ * The bounds:
+ *   codel_Newton_step   rec_inv_sqrt as codel_dequeue() keeps it, one step
+ *                       per drop from count = 1, and after re-entry (count
+ *                       - 2 and two steps), within NEWTON_LSB of
+ *                       2^16 / sqrt(count) from NEWTON_SETTLED drops on.
+ *                       Before that the estimate is still converging from
+ *                       1.0, as it has been since the sqrt cache went;
+ *                       the rows per power of two show by how much, but
+ *                       don't fail.
+ *   codel_control_law   t + interval * rec_inv_sqrt / 2^16 rounded down.
+ *                       reciprocal_scale() takes 32 bits, so intervals are
+ *                       checked up to 2^32 - 1 ns.
+ *   cake_set_rate       (len * tin_rate_ns) >> tin_rate_shft below
+ *                       len * 10^9 / max(rate, 64) by at most 1 ns plus
+ *                       2^-30 of it; max_err is that excess, relative.
+ *                       Also the quantum that rate should get.
+ *   cake_overhead       exactly in + overhead, in 48 byte ATM cells of 53
+ *                       when atm is on.  Sums below zero wrap; they are
+ *                       counted, not failed.
+ *
+ *	cakemath		count up to 2^28, some seconds
+ *	cakemath -c 32		every count, a couple of minutes
+ *	cakemath -c 24 -j	count up to 2^24, JSON
+ */
+
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include "../sch_cake.c"
+#include "perfctr.h"
+
+#define NEWTON_LSB	2
+#define NEWTON_SETTLED	64
+#define COST_INPUTS	(1 << 16)
+
+static struct {
+	int		count_bits;
+	int		rounds;
+	int		json;
+} cfg = {
+	.count_bits = 28, .rounds = 5,
+};
+
+static struct perfctr pc;
+static int failed;
+
+struct check {
+	const char	*name;
+	const char	*range;
+	u64		inputs;
+	u64		failed;
+	long double	max_err;
+	long double	bound;
+	const char	*unit;
+};
+
+struct cost {
+	u64	ops;
+	u64	ns;
+	u64	ctr[PERFCTR_MAX];
+};
+
+static u64 wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void timer_start(struct cost *c)
+{
+	perfctr_start(&pc);
+	c->ns -= wall_ns();
+}
+
+static void timer_stop(struct cost *c, u64 ops)
+{
+	int i;
+
+	c->ns += wall_ns();
+	perfctr_stop(&pc);
+	c->ops += ops;
+	for (i = 0; i < PERFCTR_MAX; i++)
+		c->ctr[i] = (c->ctr[i] == PERFCTR_NONE ||
+			     pc.delta[i] == PERFCTR_NONE) ?
+			    PERFCTR_NONE : c->ctr[i] + pc.delta[i];
+}
+
+static void check_err(struct check *ck, long double err)
+{
+	ck->inputs++;
+	if (fabsl(err) > fabsl(ck->max_err))
+		ck->max_err = err;
+	if (fabsl(err) > ck->bound)
+		ck->failed++;
+}
+
+static void print_row(const struct check *ck, const struct cost *c)
+{
+	double ops = c && c->ops ? c->ops : 1;
+	int i;
+
+	if (ck->failed)
+		failed = 1;
+
+	if (cfg.json) {
+		printf("{\"check\":\"%s\",\"range\":\"%s\",\"inputs\":%llu,"
+		       "\"failed\":%llu,\"max_err\":%.6Lg,\"unit\":\"%s\"",
+		       ck->name, ck->range, (unsigned long long)ck->inputs,
+		       (unsigned long long)ck->failed, ck->max_err, ck->unit);
+		if (isinf(ck->bound))
+			printf(",\"bound\":null");
+		else
+			printf(",\"bound\":%.6Lg", ck->bound);
+		if (c) {
+			printf(",\"ns_per_call\":%.2f", c->ns / ops);
+			for (i = 0; i < PERFCTR_MAX; i++) {
+				if (c->ctr[i] == PERFCTR_NONE)
+					printf(",\"%s_per_call\":null",
+					       perfctr_names[i]);
+				else
+					printf(",\"%s_per_call\":%.2f",
+					       perfctr_names[i],
+					       c->ctr[i] / ops);
+			}
+		}
+		printf("}\n");
+		return;
+	}
+
+	printf("%s,%s,%llu,%llu,%.6Lg,%.6Lg,%s", ck->name, ck->range,
+	       (unsigned long long)ck->inputs,
+	       (unsigned long long)ck->failed, ck->max_err, ck->bound,
+	       ck->unit);
+	if (c) {
+		printf(",%.2f", c->ns / ops);
+		for (i = 0; i < PERFCTR_MAX; i++) {
+			if (c->ctr[i] == PERFCTR_NONE)
+				printf(",");
+			else
+				printf(",%.2f", c->ctr[i] / ops);
+		}
+	} else {
+		printf(",");
+		for (i = 0; i < PERFCTR_MAX; i++)
+			printf(",");
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/* ---- codel_Newton_step() ---- */
+
+static long double newton_err(const struct codel_vars *v)
+{
+	return v->rec_inv_sqrt - 65536.0L / sqrtl(v->count);
+}
+
+static void check_newton(void)
+{
+	struct check all = {
+		"codel_Newton_step", "", 0, 0, 0, NEWTON_LSB, "lsb",
+	};
+	struct check reentry = all, bucket = all;
+	struct codel_vars v, r;
+	char range[32];
+	u64 count, end = 1ULL << cfg.count_bits;
+	int bits = 0;
+
+	reentry.name = "codel_Newton_step(reentry)";
+
+	/* entering dropping state afresh, as codel_dequeue() does */
+	codel_vars_init(&v);
+	v.count = 1;
+	v.rec_inv_sqrt = ~0U >> REC_INV_SQRT_SHIFT;
+	codel_Newton_step(&v);
+
+	for (count = 1; count < end; count++) {
+		if (count == 1ULL << bits) {
+			if (bits) {
+				snprintf(range, sizeof(range),
+					 "count<2^%d", bits);
+				bucket.range = range;
+				print_row(&bucket, NULL);
+			}
+			bucket.inputs = bucket.failed = 0;
+			bucket.max_err = 0;
+			bucket.bound = count < NEWTON_SETTLED ? INFINITY :
+							       NEWTON_LSB;
+			bits++;
+		}
+		if (count > 1) {
+			v.count++;
+			codel_Newton_step(&v);
+		}
+		check_err(&bucket, newton_err(&v));
+		if (count >= NEWTON_SETTLED)
+			check_err(&all, newton_err(&v));
+
+		/* back into dropping soon after leaving it at this count */
+		if (count >= NEWTON_SETTLED + 2) {
+			r = v;
+			r.count -= 2;
+			codel_Newton_step(&r);
+			codel_Newton_step(&r);
+			check_err(&reentry, newton_err(&r));
+		}
+	}
+	snprintf(range, sizeof(range), "count<2^%d", bits);
+	bucket.range = range;
+	print_row(&bucket, NULL);
+
+	snprintf(range, sizeof(range), "%d<=count<2^%d", NEWTON_SETTLED,
+		 cfg.count_bits);
+	reentry.range = range;
+	print_row(&reentry, NULL);
+
+	{
+		struct codel_vars *in = calloc(COST_INPUTS, sizeof(*in));
+		struct cost c = { 0 };
+		volatile u32 sink = 0;
+		int i, round;
+
+		if (!in)
+			abort();
+		for (i = 0; i < COST_INPUTS; i++) {
+			in[i].count = (prandom_u32() >> (i & 31)) | 1;
+			in[i].rec_inv_sqrt = min(65535.0L,
+						 65536.0L / sqrtl(in[i].count));
+		}
+		for (round = 0; round < cfg.rounds; round++) {
+			timer_start(&c);
+			for (i = 0; i < COST_INPUTS; i++) {
+				codel_Newton_step(&in[i]);
+				sink += in[i].rec_inv_sqrt;
+			}
+			timer_stop(&c, COST_INPUTS);
+		}
+		(void)sink;
+		all.range = range;
+		print_row(&all, &c);
+		free(in);
+	}
+}
+
+/* ---- codel_control_law() ---- */
+
+static void check_control_law(void)
+{
+	struct check ck = {
+		"codel_control_law", "interval<2^32ns", 0, 0, 0, 1, "ns",
+	};
+	codel_time_t t = 1ULL << 40, interval, got;
+	struct cost c = { 0 };
+	volatile u64 sink = 0;
+	u32 rec, i;
+	int round;
+
+	/* every rec_inv_sqrt, against 1 us to 4.29 s in 1/64 octaves */
+	for (i = 0; i < 64 * 22; i++) {
+		interval = 1000 * exp2l(i / 64.0L);
+		if (interval >> 32)
+			break;
+		for (rec = 0; rec < 65536; rec++) {
+			long double exact = t + (long double)interval *
+					    rec / 65536;
+
+			got = codel_control_law(t, interval, rec);
+			/* truncated, so 0 to 1 ns early */
+			check_err(&ck, got > exact ? 1e9 :
+					 (long double)got - exact);
+		}
+	}
+
+	for (round = 0; round < cfg.rounds; round++) {
+		timer_start(&c);
+		for (i = 0; i < COST_INPUTS; i++)
+			sink += codel_control_law(t, 100000000 + i, i);
+		timer_stop(&c, COST_INPUTS);
+	}
+	(void)sink;
+	print_row(&ck, &c);
+}
+
+/* ---- cake_set_rate() ---- */
+
+static void check_set_rate(void)
+{
+	static const u32 lens[] = { 1, 64, 1514, 65535 };
+	struct check ck = {
+		"cake_set_rate", "rate<2^32", 0, 0, 0, 1.0L / (1 << 30),
+		"rel",
+	};
+	struct check quantum = {
+		"cake_set_rate(quantum)", "rate<2^32", 0, 0, 0, 0, "bytes",
+	};
+	struct cake_tin_data b;
+	struct cost c = { 0 };
+	volatile u32 sink = 0;
+	u64 rate, n;
+	u32 i;
+	int round;
+
+	/* every rate up to 2^20 bytes/s, then as many spread log-evenly */
+	for (n = 0; n < 2ULL << 20; n++) {
+		rate = n < 1 << 20 ? n :
+		       (u64)exp2l(20 + 12.0L * (n - (1 << 20)) / (1 << 20));
+		if (rate >> 32)
+			rate = ~0U;
+
+		memset(&b, 0, sizeof(b));
+		cake_set_rate(&b, rate);
+		check_err(&quantum, (long double)b.quantum -
+			  (rate ? min(max(rate >> 12, 300ULL), 1514ULL) :
+				  1514));
+		if (!rate) {
+			check_err(&ck, b.tin_rate_ns ? 1e9 : 0);
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_SIZE(lens); i++) {
+			long double exact = (long double)lens[i] * NSEC_PER_SEC /
+					    max(rate, 64ULL);
+			u64 got = (lens[i] * (u64)b.tin_rate_ns) >>
+				  b.tin_rate_shft;
+			long double under = exact - got;
+
+			/* rounded down, by at most 1 ns and 2^-30 */
+			check_err(&ck, under < 0 ? 1 :
+				  max(under - 1, 0.0L) / exact);
+		}
+	}
+	print_row(&quantum, NULL);
+
+	for (round = 0; round < cfg.rounds; round++) {
+		timer_start(&c);
+		for (i = 0; i < COST_INPUTS; i++) {
+			cake_set_rate(&b, (u64)i << (i & 15));
+			sink += b.tin_rate_ns;
+		}
+		timer_stop(&c, COST_INPUTS);
+	}
+	(void)sink;
+	print_row(&ck, &c);
+}
+
+/* ---- cake_overhead() ---- */
+
+static void check_overhead(void)
+{
+	struct check ck = {
+		"cake_overhead", "len<2^16,overhead-64..256", 0, 0, 0, 0,
+		"bytes",
+	};
+	struct check wrap = ck;
+	static struct cake_sched_data q;
+	struct cost c = { 0 };
+	volatile u32 sink = 0;
+	int overhead, atm, round;
+	u32 len, i;
+
+	wrap.name = "cake_overhead(wrapped)";
+	wrap.bound = INFINITY;
+
+	for (atm = 0; atm < 2; atm++) {
+		q.rate_flags = atm ? CAKE_FLAG_ATM : 0;
+		for (overhead = -64; overhead <= 256; overhead++) {
+			q.rate_overhead = overhead;
+			for (len = 0; len < 1 << 16; len++) {
+				s64 sum = (s64)len + overhead;
+				s64 exact = atm ? (sum + 47) / 48 * 53 : sum;
+
+				if (sum < 0) {
+					wrap.inputs++;
+					continue;
+				}
+				check_err(&ck, (long double)
+					  cake_overhead(&q, len) - exact);
+			}
+		}
+	}
+	print_row(&wrap, NULL);
+
+	q.rate_flags = CAKE_FLAG_ATM;
+	q.rate_overhead = 18;
+	for (round = 0; round < cfg.rounds; round++) {
+		timer_start(&c);
+		for (i = 0; i < COST_INPUTS; i++)
+			sink += cake_overhead(&q, i);
+		timer_stop(&c, COST_INPUTS);
+	}
+	(void)sink;
+	print_row(&ck, &c);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "c:r:jh")) != -1) {
+		switch (c) {
+		case 'c':
+			cfg.count_bits = min(max(atoi(optarg), 2), 32);
+			break;
+		case 'r':
+			cfg.rounds = max(atoi(optarg), 1);
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-c count_bits] [-r rounds] [-j]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	perfctr_open(&pc);
+	shim_seed(1);
+
+	if (!cfg.json) {
+		printf("check,range,inputs,failed,max_err,bound,unit,"
+		       "ns_per_call");
+		for (c = 0; c < PERFCTR_MAX; c++)
+			printf(",%s_per_call", perfctr_names[c]);
+		printf("\n");
+	}
+
+	check_newton();
+	check_control_law();
+	check_set_rate();
+	check_overhead();
+
+	perfctr_close(&pc);
+	return failed;
+}
@@ -0,0 +1,231 @@
+/*
+ * cakemem - memory footprint of cake instances
+ *
+ * For every tin mode, shaped rate and number of flows asked for, this
+ * creates an instance through libcake and overloads it for a while with
+ * that many unresponsive flows, spread over the codepoints so that every
+ * tin gets some.  One row per instance:
+ *
+ *	diffserv,rate_mbit,flows,kmalloc_bytes,vmalloc_bytes,kmalloc_slab,
+ *	vmalloc_pages,static_kb,buffer_limit_kb,peak_queued_kb,worst_kb
+ *
+ * kmalloc_bytes and vmalloc_bytes are what cake_init() asked for and where
+ * cake_zalloc() placed it; kmalloc_slab and vmalloc_pages are the same
+ * allocations as the allocators round them up (powers of two, pages), and
+ * static_kb is their sum.  peak_queued_kb is the most skb truesize ever
+ * held, and worst_kb what an instance may pin at its memory limit.
+ *
+ * -K plays a fragmented machine by failing kmalloc above that size, which
+ * is when cake_zalloc() falls back to vmalloc:
+ *
+ *	cakemem -d all -r 10,100 -n 1,64,1024
+ *	cakemem -K 32768 -j
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include "libcake.h"
+#include "util.h"
+#include "../pkt_sched.h"
+
+#define NSEC_PER_SEC	1000000000ULL
+#define MAX_LIST	32
+#define PKT_LEN		1500
+
+
+/* a spread of codepoints so that every tin mode uses several tins */
+static const uint8_t dscps[] = { 0, 8, 10, 18, 26, 34, 46, 48 };
+
+static struct {
+	int		diffserv;	/* 0 = all */
+	double		rates[MAX_LIST];
+	int		nrates;
+	uint32_t	flows[MAX_LIST];
+	int		nflows;
+	double		seconds;
+	unsigned long	kmalloc_max;
+	int		json;
+} cfg = { .diffserv = 0, .seconds = 2 };
+
+static unsigned int flow_pkt(uint8_t *p, uint32_t id)
+{
+	struct tuple t = {
+		.proto = IPPROTO_UDP,
+		.sport = (0x30 | (id >> 24 & 0x0f)) << 8 | (id & 0xff),
+		.dport = 53,
+	};
+
+	tuple_v4(t.src, id);
+	tuple_v4(t.dst, 1);
+	return build_pkt(p, &t, dscps[id % sizeof(dscps)] << 2, PKT_LEN);
+}
+
+/* Unresponsive flows offering twice the shaped rate between them. */
+static void overload(struct cake_sim *cake, double rate_mbit,
+		     uint32_t nflows)
+{
+	double gap = NSEC_PER_SEC * PKT_LEN * 8 / (2 * rate_mbit * 1e6);
+	uint64_t end = cfg.seconds * NSEC_PER_SEC, now = 0, next;
+	static uint8_t buf[PKT_LEN];
+	struct cake_pkt pkt;
+
+	next = rnd_exp(gap);
+	while (now < end) {
+		uint64_t wake = cake_sim_qlen(cake) ? cake_sim_wakeup(cake) : 0;
+
+		if (wake && wake <= next) {
+			now = wake > now ? wake : now + 1;
+		} else {
+			uint32_t id = rnd() % nflows;
+
+			now = next;
+			cake_sim_set_time(now);
+			flow_pkt(buf, id);
+			cake_sim_enqueue(cake, buf, PKT_LEN, 0, id);
+			next += rnd_exp(gap) + 1;
+		}
+		cake_sim_set_time(now);
+		while (cake_sim_dequeue(cake, &pkt))
+			;
+	}
+}
+
+static void measure(int diffserv, double rate_mbit, uint32_t nflows)
+{
+	struct cake_sim_opt opt[2];
+	struct cake_sim_mem mem;
+	struct cake_sim *cake;
+	double stat, worst;
+
+	rnd_seed(1);
+	cake_sim_seed(1);
+	cake_sim_set_time(0);
+	opt[0] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE,
+					rate_mbit * 1e6 / 8 };
+	opt[1] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE, diffserv };
+	cake = cake_sim_create(opt, 2, 1500);
+	if (!cake) {
+		fprintf(stderr, "cake_sim_create failed\n");
+		exit(1);
+	}
+	overload(cake, rate_mbit, nflows);
+	cake_sim_mem(cake, &mem);
+
+	stat = (mem.kmalloc_slab + mem.vmalloc_pages) / 1024.0;
+	worst = stat + mem.buffer_limit / 1024.0;
+
+	if (cfg.json)
+		printf("{\"diffserv\":\"%s\",\"rate_mbit\":%g,\"flows\":%u,"
+		       "\"kmalloc_bytes\":%llu,\"vmalloc_bytes\":%llu,"
+		       "\"kmalloc_slab\":%llu,\"vmalloc_pages\":%llu,"
+		       "\"static_kb\":%.1f,\"buffer_limit_kb\":%.1f,"
+		       "\"peak_queued_kb\":%.1f,\"worst_kb\":%.1f}\n",
+		       diffserv_names[diffserv], rate_mbit, nflows,
+		       (unsigned long long)mem.kmalloc_bytes,
+		       (unsigned long long)mem.vmalloc_bytes,
+		       (unsigned long long)mem.kmalloc_slab,
+		       (unsigned long long)mem.vmalloc_pages, stat,
+		       mem.buffer_limit / 1024.0, mem.buffer_peak / 1024.0,
+		       worst);
+	else
+		printf("%s,%g,%u,%llu,%llu,%llu,%llu,%.1f,%.1f,%.1f,%.1f\n",
+		       diffserv_names[diffserv], rate_mbit, nflows,
+		       (unsigned long long)mem.kmalloc_bytes,
+		       (unsigned long long)mem.vmalloc_bytes,
+		       (unsigned long long)mem.kmalloc_slab,
+		       (unsigned long long)mem.vmalloc_pages, stat,
+		       mem.buffer_limit / 1024.0, mem.buffer_peak / 1024.0,
+		       worst);
+
+	cake_sim_destroy(cake);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d mode   diffserv mode or 'all' (all)\n"
+		"  -r mbit   shaped rates, comma-separated (1,10,100,1000)\n"
+		"  -n flows  concurrent flows, comma-separated (1,16,256,4096)\n"
+		"  -t secs   simulated overload per instance (2)\n"
+		"  -K bytes  fail kmalloc above this size (4M)\n"
+		"  -j        JSON lines\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static const double rates_default[] = { 1, 10, 100, 1000 };
+	static const uint32_t flows_default[] = { 1, 16, 256, 4096 };
+	int c, d, r, f, d0, d1;
+	char *tok;
+
+	while ((c = getopt(argc, argv, "d:r:n:t:K:jh")) != -1) {
+		switch (c) {
+		case 'd':
+			cfg.diffserv = strcmp(optarg, "all") ?
+				lookup(optarg, diffserv_names,
+				       CAKE_DIFFSERV_NAMES) : 0;
+			break;
+		case 'r':
+			for (tok = strtok(optarg, ","); tok &&
+			     cfg.nrates < MAX_LIST; tok = strtok(NULL, ","))
+				cfg.rates[cfg.nrates++] = atof(tok);
+			break;
+		case 'n':
+			for (tok = strtok(optarg, ","); tok &&
+			     cfg.nflows < MAX_LIST; tok = strtok(NULL, ","))
+				cfg.flows[cfg.nflows++] = atoi(tok);
+			break;
+		case 't':
+			cfg.seconds = atof(optarg);
+			break;
+		case 'K':
+			cfg.kmalloc_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!cfg.nrates) {
+		memcpy(cfg.rates, rates_default, sizeof(rates_default));
+		cfg.nrates = 4;
+	}
+	if (!cfg.nflows) {
+		memcpy(cfg.flows, flows_default, sizeof(flows_default));
+		cfg.nflows = 4;
+	}
+	for (r = 0; r < cfg.nrates; r++)
+		if (cfg.rates[r] <= 0)
+			usage(argv[0]);
+	for (f = 0; f < cfg.nflows; f++)
+		if (!cfg.flows[f])
+			usage(argv[0]);
+	d0 = cfg.diffserv ? cfg.diffserv : 1;
+	d1 = cfg.diffserv ? cfg.diffserv : CAKE_DIFFSERV_NAMES - 1;
+	if (d0 < 1 || d1 >= CAKE_DIFFSERV_NAMES || cfg.seconds < 0)
+		usage(argv[0]);
+	if (cfg.kmalloc_max)
+		cake_sim_kmalloc_max(cfg.kmalloc_max);
+
+	if (!cfg.json)
+		printf("diffserv,rate_mbit,flows,kmalloc_bytes,vmalloc_bytes,"
+		       "kmalloc_slab,vmalloc_pages,static_kb,buffer_limit_kb,"
+		       "peak_queued_kb,worst_kb\n");
+
+	for (d = d0; d <= d1; d++)
+		for (r = 0; r < cfg.nrates; r++)
+			for (f = 0; f < cfg.nflows; f++)
+				measure(d, cfg.rates[r], cfg.flows[f]);
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * cakerate - shaper accuracy across rates, packet sizes and framing
+ *
+ * cake_set_rate() turns the configured rate into a 32-bit time-per-byte
+ * fraction (rate_ns >> rate_shft) and cake_overhead() adds per-packet
+ * overhead and ATM cell padding.  This keeps one flow backlogged in
+ * libcake on a virtual clock, polls exactly when the shaper asks to be,
+ * and compares the wire rate actually achieved with the one configured.
+ *
+ *	rate_bps,size,framing,overhead,atm,packets,achieved_bps,error_pct,flag
+ *
+ * Wire bytes are worked out here, independently of cake, from the length
+ * of each packet dequeued (GSO aggregates arrive as segments).  Rows whose
+ * error exceeds the tolerance are flagged "over", and the exit status is
+ * then 1.  Rates that don't fit TCA_CAKE_BASE_RATE (u32 bytes/s, ~34 Gbit)
+ * are flagged "unrepresentable" and not run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include "libcake.h"
+#include "util.h"
+#include "../pkt_sched.h"
+
+#define NSEC_PER_SEC	1000000000ULL
+#define BACKLOG		4	/* packets kept queued */
+
+struct framing {
+	const char	*name;
+	int32_t		overhead;
+	int		atm;
+};
+
+static const struct framing framings[] = {
+	{ "raw",           0, 0 },
+	{ "ethernet",     38, 0 },
+	{ "docsis",       18, 0 },
+	{ "atm",           0, 1 },
+	{ "pppoa-vcmux",  10, 1 },
+	{ "pppoe-llcsnap", 40, 1 },
+	{ "negative",     -8, 0 },
+};
+#define NFRAMINGS	(sizeof(framings) / sizeof(framings[0]))
+
+static const double rates_default[] = {
+	64e3, 100e3, 256e3, 1e6, 2.5e6, 10e6, 25e6, 100e6, 250e6,
+	1e9, 2.5e9, 10e9, 25e9, 40e9, 100e9,
+};
+static const uint32_t sizes_default[] = {
+	64, 128, 256, 576, 1500, 9000, 16384, 65535,
+};
+
+static struct {
+	double		rates[64];
+	int		nrates;
+	uint32_t	sizes[64];
+	int		nsizes;
+	int		packets;
+	double		tolerance;	/* percent */
+	int		json;
+} cfg = { .packets = 1000, .tolerance = 0.1 };
+
+static uint32_t wire_bytes(uint32_t len, const struct framing *f)
+{
+	int64_t out = (int64_t)len + f->overhead;
+
+	if (out < 0)
+		out = 0;
+	if (f->atm)
+		out = (out + 47) / 48 * 53;
+	return out;
+}
+
+static void print_row(double rate, uint32_t size, const struct framing *f,
+		      int packets, double achieved, const char *flag)
+{
+	double err = achieved > 0 ? (achieved / rate - 1) * 100 : 0;
+
+	if (cfg.json)
+		printf("{\"rate_bps\":%.0f,\"size\":%u,\"framing\":\"%s\","
+		       "\"overhead\":%d,\"atm\":%d,\"packets\":%d,"
+		       "\"achieved_bps\":%.0f,\"error_pct\":%.5f,"
+		       "\"flag\":\"%s\"}\n",
+		       rate, size, f->name, f->overhead, f->atm, packets,
+		       achieved, err, flag);
+	else
+		printf("%.0f,%u,%s,%d,%d,%d,%.0f,%.5f,%s\n", rate, size,
+		       f->name, f->overhead, f->atm, packets, achieved, err,
+		       flag);
+}
+
+/* Returns 1 if the error was over tolerance. */
+static int measure(double rate, uint32_t size, const struct framing *f)
+{
+	static const struct tuple tuple = {
+		.proto = IPPROTO_UDP, .sport = 0x3000, .dport = 53,
+		.src = { 10, 0, 0, 1 }, .dst = { 10, 0, 0, 2 },
+	};
+	static uint8_t buf[65536];
+	struct cake_sim_opt opt[8];
+	struct cake_sim *cake;
+	struct cake_pkt pkt;
+	uint64_t first = 0, last = 0, wire = 0, cookie = 0, now = 0;
+	uint32_t last_wire = 0;
+	int n = 0, sent = 0, bad;
+	double achieved;
+
+	if (rate / 8 > UINT32_MAX) {
+		print_row(rate, size, f, 0, 0, "unrepresentable");
+		return 0;
+	}
+
+	/* no CoDel: a backlog this deep at 64 kbit would otherwise drop */
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE, rate / 8 };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE, 1 };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_OVERHEAD, f->overhead };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_ATM, f->atm };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_TARGET, 3600000000U };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_RTT, 3600000000U };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_MEMORY, 1U << 30 };
+
+	cake_sim_set_time(0);
+	cake = cake_sim_create(opt, n, 1500);
+	if (!cake) {
+		fprintf(stderr, "cake_sim_create failed\n");
+		exit(1);
+	}
+	build_pkt(buf, &tuple, 0, size);
+
+	while (sent < cfg.packets) {
+		while (cake_sim_qlen(cake) < BACKLOG)
+			cake_sim_enqueue(cake, buf, size,
+					 size > 1500 ? 1500 - 28 : 0,
+					 cookie++);
+
+		if (!cake_sim_dequeue(cake, &pkt)) {
+			uint64_t wake = cake_sim_wakeup(cake);
+
+			now = wake > now ? wake : now + 1;
+			cake_sim_set_time(now);
+			continue;
+		}
+
+		/* bytes are counted up to, not including, the last packet */
+		if (!sent)
+			first = now;
+		else
+			wire += last_wire;
+		last = now;
+		last_wire = wire_bytes(pkt.len, f);
+		sent++;
+	}
+	cake_sim_destroy(cake);
+
+	achieved = last > first ? wire * 8.0 * NSEC_PER_SEC / (last - first)
+				: 0;
+	bad = fabs(achieved / rate - 1) * 100 > cfg.tolerance;
+	print_row(rate, size, f, sent, achieved, bad ? "over" : "ok");
+	return bad;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -r rates  comma-separated, e.g. 64k,10M,1G (64k..100G)\n"
+		"  -s sizes  comma-separated IP lengths (64..65535)\n"
+		"  -n pkts   packets measured per configuration (1000)\n"
+		"  -T pct    tolerance in percent (0.1)\n"
+		"  -j        JSON lines\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int fr;
+	int c, r, s, bad = 0;
+	char *tok;
+
+	while ((c = getopt(argc, argv, "r:s:n:T:jh")) != -1) {
+		switch (c) {
+		case 'r':
+			for (tok = strtok(optarg, ","); tok && cfg.nrates < 64;
+			     tok = strtok(NULL, ","))
+				cfg.rates[cfg.nrates++] = parse_rate(tok);
+			break;
+		case 's':
+			for (tok = strtok(optarg, ","); tok && cfg.nsizes < 64;
+			     tok = strtok(NULL, ","))
+				cfg.sizes[cfg.nsizes++] = atoi(tok);
+			break;
+		case 'n':
+			cfg.packets = atoi(optarg);
+			break;
+		case 'T':
+			cfg.tolerance = atof(optarg);
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!cfg.nrates) {
+		memcpy(cfg.rates, rates_default, sizeof(rates_default));
+		cfg.nrates = sizeof(rates_default) / sizeof(rates_default[0]);
+	}
+	if (!cfg.nsizes) {
+		memcpy(cfg.sizes, sizes_default, sizeof(sizes_default));
+		cfg.nsizes = sizeof(sizes_default) / sizeof(sizes_default[0]);
+	}
+	for (r = 0; r < cfg.nrates; r++)
+		if (cfg.rates[r] <= 0)
+			usage(argv[0]);
+	for (s = 0; s < cfg.nsizes; s++)
+		if (cfg.sizes[s] < 28 || cfg.sizes[s] > 65535)
+			usage(argv[0]);
+	if (cfg.packets < 2)
+		usage(argv[0]);
+
+	if (!cfg.json)
+		printf("rate_bps,size,framing,overhead,atm,packets,"
+		       "achieved_bps,error_pct,flag\n");
+
+	for (r = 0; r < cfg.nrates; r++)
+		for (s = 0; s < cfg.nsizes; s++)
+			for (fr = 0; fr < NFRAMINGS; fr++)
+				bad |= measure(cfg.rates[r], cfg.sizes[s],
+					       &framings[fr]);
+	return bad;
+}
@@ -0,0 +1,464 @@
+/*
+ * cakeref - a plain reference model of cake's scheduling decisions,
+ * see cakeref.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "cakeref.h"
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_USEC	1000ULL
+#define ECN_NOT_ECT	0
+#define ECN_CE		3
+
+/* ---- configuration: one shaper rate and two DRR weights per tin ---- */
+
+/* time per byte as a 32-bit fraction, the way cake_set_rate() keeps it */
+static void ref_set_rate(struct cake_ref_tin *b, uint64_t rate)
+{
+	uint64_t rate_ns = 0;
+	int shft = 0;
+
+	b->quantum = 1514;
+	if (rate) {
+		b->quantum = rate >> 12;
+		if (rate >> 12 > 1514)
+			b->quantum = 1514;
+		if (rate >> 12 < 300)
+			b->quantum = 300;
+
+		shft = 32;
+		rate_ns = (NSEC_PER_SEC << 32) / (rate < 64 ? 64 : rate);
+		while (rate_ns >> 32) {
+			rate_ns >>= 1;
+			shft--;
+		}
+	}
+	b->rate_ns   = rate_ns;
+	b->rate_shft = shft;
+}
+
+static void ref_config(struct cake_ref *m)
+{
+	uint64_t rate = m->cfg.rate;
+	uint32_t prio = 256, band = 256;
+	int i;
+
+	switch (m->cfg.tin_mode) {
+	case 2:	/* precedence */
+	case 3:	/* diffserv8: same weights, different codepoint map */
+		m->tin_cnt = 8;
+		for (i = 0; i < 8; i++) {
+			ref_set_rate(&m->tins[i], rate);
+			m->tins[i].quantum_prio = prio ? prio : 1;
+			m->tins[i].quantum_band = band ? band : 1;
+			rate = rate * 7 / 8;
+			prio = prio * 3 / 2;
+			band = band * 7 / 8;
+		}
+		break;
+
+	case 4:	/* diffserv4 */
+		m->tin_cnt = 4;
+		ref_set_rate(&m->tins[0], rate);
+		ref_set_rate(&m->tins[1], rate - rate / 16);
+		ref_set_rate(&m->tins[2], rate - rate / 4);
+		ref_set_rate(&m->tins[3], rate / 4);
+		m->tins[0].quantum_prio = 16;
+		m->tins[1].quantum_prio = 256;
+		m->tins[2].quantum_prio = 1024;
+		m->tins[3].quantum_prio = 4096;
+		m->tins[0].quantum_band = 16;
+		m->tins[1].quantum_band = 48;
+		m->tins[2].quantum_band = 128;
+		m->tins[3].quantum_band = 64;
+		break;
+
+	default: /* besteffort */
+		m->tin_cnt = 1;
+		ref_set_rate(&m->tins[0], rate);
+		m->tins[0].quantum_prio = 65535;
+		m->tins[0].quantum_band = 65535;
+		break;
+	}
+
+	/* the global shaper runs at the full rate */
+	m->rate_ns   = m->tins[0].rate_ns;
+	m->rate_shft = m->tins[0].rate_shft;
+}
+
+void cake_ref_init(struct cake_ref *m, const struct cake_ref_cfg *cfg,
+		   cake_ref_drop_fn fn, void *arg)
+{
+	memset(m, 0, sizeof(*m));
+	m->cfg      = *cfg;
+	m->drop_fn  = fn;
+	m->drop_arg = arg;
+	ref_config(m);
+}
+
+void cake_ref_destroy(struct cake_ref *m)
+{
+	int t, i;
+
+	for (t = 0; t < CAKE_REF_TINS; t++) {
+		for (i = 0; i < CAKE_REF_QUEUES; i++) {
+			struct cake_ref_queue *q = &m->tins[t].q[i];
+
+			while (q->head) {
+				struct cake_ref_pkt *p = q->head;
+
+				q->head = p->next;
+				free(p);
+			}
+		}
+	}
+}
+
+/* ---- the new and old flow lists ---- */
+
+static void list_append(struct cake_ref_tin *b, uint16_t qi, int list)
+{
+	if (list == REF_LIST_NEW)
+		b->new_flows[b->n_new++] = qi;
+	else
+		b->old_flows[b->n_old++] = qi;
+	b->q[qi].list = list;
+}
+
+static void list_remove(struct cake_ref_tin *b, uint16_t qi)
+{
+	uint16_t *arr = b->q[qi].list == REF_LIST_NEW ? b->new_flows :
+							 b->old_flows;
+	unsigned int *n = b->q[qi].list == REF_LIST_NEW ? &b->n_new :
+							   &b->n_old;
+	unsigned int i;
+
+	for (i = 0; i < *n; i++) {
+		if (arr[i] == qi) {
+			memmove(&arr[i], &arr[i + 1],
+				(*n - i - 1) * sizeof(arr[0]));
+			(*n)--;
+			break;
+		}
+	}
+	b->q[qi].list = REF_LIST_NONE;
+}
+
+/* ---- packets in and out of a queue ---- */
+
+static struct cake_ref_pkt *pop(struct cake_ref *m, int tin, uint16_t qi)
+{
+	struct cake_ref_tin *b = &m->tins[tin];
+	struct cake_ref_queue *q = &b->q[qi];
+	struct cake_ref_pkt *p = q->head;
+
+	if (!p)
+		return NULL;
+
+	q->head = p->next;
+	if (!q->head)
+		q->tail = NULL;
+	p->next = NULL;
+
+	q->backlog     -= p->len;
+	b->backlog     -= p->len;
+	m->backlog     -= p->len;
+	m->buffer_used -= p->truesize;
+	m->qlen--;
+	return p;
+}
+
+static void drop(struct cake_ref *m, struct cake_ref_pkt *p)
+{
+	if (m->drop_fn)
+		m->drop_fn(m->drop_arg, p);
+	free(p);
+}
+
+/* ---- CoDel ---- */
+
+static uint64_t target_ns(const struct cake_ref *m)
+{
+	return m->cfg.target_us * NSEC_PER_USEC;
+}
+
+static uint64_t interval_ns(const struct cake_ref *m)
+{
+	return m->cfg.interval_us * NSEC_PER_USEC;
+}
+
+/* rec_inv_sqrt ~= 1/sqrt(count) in Q0.16, refined by one Newton step */
+static void newton_step(struct cake_ref_queue *q)
+{
+	uint32_t invsqrt  = (uint32_t)q->rec_inv_sqrt << 16;
+	uint32_t invsqrt2 = ((uint64_t)invsqrt * invsqrt) >> 32;
+	uint64_t val = (3ULL << 32) - (uint64_t)q->count * invsqrt2;
+
+	val >>= 2;
+	val = (val * invsqrt) >> (32 - 2 + 1);
+	q->rec_inv_sqrt = val >> 16;
+}
+
+/* t + interval / sqrt(count) */
+static uint64_t control_law(const struct cake_ref *m,
+			    const struct cake_ref_queue *q, uint64_t t)
+{
+	uint32_t interval = interval_ns(m);
+
+	return t + (uint32_t)(((uint64_t)interval *
+			       ((uint32_t)q->rec_inv_sqrt << 16)) >> 32);
+}
+
+/* Has this queue's delay been above target for a whole interval? */
+static int above_target(struct cake_ref *m, struct cake_ref_queue *q,
+			const struct cake_ref_pkt *p, uint64_t now)
+{
+	if (!p || now - p->enqueue_ns < target_ns(m) || !m->backlog) {
+		q->first_above_time = 0;
+		return 0;
+	}
+	if (!q->first_above_time) {
+		q->first_above_time = now + interval_ns(m);
+		return 0;
+	}
+	return now > q->first_above_time;
+}
+
+/* Mark CE if the packet is ECN capable; true if it now carries CE. */
+static int mark(struct cake_ref_pkt *p)
+{
+	if (p->ecn == ECN_NOT_ECT)
+		return 0;
+	if (p->ecn != ECN_CE)
+		p->ce = 1;
+	return 1;
+}
+
+/* The next packet from a queue, after CoDel has had its say.  Under
+ * memory pressure ("overloaded") CoDel drops even ECN-capable packets.
+ */
+static struct cake_ref_pkt *codel(struct cake_ref *m, int tin, uint16_t qi,
+				  uint64_t now, int overloaded)
+{
+	struct cake_ref_queue *q = &m->tins[tin].q[qi];
+	struct cake_ref_pkt *p = pop(m, tin, qi);
+	int above;
+
+	if (!p) {
+		q->dropping = 0;
+		return NULL;
+	}
+	above = above_target(m, q, p, now);
+
+	if (q->dropping) {
+		if (!above) {
+			q->dropping = 0;
+			return p;
+		}
+		if (now < q->drop_next)
+			return p;
+
+		if (q->count != UINT32_MAX)
+			q->count++;
+		newton_step(q);
+		q->drop_next = control_law(m, q, q->drop_next);
+
+		/* drop (or mark) as many as are due by now */
+		do {
+			if (mark(p) && !overloaded) {
+				q->drop_next = control_law(m, q, q->drop_next);
+				return p;
+			}
+			drop(m, p);
+			p = pop(m, tin, qi);
+			if (p && !above_target(m, q, p, now))
+				q->dropping = 0;
+			else
+				q->drop_next = control_law(m, q, q->drop_next);
+		} while (p && q->dropping && now >= q->drop_next);
+
+		if (p)
+			mark(p);
+		return p;
+	}
+
+	if (!above)
+		return p;
+
+	/* entering dropping state */
+	if (!mark(p) || overloaded) {
+		drop(m, p);
+		p = pop(m, tin, qi);
+		above_target(m, q, p, now);
+		if (p)
+			mark(p);
+	}
+	q->dropping = 1;
+
+	/* resume near the previous drop rate if that was recent */
+	if (q->count > 2 && now - q->drop_next < 8 * interval_ns(m)) {
+		q->count -= 2;
+		newton_step(q);
+	} else {
+		q->count = 1;
+		q->rec_inv_sqrt = 0xffff;
+	}
+	newton_step(q);
+	q->drop_next = control_law(m, q, now);
+	return p;
+}
+
+/* ---- enqueue ---- */
+
+/* Memory limit hit: drop from the head of the longest queue anywhere,
+ * the first one found scanning tins in order, old flows before new.
+ */
+static void evict(struct cake_ref *m)
+{
+	int best_tin = -1, t;
+	uint32_t best = 0, i;
+	uint16_t best_q = 0;
+
+	for (t = 0; t < m->tin_cnt; t++) {
+		struct cake_ref_tin *b = &m->tins[t];
+
+		for (i = 0; i < b->n_old; i++)
+			if (b->q[b->old_flows[i]].backlog > best) {
+				best     = b->q[b->old_flows[i]].backlog;
+				best_tin = t;
+				best_q   = b->old_flows[i];
+			}
+		for (i = 0; i < b->n_new; i++)
+			if (b->q[b->new_flows[i]].backlog > best) {
+				best     = b->q[b->new_flows[i]].backlog;
+				best_tin = t;
+				best_q   = b->new_flows[i];
+			}
+	}
+
+	if (best_tin >= 0)
+		drop(m, pop(m, best_tin, best_q));
+}
+
+void cake_ref_enqueue(struct cake_ref *m, uint64_t now,
+		      const struct cake_ref_pkt *pkt)
+{
+	struct cake_ref_tin *b = &m->tins[pkt->tin];
+	struct cake_ref_queue *q = &b->q[pkt->queue];
+	struct cake_ref_pkt *p = malloc(sizeof(*p));
+
+	if (!p)
+		abort();
+
+	/* an idle shaper doesn't bank credit */
+	if (!b->backlog) {
+		if (b->time_next < now)
+			b->time_next = now;
+		if (!m->qlen && m->time_next < now)
+			m->time_next = now;
+	}
+
+	*p = *pkt;
+	p->enqueue_ns = now;
+	p->ce         = 0;
+	p->next       = NULL;
+	if (q->tail)
+		q->tail->next = p;
+	else
+		q->head = p;
+	q->tail = p;
+
+	q->backlog     += p->len;
+	b->backlog     += p->len;
+	m->backlog     += p->len;
+	m->buffer_used += p->truesize;
+	m->qlen++;
+
+	if (q->list == REF_LIST_NONE) {
+		list_append(b, pkt->queue, REF_LIST_NEW);
+		q->deficit = b->quantum;
+	}
+
+	while (m->buffer_used > m->cfg.buffer_limit && m->qlen)
+		evict(m);
+}
+
+/* ---- dequeue ---- */
+
+static uint32_t wire_len(const struct cake_ref *m, uint32_t len)
+{
+	uint32_t out = len + (int16_t)m->cfg.overhead;
+
+	if (m->cfg.atm)
+		out = (out + 47) / 48 * 53;
+	return out;
+}
+
+struct cake_ref_pkt *cake_ref_dequeue(struct cake_ref *m, uint64_t now)
+{
+	for (;;) {
+		struct cake_ref_tin *b;
+		struct cake_ref_queue *q;
+		struct cake_ref_pkt *p;
+		uint32_t limit = m->cfg.buffer_limit, len;
+		uint16_t qi;
+		int list, t;
+
+		if (!m->qlen || m->time_next > now)
+			return NULL;
+
+		/* weighted round robin over tins with something queued;
+		 * a tin over its own rate earns credit at the lower weight
+		 */
+		b = &m->tins[m->cur_tin];
+		while (!b->backlog || b->deficit <= 0) {
+			if (b->deficit <= 0)
+				b->deficit += b->time_next > now ?
+					      b->quantum_band :
+					      b->quantum_prio;
+			m->cur_tin = (m->cur_tin + 1) % m->tin_cnt;
+			b = &m->tins[m->cur_tin];
+		}
+
+		/* DRR within the tin, new flows first */
+		for (;;) {
+			if (b->n_new) {
+				list = REF_LIST_NEW;
+				qi = b->new_flows[0];
+			} else {
+				list = REF_LIST_OLD;
+				qi = b->old_flows[0];
+			}
+			q = &b->q[qi];
+			if (q->deficit > 0)
+				break;
+			q->deficit += b->quantum;
+			list_remove(b, qi);
+			list_append(b, qi, REF_LIST_OLD);
+		}
+
+		p = codel(m, m->cur_tin, qi, now,
+			  m->buffer_used > limit / 4 + limit / 2);
+		if (!p) {
+			/* an emptied new flow gets one more turn as old */
+			list_remove(b, qi);
+			if (list == REF_LIST_NEW && b->n_old)
+				list_append(b, qi, REF_LIST_OLD);
+			continue;
+		}
+
+		len = wire_len(m, p->len);
+		q->deficit -= len;
+		b->deficit -= len;
+
+		/* the bandwidth is charged to this tin and all below it */
+		for (t = m->cur_tin; t >= 0; t--)
+			m->tins[t].time_next += (len *
+				(uint64_t)m->tins[t].rate_ns) >>
+				m->tins[t].rate_shft;
+		m->time_next += (len * (uint64_t)m->rate_ns) >> m->rate_shft;
+		return p;
+	}
+}
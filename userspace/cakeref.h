@@ -0,0 +1,111 @@
+/*
+ * cakeref - a plain reference model of cake's scheduling decisions
+ *
+ * Written for clarity, not speed: flow lists are arrays searched linearly
+ * and every step follows the description in sch_cake.c and codel5.h
+ * rather than its code.  cakediff runs it alongside libcake to catch
+ * optimisations that change which packet goes out, or which is dropped
+ * or marked, and when.
+ *
+ * Classification is not modelled; the caller passes the tin and queue
+ * cake chose.  Only the fixed-point arithmetic (rate quantisation, the
+ * CoDel control law) is reproduced exactly, since any rounding difference
+ * there would legitimately move a packet by a nanosecond.
+ */
+
+#ifndef __CAKEREF_H
+#define __CAKEREF_H
+
+#include <stdint.h>
+
+#define CAKE_REF_TINS	8
+#define CAKE_REF_QUEUES	1024
+
+struct cake_ref_cfg {
+	uint32_t	rate;		/* bytes/s, 0 = unlimited */
+	int		tin_mode;	/* 1..4, as TCA_CAKE_DIFFSERV_MODE */
+	int32_t		overhead;
+	int		atm;
+	uint32_t	target_us;
+	uint32_t	interval_us;
+	uint32_t	buffer_limit;	/* bytes of truesize */
+};
+
+struct cake_ref_pkt {
+	uint64_t		cookie;
+	uint64_t		enqueue_ns;
+	uint32_t		len;
+	uint32_t		truesize;
+	uint8_t			ecn;	/* INET_ECN_* bits as enqueued */
+	uint8_t			ce;	/* marked by the model */
+	uint16_t		tin;
+	uint16_t		queue;
+	struct cake_ref_pkt	*next;
+};
+
+enum { REF_LIST_NONE, REF_LIST_NEW, REF_LIST_OLD };
+
+struct cake_ref_queue {
+	struct cake_ref_pkt	*head, *tail;
+	uint32_t		backlog;
+	int32_t			deficit;
+	int			list;
+
+	/* CoDel */
+	int			dropping;
+	uint32_t		count;
+	uint16_t		rec_inv_sqrt;
+	uint64_t		first_above_time;
+	uint64_t		drop_next;
+};
+
+struct cake_ref_tin {
+	struct cake_ref_queue	q[CAKE_REF_QUEUES];
+	uint16_t		new_flows[CAKE_REF_QUEUES];
+	uint16_t		old_flows[CAKE_REF_QUEUES];
+	unsigned int		n_new, n_old;
+
+	uint32_t		backlog;
+	uint16_t		quantum;	/* per-queue DRR quantum */
+	uint16_t		quantum_prio;
+	uint16_t		quantum_band;
+	int32_t			deficit;
+
+	uint32_t		rate_ns;
+	uint16_t		rate_shft;
+	uint64_t		time_next;
+};
+
+typedef void (*cake_ref_drop_fn)(void *arg, const struct cake_ref_pkt *pkt);
+
+struct cake_ref {
+	struct cake_ref_cfg	cfg;
+	struct cake_ref_tin	tins[CAKE_REF_TINS];
+	int			tin_cnt;
+	int			cur_tin;
+
+	uint32_t		rate_ns;
+	uint16_t		rate_shft;
+	uint64_t		time_next;
+
+	uint32_t		qlen;
+	uint32_t		backlog;
+	uint32_t		buffer_used;
+
+	cake_ref_drop_fn	drop_fn;
+	void			*drop_arg;
+};
+
+void cake_ref_init(struct cake_ref *m, const struct cake_ref_cfg *cfg,
+		   cake_ref_drop_fn fn, void *arg);
+void cake_ref_destroy(struct cake_ref *m);
+
+void cake_ref_enqueue(struct cake_ref *m, uint64_t now,
+		      const struct cake_ref_pkt *pkt);
+
+/* Returns the packet cake should release at 'now', or NULL; the caller
+ * frees it.  Drops are reported through the callback as they happen.
+ */
+struct cake_ref_pkt *cake_ref_dequeue(struct cake_ref *m, uint64_t now);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * cakereplay - replay a packet capture through libcake
+ *
+ * Every IP packet in a pcap or pcapng file is offered to cake at its
+ * recorded time (relative to the first packet), and cake is polled
+ * whenever its shaper would release something.  One line is printed per
+ * packet as its fate becomes known:
+ *
+ *	pkt,time_us,len,tin,flow,sojourn_us,verdict
+ *
+ * where verdict is "sent", "marked" (sent with CE) or "dropped", and
+ * time_us is when that happened.  Runs are deterministic, so the output
+ * of two builds of sch_cake.c over the same capture can be diffed:
+ *
+ *	cakereplay -r 20 -d diffserv4 uplink.pcapng > a.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include "libcake.h"
+#include "util.h"
+#include "pcapread.h"
+#include "../pkt_sched.h"
+
+#define NSEC_PER_USEC	1000ULL
+#define MAX_OPTS	32
+
+
+static struct {
+	double			rate_mbit;
+	int			diffserv;
+	int			flow_mode;
+	unsigned int		mtu;
+	double			speed;
+	int			json;
+	struct cake_sim_opt	extra[MAX_OPTS];
+	int			nextra;
+} cfg = {
+	.rate_mbit = 0, .diffserv = 4, .flow_mode = 4, .mtu = 1500,
+	.speed = 1,
+};
+
+static struct {
+	uint64_t	sent, marked, dropped, rejected;
+} totals;
+
+static void report(const struct cake_pkt *pkt, uint64_t now)
+{
+	const char *verdict = pkt->dropped ? "dropped" :
+			      pkt->ce ? "marked" : "sent";
+	uint64_t sojourn = now > pkt->enqueue_ns ? now - pkt->enqueue_ns : 0;
+
+	if (pkt->dropped)
+		totals.dropped++;
+	else if (pkt->ce)
+		totals.marked++;
+	else
+		totals.sent++;
+
+	if (cfg.json)
+		printf("{\"pkt\":%llu,\"time_us\":%llu,\"len\":%u,"
+		       "\"tin\":%u,\"flow\":%u,\"sojourn_us\":%llu,"
+		       "\"verdict\":\"%s\"}\n",
+		       (unsigned long long)pkt->cookie,
+		       (unsigned long long)(now / NSEC_PER_USEC), pkt->len,
+		       pkt->tin, pkt->flow,
+		       (unsigned long long)(sojourn / NSEC_PER_USEC), verdict);
+	else
+		printf("%llu,%llu,%u,%u,%u,%llu,%s\n",
+		       (unsigned long long)pkt->cookie,
+		       (unsigned long long)(now / NSEC_PER_USEC), pkt->len,
+		       pkt->tin, pkt->flow,
+		       (unsigned long long)(sojourn / NSEC_PER_USEC), verdict);
+}
+
+static void on_drop(void *arg, const struct cake_pkt *pkt)
+{
+	report(pkt, cake_sim_time());
+}
+
+/* Let cake release everything it wants to before time 'until'. */
+static void pump(struct cake_sim *cake, uint64_t until)
+{
+	struct cake_pkt pkt;
+
+	for (;;) {
+		uint64_t wake;
+
+		while (cake_sim_dequeue(cake, &pkt))
+			report(&pkt, cake_sim_time());
+
+		wake = cake_sim_wakeup(cake);
+		if (!cake_sim_qlen(cake) || !wake || wake >= until)
+			break;
+		cake_sim_set_time(wake > cake_sim_time() ?
+				  wake : cake_sim_time() + 1);
+	}
+	if (until != UINT64_MAX && until > cake_sim_time())
+		cake_sim_set_time(until);
+}
+
+static int replay(const char *path)
+{
+	static uint8_t buf[65536];
+	struct cake_sim_opt opt[MAX_OPTS + 4];
+	struct pcap_reader *r = pcap_open(path);
+	struct cake_sim *cake;
+	struct pcap_pkt pkt;
+	uint64_t first = 0, seq = 0;
+	unsigned int n = 0;
+	int i, ret;
+
+	if (!r)
+		return -1;
+
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE,
+					  cfg.rate_mbit * 1e6 / 8 };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE,
+					  cfg.diffserv };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_FLOW_MODE,
+					  cfg.flow_mode };
+	for (i = 0; i < cfg.nextra; i++)
+		opt[n++] = cfg.extra[i];
+
+	cake_sim_seed(1);
+	cake_sim_set_time(0);
+	cake = cake_sim_create(opt, n, cfg.mtu);
+	if (!cake) {
+		fprintf(stderr, "cake_sim_create failed\n");
+		pcap_close(r);
+		return -1;
+	}
+	cake_sim_on_drop(cake, on_drop, NULL);
+
+	if (!cfg.json)
+		printf("pkt,time_us,len,tin,flow,sojourn_us,verdict\n");
+
+	while ((ret = pcap_next_ip(r, &pkt)) > 0) {
+		uint64_t now;
+		uint32_t len = pkt.len < sizeof(buf) ? pkt.len : sizeof(buf);
+
+		if (!seq)
+			first = pkt.ts_ns;
+		now = pkt.ts_ns > first ?
+		      (uint64_t)((pkt.ts_ns - first) / cfg.speed) : 0;
+
+		/* captures aren't always in order; never go backwards */
+		pump(cake, now > cake_sim_time() ? now : cake_sim_time());
+
+		/* a snapped capture still has to occupy its full length */
+		memcpy(buf, pkt.data, pkt.caplen < len ? pkt.caplen : len);
+		if (pkt.caplen < len)
+			memset(buf + pkt.caplen, 0, len - pkt.caplen);
+
+		if (cake_sim_enqueue(cake, buf, len,
+				     len > cfg.mtu ? cfg.mtu - 52 : 0, seq) < 0)
+			totals.rejected++;
+		seq++;
+	}
+	pump(cake, UINT64_MAX);
+
+	fprintf(stderr, "%llu packets: %llu sent, %llu marked, %llu dropped, "
+		"%llu rejected, %llu non-IP frames skipped\n",
+		(unsigned long long)seq, (unsigned long long)totals.sent,
+		(unsigned long long)totals.marked,
+		(unsigned long long)totals.dropped,
+		(unsigned long long)totals.rejected,
+		(unsigned long long)pcap_skipped(r));
+
+	cake_sim_destroy(cake);
+	pcap_close(r);
+	return ret < 0 ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] capture.pcap|capture.pcapng|-\n"
+		"  -r mbit   cake shaped rate (0 = unlimited)\n"
+		"  -d mode   diffserv mode (diffserv4)\n"
+		"  -f mode   flow mode (flows)\n"
+		"  -M mtu    device MTU, larger packets are treated as GSO (1500)\n"
+		"  -x factor replay speed, 2 = twice as fast (1)\n"
+		"  -O a=v    extra TCA_CAKE_* attribute, by number\n"
+		"  -j        JSON lines\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "r:d:f:M:x:O:jh")) != -1) {
+		switch (c) {
+		case 'r':
+			cfg.rate_mbit = atof(optarg);
+			break;
+		case 'd':
+			cfg.diffserv = lookup(optarg, diffserv_names,
+					      CAKE_DIFFSERV_NAMES);
+			break;
+		case 'f':
+			cfg.flow_mode = lookup(optarg, flow_names,
+					       CAKE_FLOW_NAMES);
+			break;
+		case 'M':
+			cfg.mtu = atoi(optarg);
+			break;
+		case 'x':
+			cfg.speed = atof(optarg);
+			break;
+		case 'O':
+			if (cfg.nextra == MAX_OPTS || !strchr(optarg, '='))
+				usage(argv[0]);
+			cfg.extra[cfg.nextra].type = atoi(optarg);
+			cfg.extra[cfg.nextra].value =
+				strtoul(strchr(optarg, '=') + 1, NULL, 0);
+			cfg.nextra++;
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || cfg.rate_mbit < 0 || cfg.speed <= 0 ||
+	    cfg.mtu < 576 || cfg.diffserv < 1 ||
+	    cfg.diffserv >= CAKE_DIFFSERV_NAMES || cfg.flow_mode < 0 ||
+	    cfg.flow_mode >= CAKE_FLOW_NAMES)
+		usage(argv[0]);
+
+	return replay(argv[optind]) ? 1 : 0;
+}
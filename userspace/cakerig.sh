@@ -0,0 +1,317 @@
+#!/bin/sh
+#
+# cakerig.sh - qualify a sch_cake.ko build on veth pairs between network
+# namespaces, without touching a real link.
+#
+#	ns cakerig-tx: veth0 (cake on egress) ----> veth1 :ns cakerig-rx
+#
+# For every diffserv mode it measures:
+#   pps    the most packets/s cake forwards unshaped, with UDP senders
+#          on 1..N cores (reported per core);
+#   load   ping RTT percentiles while TCP bulk senders fill a shaped link,
+#          plus goodput, from iperf3 if it is installed.
+#
+# Cake is configured with cakectl, which uses this tree's pkt_sched.h, so
+# the distribution's tc doesn't need to know about new attributes.
+#
+#	make && make userspace && sudo userspace/cakerig.sh
+#	sudo userspace/cakerig.sh -m diffserv4 -r 50mbit -t 20 -c 4
+#
+# Results go to stdout as one whitespace-separated line per measurement.
+# The pps senders have to go through the qdisc.  pktgen only does that from
+# Linux 4.6 ("xmit_mode queue_xmit"), later than this module builds for, so
+# they are iperf3 UDP clients, one per core; pktgen is used instead where
+# the kernel has queue_xmit.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MODULE=$HERE/../sch_cake.ko
+CAKECTL=$HERE/cakectl
+
+MODES="besteffort precedence diffserv8 diffserv4"
+FLOWS=flows
+RATE=100mbit
+SECS=10
+CPUS=$(getconf _NPROCESSORS_ONLN)
+PKT_SIZE=64
+TCP_STREAMS=4
+NO_LOAD=
+NO_PPS=
+PPS_SENDER=
+
+TX=cakerig-tx
+RX=cakerig-rx
+TX_IP=10.254.77.1
+RX_IP=10.254.77.2
+
+usage() {
+	cat >&2 <<EOF
+usage: $0 [options]
+  -k path   sch_cake.ko to load ($MODULE)
+  -m modes  diffserv modes to test ("$MODES")
+  -f mode   flow mode ($FLOWS)
+  -r rate   shaped rate for the load test ($RATE)
+  -t secs   duration of each measurement ($SECS)
+  -c cpus   most pps senders to try, one per core ($CPUS)
+  -s bytes  pps packet size, with the Ethernet header ($PKT_SIZE)
+  -P n      TCP streams per class in the load test ($TCP_STREAMS)
+  -L        skip the load test, -G skip the pps test
+EOF
+	exit 2
+}
+
+while getopts "k:m:f:r:t:c:s:P:LGh" opt; do
+	case $opt in
+	k) MODULE=$OPTARG ;;
+	m) MODES=$OPTARG ;;
+	f) FLOWS=$OPTARG ;;
+	r) RATE=$OPTARG ;;
+	t) SECS=$OPTARG ;;
+	c) CPUS=$OPTARG ;;
+	s) PKT_SIZE=$OPTARG ;;
+	P) TCP_STREAMS=$OPTARG ;;
+	L) NO_LOAD=1 ;;
+	G) NO_PPS=1 ;;
+	*) usage ;;
+	esac
+done
+
+die() {
+	echo "cakerig: $*" >&2
+	exit 1
+}
+
+[ "$(id -u)" = 0 ] || die "must be run as root"
+[ -x "$CAKECTL" ] || die "$CAKECTL missing, run 'make userspace' first"
+[ -f "$MODULE" ] || die "$MODULE missing, run 'make' first"
+command -v ip >/dev/null || die "needs iproute2"
+
+tx() { ip netns exec $TX "$@"; }
+rx() { ip netns exec $RX "$@"; }
+
+cleanup() {
+	set +e
+	[ -n "$IPERF_PID" ] && kill $IPERF_PID 2>/dev/null
+	ip netns pids $RX 2>/dev/null | xargs -r kill 2>/dev/null
+	ip netns del $TX 2>/dev/null
+	ip netns del $RX 2>/dev/null
+	[ -n "$PKTGEN_LOADED" ] && rmmod pktgen 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+# ---- module and topology ----
+
+if lsmod | grep -q '^sch_cake '; then
+	rmmod sch_cake || die "sch_cake is in use, remove its qdiscs first"
+fi
+insmod "$MODULE"
+
+ip netns del $TX 2>/dev/null || true
+ip netns del $RX 2>/dev/null || true
+ip netns add $TX
+ip netns add $RX
+ip link add veth0 netns $TX type veth peer name veth1 netns $RX
+tx ip addr add $TX_IP/24 dev veth0
+rx ip addr add $RX_IP/24 dev veth1
+tx ip link set lo up
+rx ip link set lo up
+tx ip link set veth0 up
+rx ip link set veth1 up
+# veth is a software device; give it a queue for cake to stand in for
+tx ip link set veth0 txqueuelen 1000
+RX_MAC=$(rx cat /sys/class/net/veth1/address)
+tx ping -c 1 -W 2 $RX_IP >/dev/null || die "veth pair not passing traffic"
+
+cake() { tx "$CAKECTL" "$@"; }
+
+rx_packets() {
+	rx cat /sys/class/net/veth1/statistics/rx_packets
+}
+
+# ---- pps: unshaped, senders on 1..CPUS cores ----
+
+pg() {
+	# pg file command
+	tx sh -c "echo '$2' > /proc/net/pktgen/$1"
+	if tx grep -q '^Result: [^O]' /proc/net/pktgen/$1 2>/dev/null; then
+		return 1
+	fi
+}
+
+pktgen_setup() {
+	threads=$1
+	for t in $(seq 0 $((CPUS - 1))); do
+		pg kpktgend_$t "rem_device_all"
+	done
+	for t in $(seq 0 $((threads - 1))); do
+		dev=veth0@$t
+		pg kpktgend_$t "add_device $dev" || return 1
+		pg $dev "count 0"
+		pg $dev "pkt_size $PKT_SIZE"
+		pg $dev "delay 0"
+		pg $dev "dst $RX_IP"
+		pg $dev "dst_mac $RX_MAC"
+		pg $dev "udp_src_min 1024"
+		pg $dev "udp_src_max 33791"
+		pg $dev "flows 1024"
+		pg $dev "flowlen 8"
+		pg $dev "flag UDPSRC_RND"
+		# spread the load over every tin
+		pg $dev "tos $(printf '%02x' $(((t * 8) << 2 & 0xff)))"
+		pg $dev "xmit_mode queue_xmit" || return 1
+	done
+}
+
+# PPS_SENDER: pktgen if it can go through the qdisc here, else iperf3,
+# with a server per core; "none" if neither
+pps_sender() {
+	PPS_SENDER=none
+	if [ -d /proc/net/pktgen ] ||
+	   { modprobe pktgen 2>/dev/null && PKTGEN_LOADED=1; }; then
+		if pktgen_setup 1; then
+			PPS_SENDER=pktgen
+			return
+		fi
+		for t in $(seq 0 $((CPUS - 1))); do
+			pg kpktgend_$t "rem_device_all" || true
+		done
+	fi
+	command -v iperf3 >/dev/null || return 0
+	PPS_SENDER=iperf3
+	for t in $(seq 0 $((CPUS - 1))); do
+		rx iperf3 -s -D -p $((5301 + t)) >/dev/null
+	done
+	sleep 0.5
+}
+
+# One UDP client per core, each with 8 flows in a tin of its own, like the
+# pktgen threads.  -b 0 sends as fast as the socket takes them.
+iperf_pps_start() {
+	threads=$1
+	len=$((PKT_SIZE - 42))
+	[ $len -ge 16 ] || len=16
+	for t in $(seq 0 $((threads - 1))); do
+		tx iperf3 -c $RX_IP -p $((5301 + t)) -u -b 0 -l $len -P 8 \
+		       -A $t -S $(((t * 8) << 2 & 0xff)) -t $((SECS + 2)) \
+		       >/dev/null 2>&1 &
+		IPERF_PID="$IPERF_PID $!"
+	done
+	# past the control connections and the first second's ramp
+	sleep 1
+}
+
+iperf_pps_stop() {
+	kill $IPERF_PID 2>/dev/null || true
+	wait $IPERF_PID 2>/dev/null || true
+	IPERF_PID=
+}
+
+run_pps() {
+	mode=$1
+
+	[ -n "$PPS_SENDER" ] || pps_sender
+	sender=$PPS_SENDER
+	if [ $sender = none ]; then
+		echo "cakerig: no iperf3, and pktgen can't xmit through the" \
+		     "qdisc here, skipping pps" >&2
+		return 0
+	fi
+
+	cake replace dev veth0 unlimited diffserv $mode flows $FLOWS
+
+	for threads in $(seq 1 $CPUS); do
+		if [ $sender = pktgen ]; then
+			if ! pktgen_setup $threads; then
+				echo "cakerig: pktgen can't add a thread on" \
+				     "cpu $((threads - 1)), stopping pps" >&2
+				return 0
+			fi
+			tx sh -c "echo start > /proc/net/pktgen/pgctrl" &
+			pgpid=$!
+		else
+			iperf_pps_start $threads
+		fi
+		before=$(rx_packets)
+		sleep $SECS
+		after=$(rx_packets)
+		if [ $sender = pktgen ]; then
+			tx sh -c "echo stop > /proc/net/pktgen/pgctrl"
+			wait $pgpid 2>/dev/null || true
+		else
+			iperf_pps_stop
+		fi
+
+		pps=$(((after - before) / SECS))
+		echo "pps mode=$mode flows=$FLOWS threads=$threads" \
+		     "sender=$sender size=$PKT_SIZE pps=$pps" \
+		     "pps_per_core=$((pps / threads))"
+	done
+	cake stats dev veth0 json | sed "s/^/stats mode=$mode test=pps /"
+}
+
+# ---- latency under load: shaped, TCP bulk + ping ----
+
+percentiles() {
+	# stdin: one RTT (ms) per line
+	sort -n | awk '{ v[NR] = $1 }
+	END {
+		if (!NR) { print "n=0"; exit }
+		printf "n=%d p50=%s p90=%s p99=%s max=%s\n", NR,
+		       v[int(NR * 0.50) + 1 > NR ? NR : int(NR * 0.50) + 1],
+		       v[int(NR * 0.90) + 1 > NR ? NR : int(NR * 0.90) + 1],
+		       v[int(NR * 0.99) + 1 > NR ? NR : int(NR * 0.99) + 1],
+		       v[NR]
+	}'
+}
+
+run_load() {
+	mode=$1
+
+	cake replace dev veth0 bandwidth $RATE diffserv $mode flows $FLOWS
+
+	IPERF_PID=
+	if command -v iperf3 >/dev/null; then
+		rx iperf3 -s -D -1 -p 5201 >/dev/null
+		rx iperf3 -s -D -1 -p 5202 >/dev/null
+		sleep 0.5
+		# one bulk class at best effort, one marked CS1 (background)
+		tx iperf3 -c $RX_IP -p 5201 -t $SECS -P $TCP_STREAMS \
+		       -f k > /tmp/cakerig.be.$$ 2>&1 &
+		IPERF_PID=$!
+		tx iperf3 -c $RX_IP -p 5202 -t $SECS -P $TCP_STREAMS \
+		       -S 0x20 -f k > /tmp/cakerig.bk.$$ 2>&1 &
+		sleep 1
+	else
+		echo "cakerig: no iperf3, measuring latency without load" >&2
+	fi
+
+	# sparse probes in the best effort and voice classes
+	tx ping -q -c 1 $RX_IP >/dev/null
+	tx ping -n -i 0.1 -w $((SECS - 2)) $RX_IP 2>/dev/null |
+		sed -n 's/.*time=\([0-9.]*\).*/\1/p' > /tmp/cakerig.be_rtt.$$ &
+	tx ping -n -i 0.1 -Q 0xb8 -w $((SECS - 2)) $RX_IP 2>/dev/null |
+		sed -n 's/.*time=\([0-9.]*\).*/\1/p' > /tmp/cakerig.ef_rtt.$$
+	wait
+
+	for class in be ef; do
+		echo "load mode=$mode flows=$FLOWS rate=$RATE class=$class" \
+		     "rtt_ms $(percentiles < /tmp/cakerig.${class}_rtt.$$)"
+	done
+	if [ -n "$IPERF_PID" ]; then
+		for class in be bk; do
+			kbit=$(awk '/SUM.*receiver|receiver$/ { v = $(NF-2) }
+				    END { print v + 0 }' /tmp/cakerig.$class.$$)
+			echo "goodput mode=$mode flows=$FLOWS rate=$RATE" \
+			     "class=$class kbit=$kbit"
+		done
+	fi
+	rm -f /tmp/cakerig.*.$$
+	IPERF_PID=
+	cake stats dev veth0 json | sed "s/^/stats mode=$mode test=load /"
+}
+
+for mode in $MODES; do
+	[ -n "$NO_PPS" ] || run_pps $mode
+	[ -n "$NO_LOAD" ] || run_load $mode
+done
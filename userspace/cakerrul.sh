@@ -0,0 +1,227 @@
+#!/bin/sh
+#
+# cakerrul.sh - RRUL-style latency under load, entirely in namespaces
+#
+#	client ---- c0|r0  router  r1|s0 ---- server
+#	            cake ->        <- cake      netem (base RTT)
+#	        (download)        (upload)
+#
+# The router shapes both directions with cake at each rate under test;
+# the server adds the base RTT with netem on its way back.  For every
+# diffserv mode and rate it runs, at once:
+#   - one TCP upload and one TCP download per class (BE, BK, CS5, EF),
+#   - ICMP ping and one UDP probe stream per class,
+# and reports per-class latency percentiles and TCP goodput.
+#
+#	make && make userspace && sudo userspace/cakerrul.sh
+#	sudo userspace/cakerrul.sh -m "besteffort diffserv4" -r "10mbit" -d 40
+#
+# Needs iproute2 with netem and iperf3; cake itself is configured with
+# cakectl.  Results go to stdout, one line per class and measurement.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MODULE=$HERE/../sch_cake.ko
+CAKECTL=$HERE/cakectl
+UDPPING=$HERE/udpping
+
+MODES="diffserv4"
+RATES="1mbit 10mbit 100mbit 1gbit"
+FLOWS=flows
+RTT_MS=40
+SECS=30
+
+CL=cakerrul-cl
+RT=cakerrul-rt
+SV=cakerrul-sv
+CL_IP=10.254.78.1
+SV_IP=10.254.79.1
+
+# class name and TOS byte, as RRUL uses them
+CLASSES="BE:0x00 BK:0x20 CS5:0xa0 EF:0xb8"
+
+usage() {
+	cat >&2 <<EOF
+usage: $0 [options]
+  -k path   sch_cake.ko to load ($MODULE)
+  -m modes  diffserv modes to test ("$MODES")
+  -r rates  shaped rates, both directions ("$RATES")
+  -f mode   flow mode ($FLOWS)
+  -d ms     base RTT added by netem ($RTT_MS)
+  -t secs   duration of each run ($SECS)
+EOF
+	exit 2
+}
+
+while getopts "k:m:r:f:d:t:h" opt; do
+	case $opt in
+	k) MODULE=$OPTARG ;;
+	m) MODES=$OPTARG ;;
+	r) RATES=$OPTARG ;;
+	f) FLOWS=$OPTARG ;;
+	d) RTT_MS=$OPTARG ;;
+	t) SECS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+die() {
+	echo "cakerrul: $*" >&2
+	exit 1
+}
+
+[ "$(id -u)" = 0 ] || die "must be run as root"
+[ -x "$CAKECTL" ] && [ -x "$UDPPING" ] ||
+	die "cakectl or udpping missing, run 'make userspace' first"
+[ -f "$MODULE" ] || die "$MODULE missing, run 'make' first"
+command -v iperf3 >/dev/null || die "needs iperf3"
+command -v tc >/dev/null || die "needs iproute2"
+
+cl() { ip netns exec $CL "$@"; }
+rt() { ip netns exec $RT "$@"; }
+sv() { ip netns exec $SV "$@"; }
+
+TMP=$(mktemp -d /tmp/cakerrul.XXXXXX)
+
+cleanup() {
+	set +e
+	ip netns pids $SV 2>/dev/null | xargs -r kill 2>/dev/null
+	ip netns pids $CL 2>/dev/null | xargs -r kill 2>/dev/null
+	ip netns del $CL 2>/dev/null
+	ip netns del $RT 2>/dev/null
+	ip netns del $SV 2>/dev/null
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+# ---- module and topology ----
+
+if lsmod | grep -q '^sch_cake '; then
+	rmmod sch_cake || die "sch_cake is in use, remove its qdiscs first"
+fi
+insmod "$MODULE"
+
+for ns in $CL $RT $SV; do
+	ip netns del $ns 2>/dev/null || true
+	ip netns add $ns
+	ip netns exec $ns ip link set lo up
+done
+
+ip link add c0 netns $CL type veth peer name r0 netns $RT
+ip link add r1 netns $RT type veth peer name s0 netns $SV
+cl ip addr add $CL_IP/24 dev c0
+rt ip addr add 10.254.78.254/24 dev r0
+rt ip addr add 10.254.79.254/24 dev r1
+sv ip addr add $SV_IP/24 dev s0
+cl ip link set c0 up
+rt ip link set r0 up
+rt ip link set r1 up
+sv ip link set s0 up
+cl ip route add default via 10.254.78.254
+sv ip route add default via 10.254.79.254
+rt sysctl -qw net.ipv4.ip_forward=1
+
+# the whole base RTT on the server's return path, with room to queue
+sv tc qdisc add dev s0 root netem delay ${RTT_MS}ms limit 100000
+
+cl ping -c 1 -W 2 $SV_IP >/dev/null || die "topology not passing traffic"
+
+sv "$UDPPING" -s -p 7007 &
+
+# ---- one run ----
+
+percentiles() {
+	# stdin: one RTT (ms) per line
+	sort -n | awk '{ v[NR] = $1 }
+	END {
+		if (!NR) { print "n=0"; exit }
+		printf "n=%d p50=%s p90=%s p99=%s max=%s\n", NR,
+		       v[int(NR * 0.50) + 1 > NR ? NR : int(NR * 0.50) + 1],
+		       v[int(NR * 0.90) + 1 > NR ? NR : int(NR * 0.90) + 1],
+		       v[int(NR * 0.99) + 1 > NR ? NR : int(NR * 0.99) + 1],
+		       v[NR]
+	}'
+}
+
+goodput() {
+	awk '/receiver/ { v = $(NF-2) } END { print v + 0 }' "$1"
+}
+
+run() {
+	mode=$1
+	rate=$2
+	tag="mode=$mode rate=$rate rtt=${RTT_MS}ms flows=$FLOWS"
+
+	rt "$CAKECTL" replace dev r0 bandwidth $rate diffserv $mode \
+		flows $FLOWS
+	rt "$CAKECTL" replace dev r1 bandwidth $rate diffserv $mode \
+		flows $FLOWS
+
+	port=5300
+	for c in $CLASSES; do
+		for dir in up down; do
+			port=$((port + 1))
+			sv iperf3 -s -1 -p $port >/dev/null 2>&1 &
+		done
+	done
+	sleep 1
+
+	pids=
+	port=5300
+	for c in $CLASSES; do
+		name=${c%%:*}
+		tos=${c#*:}
+		for dir in up down; do
+			port=$((port + 1))
+			rev=
+			[ $dir = down ] && rev=-R
+			cl iperf3 -c $SV_IP -p $port -t $SECS -S $tos -f k \
+				$rev > "$TMP/tcp.$name.$dir" 2>&1 &
+			pids="$pids $!"
+		done
+	done
+
+	# let the bulk flows fill the queues before probing
+	sleep 2
+	probe_secs=$((SECS - 4))
+	cl ping -n -i 0.2 -w $probe_secs $SV_IP 2>/dev/null |
+		sed -n 's/.*time=\([0-9.]*\).*/\1/p' > "$TMP/icmp.BE" &
+	pids="$pids $!"
+	for c in $CLASSES; do
+		name=${c%%:*}
+		tos=${c#*:}
+		cl "$UDPPING" -p 7007 -Q $tos -i 50 -t $probe_secs $SV_IP \
+			> "$TMP/udp.$name" 2>/dev/null &
+		pids="$pids $!"
+	done
+	# not a bare wait: the UDP echo server never exits
+	wait $pids 2>/dev/null || true
+
+	echo "rrul $tag class=BE probe=icmp" \
+	     "rtt_ms $(percentiles < "$TMP/icmp.BE")"
+	total=0
+	for c in $CLASSES; do
+		name=${c%%:*}
+		echo "rrul $tag class=$name probe=udp" \
+		     "rtt_ms $(percentiles < "$TMP/udp.$name")"
+		for dir in up down; do
+			kbit=$(goodput "$TMP/tcp.$name.$dir")
+			total=$(awk "BEGIN { print $total + $kbit }")
+			echo "rrul $tag class=$name dir=$dir goodput_kbit=$kbit"
+		done
+	done
+	echo "rrul $tag total_goodput_kbit=$total"
+
+	for dev in r0 r1; do
+		rt "$CAKECTL" stats dev $dev json |
+			sed "s/^/stats $tag dev=$dev /"
+	done
+	rm -f "$TMP"/tcp.* "$TMP"/udp.* "$TMP"/icmp.*
+}
+
+for mode in $MODES; do
+	for rate in $RATES; do
+		run $mode $rate
+	done
+done
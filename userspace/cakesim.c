@@ -0,0 +1,822 @@
+/*
+ * cakesim - discrete-event traffic simulator around libcake
+ *
+ * Models a set of sources behind a cake instance and a bottleneck link:
+ *
+ *	sources -> cake -> link (serialises at link rate) -> sink
+ *	   ^                                                  |
+ *	   +------------- acks / loss after base RTT ---------+
+ *
+ * Sources are Reno- or Cubic-like TCP bulk transfers that back off on drops
+ * and CE marks, constant-bitrate VoIP, and bursty web users.  For every
+ * diffserv/flow mode asked for it reports throughput, per-flow latency
+ * percentiles and Jain's fairness index over the bulk flows and hosts.
+ *
+ *	cakesim -r 20 -t 10 -F reno:4:1 -F cubic:4:2 -F voip:2:3:46 -F web:4:1
+ *	cakesim -r 20 -m all -F reno:8:1 -F reno:1:2 -j
+ *
+ * With -T the link drains according to a Mahimahi packet-delivery trace
+ * (see traces/) instead of at a constant rate, so the shaped rate can be
+ * compared with a capacity that moves underneath it:
+ *
+ *	cakesim -r 10 -T traces/lte-driving.trace -t 30 -F cubic:4:1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include "libcake.h"
+#include "util.h"
+#include "../pkt_sched.h"
+
+#define NSEC_PER_MSEC	1000000ULL
+#define NSEC_PER_SEC	1000000000ULL
+#define MAX_FLOWS	4096
+#define MAX_OPTS	32
+#define TRACE_MTU	1500	/* bytes per delivery opportunity */
+
+
+enum src_type { SRC_RENO, SRC_CUBIC, SRC_VOIP, SRC_WEB };
+static const char * const src_names[] = { "reno", "cubic", "voip", "web" };
+
+enum ev_type { EV_SEND, EV_ACK, EV_LOSS, EV_WAKE, EV_DELIVER };
+
+struct event {
+	uint64_t	time;
+	uint64_t	seq;
+	enum ev_type	type;
+	uint32_t	flow;
+	uint32_t	len;
+	uint8_t		ce;
+	uint64_t	sent;	/* EV_DELIVER: cake enqueue time */
+};
+
+struct flow {
+	enum src_type	type;
+	uint32_t	host;
+	uint8_t		dscp;
+	uint16_t	port;
+
+	/* TCP */
+	double		cwnd, ssthresh;
+	double		wmax;
+	uint64_t	epoch;
+	uint32_t	inflight;
+	uint64_t	recover_until;
+
+	/* web */
+	uint32_t	burst_left;	/* packets of this page still in flight */
+	uint64_t	burst_start;
+
+	uint64_t	bytes, pkts, drops, marks;
+	struct samples	delay;		/* us, cake + link queue */
+	struct samples	pages;		/* web: page completion, us */
+};
+
+struct sim {
+	struct cake_sim	*cake;
+	struct event	*heap;
+	size_t		heap_n, heap_cap;
+	uint64_t	seq;
+	uint64_t	now;
+	uint64_t	end, warmup;
+	uint64_t	link_ns_per_kb;	/* link serialisation, ns per 1024 B */
+	uint64_t	link_free;
+	uint64_t	opp;		/* trace: next delivery opportunity */
+	uint64_t	opp_time;	/* and the time of the last one used */
+	uint32_t	opp_left;	/* bytes still free in that one */
+	uint64_t	wake_pending;
+	uint64_t	rtt;
+	uint32_t	nflows;
+	struct flow	flows[MAX_FLOWS];
+};
+
+struct flow_spec {
+	enum src_type	type;
+	uint32_t	count, host;
+	uint8_t		dscp;
+};
+
+static struct {
+	double		rate_mbit;
+	double		link_mbit;
+	double		seconds;
+	double		warmup;
+	double		rtt_ms;
+	int		ecn;
+	int		json;
+	uint32_t	seed;
+	int		diffserv;	/* 0 = all */
+	int		flow_mode;	/* -1 = all */
+	struct flow_spec specs[64];
+	int		nspecs;
+	struct cake_sim_opt extra[MAX_OPTS];
+	int		nextra;
+	const char	*trace_path;
+	uint32_t	*trace;		/* ms of each delivery opportunity */
+	size_t		trace_n;
+} cfg = {
+	.rate_mbit = 20, .seconds = 10, .warmup = 2, .rtt_ms = 40,
+	.ecn = 1, .seed = 1, .diffserv = 4, .flow_mode = 4,
+};
+
+/* ---- event heap ---- */
+
+static int ev_before(const struct event *a, const struct event *b)
+{
+	return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void ev_push(struct sim *s, struct event ev)
+{
+	size_t i;
+
+	if (s->heap_n == s->heap_cap) {
+		s->heap_cap = s->heap_cap ? s->heap_cap * 2 : 4096;
+		s->heap = realloc(s->heap, s->heap_cap * sizeof(*s->heap));
+		if (!s->heap) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	ev.seq = s->seq++;
+	i = s->heap_n++;
+	while (i && ev_before(&ev, &s->heap[(i - 1) / 2])) {
+		s->heap[i] = s->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	s->heap[i] = ev;
+}
+
+static struct event ev_pop(struct sim *s)
+{
+	struct event top = s->heap[0], last = s->heap[--s->heap_n];
+	size_t i = 0, c;
+
+	while ((c = 2 * i + 1) < s->heap_n) {
+		if (c + 1 < s->heap_n && ev_before(&s->heap[c + 1], &s->heap[c]))
+			c++;
+		if (!ev_before(&s->heap[c], &last))
+			break;
+		s->heap[i] = s->heap[c];
+		i = c;
+	}
+	s->heap[i] = last;
+	return top;
+}
+
+static void ev_at(struct sim *s, uint64_t t, enum ev_type type,
+		  uint32_t flow)
+{
+	struct event ev = { .time = t, .type = type, .flow = flow };
+
+	ev_push(s, ev);
+}
+
+/* ---- packets ---- */
+
+static int is_tcp(const struct flow *f)
+{
+	return f->type == SRC_RENO || f->type == SRC_CUBIC;
+}
+
+static void emit(struct sim *s, uint32_t id, uint32_t len);
+
+/* 10.0.host.1 -> 10.1.0.1 */
+static void build_packet(const struct flow *f, uint8_t *p, uint32_t len,
+			 int ecn)
+{
+	struct tuple t = {
+		.proto = is_tcp(f) ? IPPROTO_TCP : IPPROTO_UDP,
+		.sport = f->port,
+		.dport = is_tcp(f) ? 80 : 5004,
+	};
+
+	tuple_v4(t.src, f->host << 8 | 1);
+	tuple_v4(t.dst, 0x010001);
+	build_pkt(p, &t, f->dscp << 2 | (ecn ? 0x02 : 0), len);	/* ECT(0) */
+}
+
+/* ---- link and dequeue ---- */
+
+static void load_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	unsigned long ms, last = 0;
+	size_t cap = 0;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	while (fscanf(f, "%lu", &ms) == 1) {
+		if (ms < last) {
+			fprintf(stderr, "%s: line %zu goes back in time\n",
+				path, cfg.trace_n + 1);
+			exit(1);
+		}
+		if (cfg.trace_n == cap) {
+			cap = cap ? cap * 2 : 4096;
+			cfg.trace = realloc(cfg.trace, cap * sizeof(*cfg.trace));
+			if (!cfg.trace) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		cfg.trace[cfg.trace_n++] = last = ms;
+	}
+	fclose(f);
+	if (!last) {
+		fprintf(stderr, "%s: not a Mahimahi trace\n", path);
+		exit(1);
+	}
+}
+
+/* Opportunity i of the trace repeated forever, the last line as period. */
+static uint64_t trace_time(uint64_t i)
+{
+	uint64_t period = cfg.trace[cfg.trace_n - 1];
+
+	return ((i / cfg.trace_n) * period + cfg.trace[i % cfg.trace_n]) *
+	       NSEC_PER_MSEC;
+}
+
+static double trace_mbit(uint64_t from, uint64_t to)
+{
+	uint64_t i, n = 0;
+
+	for (i = 0; trace_time(i) < to; i++)
+		n += trace_time(i) >= from;
+	return n * TRACE_MTU * 8 / ((to - from) / 1e9) / 1e6;
+}
+
+/* When the link finishes sending len bytes handed to it now. */
+static uint64_t link_tx(struct sim *s, uint32_t len)
+{
+	uint64_t start = s->link_free > s->now ? s->link_free : s->now;
+
+	if (!cfg.trace_n)
+		return start + (len * s->link_ns_per_kb >> 10);
+
+	/* as in Mahimahi, an opportunity not used in time is gone, but a
+	 * packet may finish one the previous packet started and may span
+	 * several
+	 */
+	if (s->opp_time < start)
+		s->opp_left = 0;
+	while (len > s->opp_left) {
+		len -= s->opp_left;
+		do
+			s->opp_time = trace_time(s->opp++);
+		while (s->opp_time < start);
+		s->opp_left = TRACE_MTU;
+	}
+	s->opp_left -= len;
+	return s->opp_time;
+}
+
+static void pump(struct sim *s)
+{
+	struct cake_pkt pkt;
+	uint64_t ring = 2 * (1514 * s->link_ns_per_kb >> 10);
+	uint64_t wake;
+
+	/* keep at most a couple of packets queued at the link, like BQL */
+	while (cake_sim_qlen(s->cake)) {
+		if (s->link_free > s->now + ring) {
+			wake = s->link_free - ring;
+			goto schedule;
+		}
+		if (!cake_sim_dequeue(s->cake, &pkt))
+			break;
+
+		{
+			struct event ev = { .type = EV_DELIVER };
+
+			s->link_free = link_tx(s, pkt.len);
+			ev.time = s->link_free;
+			ev.flow = pkt.cookie >> 32;
+			ev.len  = pkt.len;
+			ev.ce   = pkt.ce;
+			ev.sent = pkt.enqueue_ns;
+			ev_push(s, ev);
+		}
+	}
+
+	wake = cake_sim_wakeup(s->cake);
+	if (!wake || !cake_sim_qlen(s->cake))
+		return;
+
+schedule:
+	if (s->wake_pending > s->now && s->wake_pending <= wake)
+		return;
+	s->wake_pending = wake;
+	ev_at(s, wake, EV_WAKE, 0);
+}
+
+static void emit(struct sim *s, uint32_t id, uint32_t len)
+{
+	struct flow *f = &s->flows[id];
+	uint8_t pkt[1500];
+
+	build_packet(f, pkt, len, is_tcp(f) && cfg.ecn);
+	cake_sim_set_time(s->now);
+	cake_sim_enqueue(s->cake, pkt, len, 0, (uint64_t)id << 32);
+	pump(s);
+}
+
+/* ---- TCP ---- */
+
+static void tcp_send(struct sim *s, uint32_t id)
+{
+	struct flow *f = &s->flows[id];
+
+	while (f->inflight < (uint32_t)f->cwnd) {
+		f->inflight++;
+		emit(s, id, 1500);
+	}
+}
+
+static void tcp_reduce(struct sim *s, struct flow *f)
+{
+	double beta = f->type == SRC_CUBIC ? 0.7 : 0.5;
+
+	/* one reduction per round trip, as with SACK recovery */
+	if (s->now < f->recover_until)
+		return;
+
+	f->wmax = f->cwnd;
+	f->epoch = s->now;
+	f->ssthresh = f->cwnd * beta;
+	if (f->ssthresh < 2)
+		f->ssthresh = 2;
+	f->cwnd = f->ssthresh;
+	f->recover_until = s->now + s->rtt;
+}
+
+static void tcp_grow(struct sim *s, struct flow *f)
+{
+	double t, k, target;
+
+	if (f->cwnd < f->ssthresh) {
+		f->cwnd += 1;
+		return;
+	}
+
+	if (f->type == SRC_RENO) {
+		f->cwnd += 1 / f->cwnd;
+		return;
+	}
+
+	/* W(t) = C(t - K)^3 + Wmax, C = 0.4, with Reno as a floor */
+	t = (s->now - f->epoch) / 1e9;
+	k = cbrt(f->wmax * 0.3 / 0.4);
+	target = 0.4 * pow(t - k, 3) + f->wmax;
+	if (target > f->cwnd)
+		f->cwnd += (target - f->cwnd) / f->cwnd;
+	else
+		f->cwnd += 0.01 / f->cwnd;
+	if (f->cwnd < f->ssthresh + (t * 1e9 / s->rtt) * 0.53)
+		f->cwnd += 1 / f->cwnd;
+}
+
+/* ---- events ---- */
+
+static void on_drop(void *arg, const struct cake_pkt *pkt)
+{
+	struct sim *s = arg;
+	uint32_t id = pkt->cookie >> 32;
+	struct flow *f = &s->flows[id];
+
+	if (s->now >= s->warmup)
+		f->drops++;
+
+	if (is_tcp(f)) {
+		ev_at(s, s->now + s->rtt, EV_LOSS, id);
+	} else if (f->type == SRC_WEB && f->burst_left &&
+		   !--f->burst_left && s->now >= s->warmup) {
+		samples_add(&f->pages, (s->now - f->burst_start) / 1000);
+	}
+}
+
+static void on_deliver(struct sim *s, const struct event *ev)
+{
+	struct flow *f = &s->flows[ev->flow];
+
+	if (s->now >= s->warmup) {
+		f->bytes += ev->len;
+		f->pkts++;
+		f->marks += ev->ce;
+		samples_add(&f->delay, (s->now - ev->sent) / 1000);
+	}
+
+	switch (f->type) {
+	case SRC_RENO:
+	case SRC_CUBIC: {
+		struct event ack = {
+			.time = s->now + s->rtt, .type = EV_ACK,
+			.flow = ev->flow, .ce = ev->ce,
+		};
+
+		ev_push(s, ack);
+		break;
+	}
+	case SRC_WEB:
+		if (f->burst_left && !--f->burst_left &&
+		    s->now >= s->warmup)
+			samples_add(&f->pages,
+				    (s->now - f->burst_start) / 1000);
+		break;
+	case SRC_VOIP:
+		break;
+	}
+}
+
+static void on_send(struct sim *s, uint32_t id)
+{
+	struct flow *f = &s->flows[id];
+	uint32_t i, n;
+
+	switch (f->type) {
+	case SRC_RENO:
+	case SRC_CUBIC:
+		tcp_send(s, id);
+		break;
+
+	case SRC_VOIP:
+		emit(s, id, 200);
+		ev_at(s, s->now + 20 * NSEC_PER_MSEC, EV_SEND, id);
+		break;
+
+	case SRC_WEB:
+		/* a page: a new connection blasting out a heavy-tailed
+		 * number of packets, then a think time
+		 */
+		n = 3 + (uint32_t)(4 / pow((rnd() + 1.0) / 4294967297.0,
+					   1 / 1.2));
+		if (n > 300)
+			n = 300;
+		f->port = 1024 + rnd() % 60000;
+		f->burst_left = n;
+		f->burst_start = s->now;
+		for (i = 0; i < n; i++)
+			emit(s, id, 1500);
+		ev_at(s, s->now + (uint64_t)(rnd_exp(1.0) * NSEC_PER_SEC),
+		      EV_SEND, id);
+		break;
+	}
+}
+
+static void run(struct sim *s)
+{
+	while (s->heap_n) {
+		struct event ev = ev_pop(s);
+		struct flow *f = &s->flows[ev.flow];
+
+		if (ev.time > s->end)
+			break;
+		s->now = ev.time;
+		cake_sim_set_time(s->now);
+
+		switch (ev.type) {
+		case EV_SEND:
+			on_send(s, ev.flow);
+			break;
+		case EV_ACK:
+			f->inflight--;
+			if (ev.ce)
+				tcp_reduce(s, f);
+			else
+				tcp_grow(s, f);
+			tcp_send(s, ev.flow);
+			break;
+		case EV_LOSS:
+			f->inflight--;
+			tcp_reduce(s, f);
+			tcp_send(s, ev.flow);
+			break;
+		case EV_WAKE:
+			pump(s);
+			break;
+		case EV_DELIVER:
+			on_deliver(s, &ev);
+			pump(s);
+			break;
+		}
+	}
+}
+
+/* ---- scenario setup and reporting ---- */
+
+static int setup(struct sim *s, int diffserv, int flow_mode)
+{
+	struct cake_sim_opt opt[MAX_OPTS + 4];
+	uint64_t rate = cfg.rate_mbit * 1e6 / 8;
+	double link = cfg.link_mbit ? cfg.link_mbit : cfg.rate_mbit;
+	unsigned int n = 0;
+	int i, j;
+
+	memset(s, 0, sizeof(*s));
+	rnd_seed(cfg.seed);
+	cake_sim_seed(cfg.seed);
+	cake_sim_set_time(0);
+
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_BASE_RATE, rate };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_DIFFSERV_MODE, diffserv };
+	opt[n++] = (struct cake_sim_opt){ TCA_CAKE_FLOW_MODE, flow_mode };
+	for (i = 0; i < cfg.nextra; i++)
+		opt[n++] = cfg.extra[i];
+
+	s->cake = cake_sim_create(opt, n, 1500);
+	if (!s->cake)
+		return -1;
+	cake_sim_on_drop(s->cake, on_drop, s);
+
+	s->end = cfg.seconds * NSEC_PER_SEC;
+	s->warmup = cfg.warmup * NSEC_PER_SEC;
+	s->rtt = cfg.rtt_ms * NSEC_PER_MSEC;
+	/* a trace link still needs a nominal rate, to size its ring */
+	if (cfg.trace_n)
+		link = trace_mbit(0, trace_time(cfg.trace_n - 1));
+	s->link_ns_per_kb = 1024 * 8 * 1e3 / link;
+
+	for (i = 0; i < cfg.nspecs; i++) {
+		for (j = 0; j < (int)cfg.specs[i].count; j++) {
+			struct flow *f;
+
+			if (s->nflows == MAX_FLOWS)
+				return -1;
+			f = &s->flows[s->nflows];
+			f->type = cfg.specs[i].type;
+			f->host = cfg.specs[i].host;
+			f->dscp = cfg.specs[i].dscp;
+			f->port = 1024 + s->nflows;
+			f->cwnd = 2;
+			f->ssthresh = 1e9;
+			/* stagger starts so the sources don't synchronise */
+			ev_at(s, (rnd() % 100) * NSEC_PER_MSEC, EV_SEND,
+			      s->nflows);
+			s->nflows++;
+		}
+	}
+	return 0;
+}
+
+static double jain(const double *x, int n)
+{
+	double sum = 0, sq = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		sum += x[i];
+		sq += x[i] * x[i];
+	}
+	return sq ? sum * sum / (n * sq) : 1;
+}
+
+static void report(struct sim *s, int diffserv, int flow_mode)
+{
+	double secs = (s->end - s->warmup) / 1e9, total = 0, capacity = 0;
+	double bulk[MAX_FLOWS], hosts[256] = { 0 };
+	int nbulk = 0, nhosts = 0;
+	uint32_t i;
+
+	for (i = 0; i < s->nflows; i++) {
+		struct flow *f = &s->flows[i];
+
+		samples_sort(&f->delay);
+		samples_sort(&f->pages);
+		total += f->bytes;
+		if (is_tcp(f)) {
+			bulk[nbulk++] = f->bytes;
+			hosts[f->host & 0xff] += f->bytes;
+			if ((int)(f->host & 0xff) >= nhosts)
+				nhosts = (f->host & 0xff) + 1;
+		}
+	}
+
+	/* only hosts that actually run bulk flows count towards fairness */
+	{
+		double h[256];
+		int nh = 0, k;
+
+		for (k = 0; k < nhosts; k++)
+			if (hosts[k] > 0)
+				h[nh++] = hosts[k];
+		nhosts = nh;
+		memcpy(hosts, h, nh * sizeof(double));
+	}
+
+	/* what the trace offered over the measured part of the run */
+	if (cfg.trace_n)
+		capacity = trace_mbit(s->warmup, s->end);
+
+	if (cfg.json) {
+		printf("{\"diffserv\":\"%s\",\"flow_mode\":\"%s\","
+		       "\"rate_mbit\":%.3f,\"throughput_mbit\":%.3f,",
+		       diffserv_names[diffserv], flow_names[flow_mode],
+		       cfg.rate_mbit, total * 8 / secs / 1e6);
+		if (cfg.trace_n)
+			printf("\"trace\":\"%s\",\"trace_mbit\":%.3f,",
+			       cfg.trace_path, capacity);
+		printf("\"jain_flows\":%.4f,\"jain_hosts\":%.4f,\"flows\":[",
+		       jain(bulk, nbulk), jain(hosts, nhosts));
+		for (i = 0; i < s->nflows; i++) {
+			struct flow *f = &s->flows[i];
+
+			printf("%s{\"id\":%u,\"type\":\"%s\",\"host\":%u,"
+			       "\"dscp\":%u,\"mbit\":%.3f,\"drops\":%llu,"
+			       "\"marks\":%llu,\"p50_us\":%u,\"p90_us\":%u,"
+			       "\"p99_us\":%u,\"page_p50_us\":%u,"
+			       "\"page_p99_us\":%u}",
+			       i ? "," : "", i, src_names[f->type], f->host,
+			       f->dscp, f->bytes * 8 / secs / 1e6,
+			       (unsigned long long)f->drops,
+			       (unsigned long long)f->marks,
+			       percentile(&f->delay, 0.5),
+			       percentile(&f->delay, 0.9),
+			       percentile(&f->delay, 0.99),
+			       percentile(&f->pages, 0.5),
+			       percentile(&f->pages, 0.99));
+		}
+		printf("]}\n");
+		return;
+	}
+
+	printf("== %s / %s: %.2f of %.2f Mbit, jain flows %.3f hosts %.3f\n",
+	       diffserv_names[diffserv], flow_names[flow_mode],
+	       total * 8 / secs / 1e6, cfg.rate_mbit,
+	       jain(bulk, nbulk), jain(hosts, nhosts));
+	if (cfg.trace_n)
+		printf("   trace %s offered %.2f Mbit, %.1f%% used\n",
+		       cfg.trace_path, capacity,
+		       capacity ? total * 8 / secs / 1e6 / capacity * 100 : 0);
+	printf("%4s %-6s %4s %4s %9s %7s %7s %8s %8s %8s %9s\n",
+	       "id", "type", "host", "dscp", "Mbit", "drops", "marks",
+	       "p50 ms", "p90 ms", "p99 ms", "page p99");
+	for (i = 0; i < s->nflows; i++) {
+		struct flow *f = &s->flows[i];
+
+		printf("%4u %-6s %4u %4u %9.3f %7llu %7llu %8.2f %8.2f %8.2f",
+		       i, src_names[f->type], f->host, f->dscp,
+		       f->bytes * 8 / secs / 1e6,
+		       (unsigned long long)f->drops,
+		       (unsigned long long)f->marks,
+		       percentile(&f->delay, 0.5) / 1e3,
+		       percentile(&f->delay, 0.9) / 1e3,
+		       percentile(&f->delay, 0.99) / 1e3);
+		if (f->pages.n)
+			printf(" %9.2f", percentile(&f->pages, 0.99) / 1e3);
+		printf("\n");
+	}
+}
+
+static void teardown(struct sim *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->nflows; i++) {
+		free(s->flows[i].delay.v);
+		free(s->flows[i].pages.v);
+	}
+	free(s->heap);
+	cake_sim_destroy(s->cake);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] -F type[:count[:host[:dscp]]] ...\n"
+		"  -F spec   sources: reno, cubic, voip or web\n"
+		"  -r mbit   cake shaped rate (20), 0 = unlimited with -T\n"
+		"  -l mbit   bottleneck link rate (= shaped rate)\n"
+		"  -T file   drain the link by a Mahimahi trace instead\n"
+		"  -t secs   simulated time (10), -w secs warmup (2)\n"
+		"  -R ms     base RTT (40)\n"
+		"  -d mode   diffserv mode or 'all' (diffserv4)\n"
+		"  -f mode   flow mode or 'all' (flows)\n"
+		"  -m all    shorthand for -d all -f all\n"
+		"  -O a=v    extra TCA_CAKE_* attribute, by number\n"
+		"  -E        disable ECN, -s seed, -j JSON lines\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static struct sim s;
+	int c, d, f, d0, d1, f0, f1;
+
+	while ((c = getopt(argc, argv, "F:r:l:T:t:w:R:d:f:m:O:Es:jh")) != -1) {
+		switch (c) {
+		case 'F': {
+			struct flow_spec *sp = &cfg.specs[cfg.nspecs];
+			char *tok = strtok(optarg, ":");
+			int type;
+
+			if (cfg.nspecs == 64 || !tok)
+				usage(argv[0]);
+			type = lookup(tok, src_names, 4);
+			if (type < 0 || type > SRC_WEB)
+				usage(argv[0]);
+			sp->type = type;
+			sp->count = 1;
+			sp->host = 1;
+			sp->dscp = 0;
+			if ((tok = strtok(NULL, ":")))
+				sp->count = atoi(tok);
+			if ((tok = strtok(NULL, ":")))
+				sp->host = atoi(tok);
+			if ((tok = strtok(NULL, ":")))
+				sp->dscp = atoi(tok) & 63;
+			cfg.nspecs++;
+			break;
+		}
+		case 'r':
+			cfg.rate_mbit = atof(optarg);
+			break;
+		case 'l':
+			cfg.link_mbit = atof(optarg);
+			break;
+		case 'T':
+			cfg.trace_path = optarg;
+			break;
+		case 't':
+			cfg.seconds = atof(optarg);
+			break;
+		case 'w':
+			cfg.warmup = atof(optarg);
+			break;
+		case 'R':
+			cfg.rtt_ms = atof(optarg);
+			break;
+		case 'd':
+			cfg.diffserv = strcmp(optarg, "all") ?
+				lookup(optarg, diffserv_names,
+				       CAKE_DIFFSERV_NAMES) : 0;
+			break;
+		case 'f':
+			cfg.flow_mode = strcmp(optarg, "all") ?
+				lookup(optarg, flow_names,
+				       CAKE_FLOW_NAMES) : -1;
+			if (cfg.flow_mode < 0 && strcmp(optarg, "all"))
+				usage(argv[0]);
+			break;
+		case 'm':
+			cfg.diffserv = 0;
+			cfg.flow_mode = -1;
+			break;
+		case 'O':
+			if (cfg.nextra == MAX_OPTS || !strchr(optarg, '='))
+				usage(argv[0]);
+			cfg.extra[cfg.nextra].type = atoi(optarg);
+			cfg.extra[cfg.nextra].value =
+				strtoul(strchr(optarg, '=') + 1, NULL, 0);
+			cfg.nextra++;
+			break;
+		case 'E':
+			cfg.ecn = 0;
+			break;
+		case 's':
+			cfg.seed = atoi(optarg);
+			break;
+		case 'j':
+			cfg.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!cfg.nspecs || cfg.rate_mbit < 0 || cfg.warmup >= cfg.seconds ||
+	    (!cfg.rate_mbit && !cfg.trace_path))
+		usage(argv[0]);
+	if (cfg.trace_path)
+		load_trace(cfg.trace_path);
+
+	d0 = cfg.diffserv ? cfg.diffserv : 1;
+	d1 = cfg.diffserv ? cfg.diffserv : CAKE_DIFFSERV_NAMES - 1;
+	f0 = cfg.flow_mode >= 0 ? cfg.flow_mode : 0;
+	f1 = cfg.flow_mode >= 0 ? cfg.flow_mode : CAKE_FLOW_NAMES - 1;
+	if (d0 < 1 || d1 >= CAKE_DIFFSERV_NAMES || f0 < 0 ||
+	    f1 >= CAKE_FLOW_NAMES)
+		usage(argv[0]);
+
+	for (d = d0; d <= d1; d++) {
+		for (f = f0; f <= f1; f++) {
+			if (setup(&s, d, f)) {
+				fprintf(stderr, "scenario setup failed\n");
+				return 1;
+			}
+			run(&s);
+			report(&s, d, f);
+			teardown(&s);
+		}
+	}
+	return 0;
+}
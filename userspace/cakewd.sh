@@ -0,0 +1,198 @@
+#!/bin/sh
+#
+# cakewd.sh - how precisely the qdisc watchdog fires, idle and under load
+#
+#	ns cakewd-tx: veth0 (cake, shaped) ----> veth1 :ns cakewd-rx
+#
+# Needs a module built with "make WDSTATS=1": cake then keeps a log2
+# histogram of how late each dequeue comes after the deadline it armed the
+# watchdog for.  For every shaped rate this floods veth0 with UDP at
+# 1.5x that rate so the shaper is always waiting, first on an idle machine
+# and then with a busy loop on every CPU, and reports per phase:
+#
+#	wd phase=idle rate=100mbit wakes=.. p50_ns=.. p99_ns=.. max_ns=..
+#	   smooth_mbit=.. burst_bytes=..
+#
+# followed by the histogram itself.  Percentiles are bucket upper bounds.
+# smooth_mbit is the rate at which MTU packets are due faster than the p99
+# lateness, beyond which cake can only keep up by releasing them in
+# bursts; burst_bytes is how much the shaped rate accrues in that time,
+# i.e. the burst allowance the next hop has to absorb.
+#
+#	make WDSTATS=1 && make userspace WDSTATS=1 && sudo userspace/cakewd.sh
+#	sudo userspace/cakewd.sh -r "10mbit 1gbit" -t 20
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+MODULE=$HERE/../sch_cake.ko
+CAKECTL=$HERE/cakectl
+
+RATES="10mbit 100mbit 1gbit"
+SECS=10
+CPUS=$(getconf _NPROCESSORS_ONLN)
+PHASES="idle loaded"
+
+TX=cakewd-tx
+RX=cakewd-rx
+TX_IP=10.254.80.1
+RX_IP=10.254.80.2
+
+usage() {
+	cat >&2 <<EOF
+usage: $0 [options]
+  -k path    sch_cake.ko to load, built with WDSTATS=1 ($MODULE)
+  -r rates   shaped rates ("$RATES")
+  -t secs    duration of each run ($SECS)
+  -p phases  "idle", "loaded" or both ("$PHASES")
+  -c cpus    busy loops in the loaded phase ($CPUS)
+EOF
+	exit 2
+}
+
+while getopts "k:r:t:p:c:h" opt; do
+	case $opt in
+	k) MODULE=$OPTARG ;;
+	r) RATES=$OPTARG ;;
+	t) SECS=$OPTARG ;;
+	p) PHASES=$OPTARG ;;
+	c) CPUS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+die() {
+	echo "cakewd: $*" >&2
+	exit 1
+}
+
+[ "$(id -u)" = 0 ] || die "must be run as root"
+[ -x "$CAKECTL" ] || die "$CAKECTL missing, run 'make userspace' first"
+[ -f "$MODULE" ] || die "$MODULE missing, run 'make WDSTATS=1' first"
+command -v iperf3 >/dev/null || die "needs iperf3"
+
+tx() { ip netns exec $TX "$@"; }
+rx() { ip netns exec $RX "$@"; }
+
+HOGS=
+
+cleanup() {
+	set +e
+	[ -n "$HOGS" ] && kill $HOGS 2>/dev/null
+	ip netns pids $RX 2>/dev/null | xargs -r kill 2>/dev/null
+	ip netns del $TX 2>/dev/null
+	ip netns del $RX 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+# ---- module and topology ----
+
+if lsmod | grep -q '^sch_cake '; then
+	rmmod sch_cake || die "sch_cake is in use, remove its qdiscs first"
+fi
+insmod "$MODULE"
+
+ip netns del $TX 2>/dev/null || true
+ip netns del $RX 2>/dev/null || true
+ip netns add $TX
+ip netns add $RX
+ip link add veth0 netns $TX type veth peer name veth1 netns $RX
+tx ip addr add $TX_IP/24 dev veth0
+rx ip addr add $RX_IP/24 dev veth1
+tx ip link set lo up
+rx ip link set lo up
+tx ip link set veth0 up
+rx ip link set veth1 up
+tx ip link set veth0 txqueuelen 1000
+tx ping -c 1 -W 2 $RX_IP >/dev/null || die "veth pair not passing traffic"
+
+tx "$CAKECTL" replace dev veth0 bandwidth 10mbit
+tx "$CAKECTL" stats dev veth0 json | grep -q '"wd_late"' ||
+	die "$MODULE has no watchdog histogram, rebuild with WDSTATS=1"
+
+rx iperf3 -s -D -p 5201 >/dev/null
+sleep 0.5
+
+# ---- one run ----
+
+mbit() {
+	# tc-style rate to Mbit/s
+	echo "$1" | awk '{
+		v = $1 + 0; u = tolower($1); sub(/^[0-9.]+/, "", u)
+		if (u ~ /^gbit/) v *= 1000
+		else if (u ~ /^kbit/) v /= 1000
+		else if (u ~ /^bit/) v /= 1e6
+		print v
+	}'
+}
+
+hogs_start() {
+	for i in $(seq 1 $CPUS); do
+		sh -c 'while :; do :; done' &
+		HOGS="$HOGS $!"
+	done
+}
+
+hogs_stop() {
+	[ -n "$HOGS" ] && kill $HOGS 2>/dev/null
+	wait $HOGS 2>/dev/null || true
+	HOGS=
+}
+
+run() {
+	phase=$1
+	rate=$2
+	offered=$(awk "BEGIN { print $(mbit $rate) * 1.5 }")
+
+	tx "$CAKECTL" replace dev veth0 bandwidth $rate
+	[ $phase = loaded ] && hogs_start
+	tx iperf3 -c $RX_IP -p 5201 -u -b ${offered}M -l 1472 -t $SECS \
+		>/dev/null 2>&1 || true
+	hogs_stop
+
+	tx "$CAKECTL" stats dev veth0 json | awk -v phase=$phase \
+		-v rate=$rate -v mbit=$(mbit $rate) '
+	{
+		match($0, /"wd_wakes":[0-9]+/)
+		wakes = substr($0, RSTART + 11, RLENGTH - 11)
+		match($0, /"wd_late_max_ns":[0-9]+/)
+		max = substr($0, RSTART + 17, RLENGTH - 17)
+		match($0, /"wd_late":\[[0-9,]*\]/)
+		n = split(substr($0, RSTART + 11, RLENGTH - 12), h, ",")
+	}
+	# upper bound of the bucket holding the p-th percentile
+	function pct(p,    i, sum) {
+		sum = 0
+		for (i = 1; i <= n; i++) {
+			sum += h[i]
+			if (sum >= p * wakes)
+				return i == 1 ? 0 : i == n ? max : 2 ^ (i - 1) - 1
+		}
+		return max
+	}
+	END {
+		if (!wakes) {
+			printf "wd phase=%s rate=%s wakes=0\n", phase, rate
+			exit
+		}
+		p50 = pct(0.5)
+		p99 = pct(0.99)
+		printf "wd phase=%s rate=%s wakes=%d p50_ns=%d p99_ns=%d " \
+		       "max_ns=%d smooth_mbit=%.0f burst_bytes=%.0f\n",
+		       phase, rate, wakes, p50, p99, max,
+		       p99 ? 1514 * 8 * 1000 / p99 : 0,
+		       mbit * 1e6 / 8 * p99 / 1e9
+		for (i = 1; i <= n; i++)
+			if (h[i])
+				printf "wd_hist phase=%s rate=%s lt_ns=%s " \
+				       "count=%d\n", phase, rate,
+				       i == 1 ? "1" : i == n ? "inf" : \
+				       sprintf("%d", 2 ^ (i - 1)), h[i]
+	}'
+}
+
+for phase in $PHASES; do
+	for rate in $RATES; do
+		run $phase $rate
+	done
+done
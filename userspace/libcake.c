@@ -0,0 +1,489 @@
+/*
+ * libcake - sch_cake.c built in userspace against a kernel shim
+ *
+ * The qdisc is included verbatim; everything below only drives it through
+ * its Qdisc_ops, the way the kernel would.
+ */
+
+#include "../sch_cake.c"
+#include "libcake.h"
+#include "util.h"
+
+struct cake_sim {
+	struct net_device	dev;
+	struct netdev_queue	txq;
+	struct Qdisc		*sch;
+	cake_sim_drop_fn	drop_fn;
+	void			*drop_arg;
+	struct shim_mem_stats	mem;	/* what cake_init() allocated */
+	int			iif;	/* skb_iif of what is enqueued */
+};
+
+static int cake_sim_ifindex;
+
+void cake_sim_set_time(uint64_t ns)
+{
+	shim_now = ns;
+}
+
+uint64_t cake_sim_time(void)
+{
+	return shim_now;
+}
+
+void cake_sim_seed(uint32_t seed)
+{
+	shim_seed(seed);
+}
+
+void cake_sim_kmalloc_max(unsigned long bytes)
+{
+	shim_kmalloc_max = bytes;
+}
+
+unsigned long cake_sim_shrink(unsigned long pages)
+{
+	return shim_shrink(pages);
+}
+
+void cake_sim_mem_pool(unsigned int bytes, unsigned int min)
+{
+	cake_mem_pool = bytes;
+	cake_mem_min = min;
+}
+
+/* Pack the options as a TCA_OPTIONS nest, as tc would send them. */
+static struct nlattr *cake_sim_opts(const struct cake_sim_opt *opt,
+				    unsigned int n)
+{
+	struct sk_buff *skb = alloc_skb(NLA_HDRLEN * (2 * n + 1) +
+					sizeof(u32) * n, GFP_KERNEL);
+	struct nlattr *nest;
+	unsigned int i;
+
+	if (!skb)
+		return NULL;
+
+	nest = nla_nest_start(skb, TCA_OPTIONS);
+	for (i = 0; i < n; i++)
+		nla_put_u32(skb, opt[i].type, opt[i].value);
+	nla_nest_end(skb, nest);
+
+	/* hand the buffer over; the caller frees it with free() */
+	nest = (struct nlattr *)skb->head;
+	free(skb);
+	return nest;
+}
+
+static u8 cake_sim_dsfield(const struct sk_buff *skb)
+{
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		return ipv4_get_dsfield(ip_hdr(skb));
+	case htons(ETH_P_IPV6):
+		return ipv6_get_dsfield(ipv6_hdr(skb));
+	default:
+		return 0;
+	}
+}
+
+static void cake_sim_fill(struct cake_pkt *pkt, const struct sk_buff *skb)
+{
+	u8 ds = cake_sim_dsfield(skb);
+
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->cookie     = skb->cookie;
+	pkt->enqueue_ns = codel_get_enqueue_time(skb);
+	pkt->len        = skb->len;
+	pkt->truesize   = skb->truesize;
+	pkt->tin        = skb->sim_tin;
+	pkt->flow       = skb->sim_flow;
+	pkt->dscp       = ds >> 2;
+	pkt->ce         = (ds & INET_ECN_MASK) == INET_ECN_CE &&
+			  skb->sim_ecn != INET_ECN_CE;
+}
+
+static void cake_sim_dropped(struct net_device *dev, struct sk_buff *skb)
+{
+	struct cake_sim *sim = dev->priv;
+	struct cake_pkt pkt;
+
+	if (!sim->drop_fn)
+		return;
+
+	cake_sim_fill(&pkt, skb);
+	pkt.dropped = 1;
+	sim->drop_fn(sim->drop_arg, &pkt);
+}
+
+/* Work out where cake_enqueue() will put the packet, so that drops and
+ * dequeues can be attributed to a tin and queue.
+ */
+static void cake_sim_classify(struct cake_sim *sim, struct sk_buff *skb)
+{
+	struct cake_sched_data *q = qdisc_priv(sim->sch);
+	u8 ds = cake_sim_dsfield(skb);
+	u32 tin = 0;
+
+	if (q->tin_mode != CAKE_MODE_BESTEFFORT) {
+		tin = q->tin_index[ds >> 2];
+		if (tin >= q->tin_cnt)
+			tin = 0;
+	}
+
+	skb->sim_tin  = tin;
+	skb->sim_flow = cake_hash(&q->tins[tin], skb, q->flow_mode,
+				  cake_skb_tenant(skb, q->flow_mode));
+	skb->sim_ecn  = ds & INET_ECN_MASK;
+}
+
+static u16 cake_sim_hdr_len(const struct sk_buff *skb)
+{
+	const u8 *nh = skb_network_header(skb);
+	u32 hlen;
+	u8 proto;
+
+	if (skb->protocol == htons(ETH_P_IP)) {
+		hlen  = ip_hdr(skb)->ihl * 4;
+		proto = ip_hdr(skb)->protocol;
+	} else {
+		hlen  = sizeof(struct ipv6hdr);
+		proto = ipv6_hdr(skb)->nexthdr;
+	}
+
+	if (proto == IPPROTO_TCP && hlen + 20 <= skb->len)
+		hlen += (nh[hlen + 12] >> 4) * 4;
+	else if (proto == IPPROTO_UDP)
+		hlen += 8;
+	return min_t(u32, hlen, skb->len);
+}
+
+/* A new cake root on sim's queue, as qdisc_create() makes it. */
+static int cake_sim_qdisc(struct cake_sim *sim, const struct cake_sim_opt *opt,
+			  unsigned int n, u32 handle, struct Qdisc **out)
+{
+	struct nlattr *attr = NULL;
+	struct Qdisc *sch;
+	int err;
+
+	sch = calloc(1, QDISC_ALIGN(sizeof(struct Qdisc)) +
+			cake_qdisc_ops.priv_size);
+	if (!sch)
+		return -ENOMEM;
+	sch->ops       = &cake_qdisc_ops;
+	sch->dev       = &sim->dev;
+	sch->dev_queue = &sim->txq;
+	sch->handle    = handle;
+	sch->parent    = TC_H_ROOT;
+
+	if (n) {
+		attr = cake_sim_opts(opt, n);
+		if (!attr) {
+			free(sch);
+			return -ENOMEM;
+		}
+	}
+
+	sim->mem = shim_mem;
+	err = cake_qdisc_ops.init(sch, attr);
+	free(attr);
+	if (err) {
+		free(sch);
+		return err;
+	}
+	sim->mem.kmalloc_bytes = shim_mem.kmalloc_bytes -
+				 sim->mem.kmalloc_bytes;
+	sim->mem.vmalloc_bytes = shim_mem.vmalloc_bytes -
+				 sim->mem.vmalloc_bytes;
+	sim->mem.kmalloc_slab  = shim_mem.kmalloc_slab - sim->mem.kmalloc_slab;
+	sim->mem.vmalloc_pages = shim_mem.vmalloc_pages -
+				 sim->mem.vmalloc_pages;
+	*out = sch;
+	return 0;
+}
+
+struct cake_sim *cake_sim_create(const struct cake_sim_opt *opt,
+				 unsigned int n, unsigned int mtu)
+{
+	struct cake_sim *sim = calloc(1, sizeof(*sim));
+
+	/* the tools name modes from util.c */
+	BUILD_BUG_ON(CAKE_DIFFSERV_NAMES != CAKE_MODE_MAX);
+	BUILD_BUG_ON(CAKE_FLOW_NAMES != CAKE_FLOW_MAX);
+
+	if (!sim)
+		return NULL;
+
+	if (cake_module_init())
+		goto fail;
+
+	snprintf(sim->dev.name, sizeof(sim->dev.name), "sim%d",
+		 cake_sim_ifindex);
+	sim->dev.ifindex         = ++cake_sim_ifindex;
+	sim->dev.mtu             = mtu ? mtu : 1500;
+	sim->dev.hard_header_len = 14;
+	sim->dev.drop_hook       = cake_sim_dropped;
+	sim->dev.priv            = sim;
+	set_bit(__LINK_STATE_START, &sim->dev.state);
+	sim->txq.numa_node       = NUMA_NO_NODE;
+
+	if (cake_sim_qdisc(sim, opt, n, 0x10000, &sim->sch))
+		goto fail;
+	sim->txq.qdisc_sleeping = sim->sch;
+	sim->txq.qdisc          = sim->sch;
+	return sim;
+
+fail:
+	free(sim);
+	return NULL;
+}
+
+int cake_sim_change(struct cake_sim *sim, const struct cake_sim_opt *opt,
+		    unsigned int n)
+{
+	struct nlattr *attr = cake_sim_opts(opt, n);
+	int err;
+
+	if (!attr)
+		return -ENOMEM;
+
+	err = cake_qdisc_ops.change(sim->sch, attr);
+	free(attr);
+	return err;
+}
+
+int cake_sim_replace(struct cake_sim *sim, const struct cake_sim_opt *opt,
+		     unsigned int n)
+{
+	struct Qdisc *old = sim->sch;
+	struct cake_sched_data *q;
+	int err;
+
+	err = cake_sim_qdisc(sim, opt, n, old->handle + 0x10000, &sim->sch);
+	if (err)
+		return err;
+	q = qdisc_priv(sim->sch);
+
+	/* dev_deactivate(), dev_graft_qdisc() and dev_activate(), then
+	 * qdisc_destroy().  The old root is reset while it is still the TX
+	 * queue's and deactivated, so the new one can't arm its watchdog.
+	 */
+	sim->txq.qdisc = NULL;
+	set_bit(__QDISC_STATE_DEACTIVATED, &old->state);
+	cake_qdisc_ops.reset(old);
+	sim->txq.qdisc_sleeping = sim->sch;
+	cake_qdisc_ops.reset(old);
+	sim->txq.qdisc = sim->sch;
+	cake_qdisc_ops.destroy(old);
+	free(old);
+
+	/* whatever cake_handover() left to run it, a jiffy early */
+	shim_timer_run(&q->kick);
+	return 0;
+}
+
+void cake_sim_reset(struct cake_sim *sim)
+{
+	cake_qdisc_ops.reset(sim->sch);
+}
+
+void cake_sim_destroy(struct cake_sim *sim)
+{
+	if (!sim)
+		return;
+
+	sim->drop_fn = NULL;
+	cake_qdisc_ops.reset(sim->sch);
+	cake_qdisc_ops.destroy(sim->sch);
+	free(sim->sch);
+	free(sim);
+}
+
+void cake_sim_on_drop(struct cake_sim *sim, cake_sim_drop_fn fn, void *arg)
+{
+	sim->drop_fn  = fn;
+	sim->drop_arg = arg;
+}
+
+void cake_sim_set_iif(struct cake_sim *sim, int iif)
+{
+	sim->iif = iif;
+}
+
+static void cake_sim_skb_init(struct cake_sim *sim, struct sk_buff *skb,
+			      uint32_t len)
+{
+	skb->len = len;
+	skb->dev = &sim->dev;
+	skb->skb_iif = sim->iif;
+
+	switch (skb->data[0] >> 4) {
+	case 4:
+		skb->protocol = htons(ETH_P_IP);
+		break;
+	case 6:
+		skb->protocol = htons(ETH_P_IPV6);
+		break;
+	}
+}
+
+static struct sk_buff *cake_sim_skb(struct cake_sim *sim, const void *pkt,
+				     uint32_t len)
+{
+	struct sk_buff *skb = alloc_skb(len, GFP_ATOMIC);
+
+	if (!skb)
+		return NULL;
+
+	memcpy(skb->data, pkt, len);
+	cake_sim_skb_init(sim, skb, len);
+	return skb;
+}
+
+int cake_sim_classify_pkt(struct cake_sim *sim, const void *pkt,
+			  uint32_t len, struct cake_pkt *out)
+{
+	struct sk_buff *skb;
+
+	if (!len)
+		return -EINVAL;
+
+	skb = cake_sim_skb(sim, pkt, len);
+	if (!skb)
+		return -ENOMEM;
+
+	cake_sim_classify(sim, skb);
+	cake_sim_fill(out, skb);
+	consume_skb(skb);
+	return 0;
+}
+
+static int cake_sim_submit(struct cake_sim *sim, struct sk_buff *skb,
+			   uint32_t gso_size, uint64_t cookie)
+{
+	u32 len = skb->len;
+
+	skb->cookie = cookie;
+
+	/* as qdisc_pkt_len_init() would see it */
+	qdisc_skb_cb(skb)->pkt_len = len;
+	if (gso_size && skb->protocol) {
+		u32 segs;
+
+		skb->hdr_len  = cake_sim_hdr_len(skb);
+		skb->gso_size = gso_size;
+		if (len > skb->hdr_len) {
+			segs = (len - skb->hdr_len + gso_size - 1) / gso_size;
+			qdisc_skb_cb(skb)->pkt_len += (segs - 1) * skb->hdr_len;
+		}
+	}
+
+	cake_sim_classify(sim, skb);
+	return cake_qdisc_ops.enqueue(skb, sim->sch);
+}
+
+int cake_sim_enqueue(struct cake_sim *sim, const void *pkt, uint32_t len,
+		     uint32_t gso_size, uint64_t cookie)
+{
+	struct sk_buff *skb;
+
+	if (!len)
+		return -EINVAL;
+
+	skb = cake_sim_skb(sim, pkt, len);
+	if (!skb)
+		return -ENOMEM;
+	return cake_sim_submit(sim, skb, gso_size, cookie);
+}
+
+int cake_sim_enqueue_buf(struct cake_sim *sim, void *buf, uint32_t len,
+			 uint32_t size, uint64_t handle)
+{
+	struct sk_buff *skb;
+
+	if (!len || len > size)
+		return -EINVAL;
+
+	skb = build_skb(buf, size);
+	if (!skb)
+		return -ENOMEM;
+	cake_sim_skb_init(sim, skb, len);
+	return cake_sim_submit(sim, skb, 0, handle);
+}
+
+int cake_sim_dequeue(struct cake_sim *sim, struct cake_pkt *pkt)
+{
+	struct cake_sched_data *q = qdisc_priv(sim->sch);
+	struct sk_buff *skb;
+
+	/* being polled once it is due is as good as the watchdog firing */
+	if (shim_now >= q->watchdog.expires)
+		qdisc_watchdog_cancel(&q->watchdog);
+	clear_bit(__QDISC_STATE_SCHED, &sim->sch->state);
+
+	skb = cake_qdisc_ops.dequeue(sim->sch);
+	if (!skb)
+		return 0;
+
+	cake_sim_fill(pkt, skb);
+	consume_skb(skb);
+	return 1;
+}
+
+uint64_t cake_sim_wakeup(const struct cake_sim *sim)
+{
+	const struct cake_sched_data *q = qdisc_priv(sim->sch);
+
+	if (test_bit(__QDISC_STATE_SCHED, &sim->sch->state))
+		return cake_sim_time();
+	return hrtimer_is_queued(&q->watchdog.timer) ? q->watchdog.expires : 0;
+}
+
+void cake_sim_counters(const struct cake_sim *sim,
+		       struct cake_sim_counters *out)
+{
+	out->bytes      = sim->sch->bstats.bytes;
+	out->packets    = sim->sch->bstats.packets;
+	out->drops      = sim->sch->qstats.drops;
+	out->overlimits = sim->sch->qstats.overlimits;
+	out->backlog    = sim->sch->qstats.backlog;
+	out->qlen       = sim->sch->q.qlen;
+}
+
+uint32_t cake_sim_qlen(const struct cake_sim *sim)
+{
+	return sim->sch->q.qlen;
+}
+
+uint32_t cake_sim_backlog(const struct cake_sim *sim)
+{
+	return sim->sch->qstats.backlog;
+}
+
+uint32_t cake_sim_drops(const struct cake_sim *sim)
+{
+	return sim->sch->qstats.drops;
+}
+
+int cake_sim_xstats(struct cake_sim *sim, void *buf, unsigned int len)
+{
+	struct gnet_dump d = { .xstats = buf, .xstats_len = len };
+
+	if (cake_qdisc_ops.dump_stats(sim->sch, &d))
+		return -1;
+	return d.xstats_len;
+}
+
+void cake_sim_mem(const struct cake_sim *sim, struct cake_sim_mem *out)
+{
+	const struct cake_sched_data *q = qdisc_priv(sim->sch);
+
+	out->kmalloc_bytes = sim->mem.kmalloc_bytes;
+	out->vmalloc_bytes = sim->mem.vmalloc_bytes;
+	out->kmalloc_slab  = sim->mem.kmalloc_slab;
+	out->vmalloc_pages = sim->mem.vmalloc_pages;
+	out->queues        = q->tins[0].flows_cnt;
+	out->flow_bytes    = sizeof(struct cake_flow);
+	out->buffer_limit  = q->buffer_limit;
+	out->buffer_peak   = q->buffer_max_used;
+}
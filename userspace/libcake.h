@@ -0,0 +1,146 @@
+/*
+ * libcake - sch_cake.c built in userspace against a kernel shim
+ *
+ * The qdisc source is compiled unmodified; time is a virtual clock that
+ * only moves when the caller moves it, so every run is deterministic.
+ * Packets are raw IPv4 or IPv6 datagrams, starting at the IP header.
+ *
+ * The same engine shapes real traffic for userspace dataplanes: set the
+ * clock from CLOCK_MONOTONIC before each call, hand packets over with
+ * cake_sim_enqueue_buf() and send what cake_sim_dequeue() releases.
+ */
+
+#ifndef __LIBCAKE_H
+#define __LIBCAKE_H
+
+#include <stdint.h>
+
+struct cake_sim;
+
+/* A packet leaving the qdisc, or being dropped by it. */
+struct cake_pkt {
+	uint64_t cookie;	/* as passed to cake_sim_enqueue() */
+	uint64_t enqueue_ns;
+	uint32_t len;
+	uint32_t truesize;	/* what it counts against the memory limit */
+	uint16_t tin;
+	uint16_t flow;		/* queue index within the tin */
+	uint8_t  dscp;		/* after any washing */
+	uint8_t  ce;		/* CE-marked by cake */
+	uint8_t  dropped;
+};
+
+/* One TCA_CAKE_* attribute, all of which are 32 bits wide. */
+struct cake_sim_opt {
+	uint16_t type;
+	uint32_t value;
+};
+
+typedef void (*cake_sim_drop_fn)(void *arg, const struct cake_pkt *pkt);
+
+/* virtual clock, shared by all instances */
+void cake_sim_set_time(uint64_t ns);
+uint64_t cake_sim_time(void);
+void cake_sim_seed(uint32_t seed);
+
+/* Fail kmalloc above this many bytes from now on, as on a fragmented
+ * machine; cake_zalloc() then falls back to vmalloc.
+ */
+void cake_sim_kmalloc_max(unsigned long bytes);
+
+/* Memory pressure, as the kernel's shrinker applies it: all instances
+ * between them drop up to this many pages of queued truesize, fattest
+ * flows first.  Returns the pages freed.
+ */
+unsigned long cake_sim_shrink(unsigned long pages);
+
+/* The mem_pool and mem_min module parameters: all instances share bytes of
+ * truesize, each keeping min of it.  Set before creating any instance.
+ */
+void cake_sim_mem_pool(unsigned int bytes, unsigned int min);
+
+struct cake_sim *cake_sim_create(const struct cake_sim_opt *opt,
+				 unsigned int n, unsigned int mtu);
+int cake_sim_change(struct cake_sim *sim, const struct cake_sim_opt *opt,
+		    unsigned int n);
+/* tc qdisc replace with a new handle: a new instance is grafted in place
+ * of the old, which is then destroyed.  Its queues carry over.
+ */
+int cake_sim_replace(struct cake_sim *sim, const struct cake_sim_opt *opt,
+		     unsigned int n);
+void cake_sim_reset(struct cake_sim *sim);
+void cake_sim_destroy(struct cake_sim *sim);
+
+void cake_sim_on_drop(struct cake_sim *sim, cake_sim_drop_fn fn, void *arg);
+
+/* Packets enqueued from now on came in on interface iif, 0 for sent from
+ * this host; in tenants mode it is whose they are.
+ */
+void cake_sim_set_iif(struct cake_sim *sim, int iif);
+
+/* Returns NET_XMIT_SUCCESS (0) when cake accepted the packet.  A non-zero
+ * gso_size makes it a GSO super-packet of gso_size byte segments.
+ */
+int cake_sim_enqueue(struct cake_sim *sim, const void *pkt, uint32_t len,
+		     uint32_t gso_size, uint64_t cookie);
+
+/* Zero-copy enqueue of a buffer the caller owns, such as an AF_XDP umem
+ * frame of size bytes holding len bytes of packet.  cake works on it in
+ * place, so ECN marks and DSCP washing end up in the caller's packet, and
+ * never frees it: handle comes back as the cookie of the cake_pkt that
+ * releases or drops it, after which the buffer may be reused.
+ */
+int cake_sim_enqueue_buf(struct cake_sim *sim, void *buf, uint32_t len,
+			 uint32_t size, uint64_t handle);
+
+/* Where cake would put this packet (tin, flow, truesize), without
+ * enqueueing it.
+ */
+int cake_sim_classify_pkt(struct cake_sim *sim, const void *pkt,
+			  uint32_t len, struct cake_pkt *out);
+
+/* Returns 1 and fills *pkt if a packet was released at the current time. */
+int cake_sim_dequeue(struct cake_sim *sim, struct cake_pkt *pkt);
+
+/* When the shaper wants to be polled again, or 0 if it doesn't care. */
+uint64_t cake_sim_wakeup(const struct cake_sim *sim);
+
+/* The qdisc's own counters, as TCA_STATS_BASIC and TCA_STATS_QUEUE
+ * carry them.
+ */
+struct cake_sim_counters {
+	uint64_t bytes;
+	uint32_t packets;
+	uint32_t drops;
+	uint32_t overlimits;
+	uint32_t backlog;
+	uint32_t qlen;
+};
+
+void cake_sim_counters(const struct cake_sim *sim,
+		       struct cake_sim_counters *out);
+
+uint32_t cake_sim_qlen(const struct cake_sim *sim);
+uint32_t cake_sim_backlog(const struct cake_sim *sim);
+uint32_t cake_sim_drops(const struct cake_sim *sim);
+
+/* Copy struct tc_cake_xstats into buf; returns its full size. */
+int cake_sim_xstats(struct cake_sim *sim, void *buf, unsigned int len);
+
+/* What an instance's tables cost, as cake_init() allocated them, and the
+ * most packet memory (truesize) it has held queued so far.
+ */
+struct cake_sim_mem {
+	uint64_t kmalloc_bytes;
+	uint64_t vmalloc_bytes;	/* where cake_zalloc() fell back */
+	uint64_t kmalloc_slab;	/* the same, as the allocators round them */
+	uint64_t vmalloc_pages;
+	uint32_t queues;	/* flow queues per tin */
+	uint32_t flow_bytes;	/* sizeof(struct cake_flow) */
+	uint32_t buffer_limit;
+	uint32_t buffer_peak;
+};
+
+void cake_sim_mem(const struct cake_sim *sim, struct cake_sim_mem *out);
+
+#endif
@@ -0,0 +1,369 @@
+/*
+ * Minimal pcap and pcapng reader, see pcapread.h.
+ *
+ * Classic pcap in either byte order with micro- or nanosecond stamps, and
+ * pcapng section/interface/enhanced/simple packet blocks with per-interface
+ * timestamp resolution.  Link types: Ethernet (with VLAN tags), Linux
+ * cooked capture, BSD loopback and raw IP.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pcapread.h"
+
+#define PCAP_MAGIC_US	0xa1b2c3d4
+#define PCAP_MAGIC_NS	0xa1b23c4d
+#define PCAPNG_SHB	0x0a0d0d0a
+#define PCAPNG_IDB	0x00000001
+#define PCAPNG_SPB	0x00000003
+#define PCAPNG_EPB	0x00000006
+#define PCAPNG_BOM	0x1a2b3c4d
+
+#define LINKTYPE_NULL		0
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LOOP		108
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_IPV6		229
+
+#define MAX_IFACES	64
+
+struct pcap_iface {
+	uint16_t	linktype;
+	uint64_t	ts_div;		/* ticks per second */
+};
+
+struct pcap_reader {
+	FILE			*f;
+	int			ng;
+	int			swap;
+	struct pcap_iface	ifaces[MAX_IFACES];
+	unsigned int		nifaces;
+	uint8_t			*buf;
+	uint32_t		bufsize;
+	uint64_t		skipped;
+};
+
+static uint32_t get32(const struct pcap_reader *r, const void *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t get16(const struct pcap_reader *r, const void *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap16(v) : v;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+static int read_buf(struct pcap_reader *r, uint32_t len)
+{
+	if (len > r->bufsize) {
+		uint8_t *b = realloc(r->buf, len);
+
+		if (!b)
+			return -1;
+		r->buf = b;
+		r->bufsize = len;
+	}
+	return fread(r->buf, 1, len, r->f) == len ? 0 : -1;
+}
+
+static void add_iface(struct pcap_reader *r, uint16_t linktype,
+		      uint64_t ts_div)
+{
+	if (r->nifaces == MAX_IFACES)
+		return;
+	r->ifaces[r->nifaces].linktype = linktype;
+	r->ifaces[r->nifaces].ts_div   = ts_div;
+	r->nifaces++;
+}
+
+/* if_tsresol: high bit set means a power of two, else of ten */
+static uint64_t tsresol_div(uint8_t v)
+{
+	uint64_t div = 1;
+	int i;
+
+	for (i = 0; i < (v & 0x7f) && div < 1000000000000ULL; i++)
+		div *= (v & 0x80) ? 2 : 10;
+	return div;
+}
+
+static int read_idb(struct pcap_reader *r, uint32_t body)
+{
+	uint64_t ts_div = 1000000;
+	uint32_t off = 8;
+
+	if (body < 8)
+		return -1;
+
+	while (off + 4 <= body) {
+		uint16_t code = get16(r, r->buf + off);
+		uint16_t len  = get16(r, r->buf + off + 2);
+
+		if (!code)
+			break;
+		if (code == 9 && len >= 1 && off + 4 < body)
+			ts_div = tsresol_div(r->buf[off + 4]);
+		off += 4 + ((len + 3) & ~3);
+	}
+	add_iface(r, get16(r, r->buf), ts_div);
+	return 0;
+}
+
+static int read_shb(struct pcap_reader *r)
+{
+	uint8_t hdr[8];
+	uint32_t bom, len;
+
+	/* block type already read; the byte order mark decides swapping */
+	if (fread(hdr, 1, 8, r->f) != 8)
+		return -1;
+	memcpy(&bom, hdr + 4, sizeof(bom));
+	if (bom == PCAPNG_BOM)
+		r->swap = 0;
+	else if (bom == __builtin_bswap32(PCAPNG_BOM))
+		r->swap = 1;
+	else
+		return -1;
+
+	len = get32(r, hdr);
+	if (len < 28 || read_buf(r, len - 12))
+		return -1;
+
+	/* interface ids are per section */
+	r->nifaces = 0;
+	return 0;
+}
+
+struct pcap_reader *pcap_open(const char *path)
+{
+	struct pcap_reader *r = calloc(1, sizeof(*r));
+	uint8_t hdr[24];
+	uint32_t magic;
+
+	if (!r)
+		return NULL;
+
+	r->f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+	if (!r->f) {
+		perror(path);
+		free(r);
+		return NULL;
+	}
+
+	if (fread(&magic, 1, 4, r->f) != 4)
+		goto bad;
+
+	if (magic == PCAPNG_SHB) {
+		r->ng = 1;
+		if (read_shb(r))
+			goto bad;
+		return r;
+	}
+
+	if (fread(hdr + 4, 1, 20, r->f) != 20)
+		goto bad;
+
+	if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS) {
+		r->swap = 0;
+	} else if (__builtin_bswap32(magic) == PCAP_MAGIC_US ||
+		   __builtin_bswap32(magic) == PCAP_MAGIC_NS) {
+		r->swap = 1;
+		magic = __builtin_bswap32(magic);
+	} else {
+		goto bad;
+	}
+
+	add_iface(r, get32(r, hdr + 20) & 0xffff,
+		  magic == PCAP_MAGIC_NS ? 1000000000 : 1000000);
+	return r;
+
+bad:
+	fprintf(stderr, "%s: not a pcap or pcapng file\n", path);
+	pcap_close(r);
+	return NULL;
+}
+
+void pcap_close(struct pcap_reader *r)
+{
+	if (!r)
+		return;
+	if (r->f && r->f != stdin)
+		fclose(r->f);
+	free(r->buf);
+	free(r);
+}
+
+uint64_t pcap_skipped(const struct pcap_reader *r)
+{
+	return r->skipped;
+}
+
+/* Strip the link layer; returns the offset of the IP header or -1. */
+static int link_offset(uint16_t linktype, const uint8_t *p, uint32_t caplen)
+{
+	uint32_t off, proto;
+
+	switch (linktype) {
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		return 0;
+
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		return caplen >= 4 ? 4 : -1;
+
+	case LINKTYPE_LINUX_SLL:
+		if (caplen < 16)
+			return -1;
+		off = 16;
+		proto = get_be16(p + 14);
+		break;
+
+	case LINKTYPE_ETHERNET:
+		if (caplen < 14)
+			return -1;
+		off = 14;
+		proto = get_be16(p + 12);
+		while ((proto == 0x8100 || proto == 0x88a8) &&
+		       off + 4 <= caplen) {
+			proto = get_be16(p + off + 2);
+			off += 4;
+		}
+		break;
+
+	default:
+		return -1;
+	}
+
+	return (proto == 0x0800 || proto == 0x86dd) ? (int)off : -1;
+}
+
+/* Length of the IP packet according to its own header, if it fits. */
+static uint32_t ip_len(const uint8_t *p, uint32_t caplen, uint32_t wirelen)
+{
+	if (caplen >= 20 && (p[0] >> 4) == 4)
+		return get_be16(p + 2) ? get_be16(p + 2) : wirelen;
+	if (caplen >= 40 && (p[0] >> 4) == 6)
+		return get_be16(p + 4) + 40;
+	return wirelen;
+}
+
+static int read_record(struct pcap_reader *r, unsigned int *iface,
+		       uint64_t *ts, uint32_t *caplen, uint32_t *wirelen,
+		       uint32_t *off)
+{
+	uint8_t hdr[16];
+	uint32_t type, len;
+
+	if (!r->ng) {
+		if (fread(hdr, 1, 16, r->f) != 16)
+			return feof(r->f) ? 0 : -1;
+		*iface   = 0;
+		*ts      = (uint64_t)get32(r, hdr) * r->ifaces[0].ts_div +
+			   get32(r, hdr + 4);
+		*caplen  = get32(r, hdr + 8);
+		*wirelen = get32(r, hdr + 12);
+		*off     = 0;
+		if (*caplen > 0x4000000)
+			return -1;
+		return read_buf(r, *caplen) ? -1 : 1;
+	}
+
+	for (;;) {
+		if (fread(&type, 1, 4, r->f) != 4)
+			return feof(r->f) ? 0 : -1;
+		if (type == PCAPNG_SHB) {
+			if (read_shb(r))
+				return -1;
+			continue;
+		}
+		if (fread(&len, 1, 4, r->f) != 4)
+			return -1;
+		type = get32(r, &type);
+		len  = get32(r, &len);
+		if (len < 12 || len > 0x4000000 || read_buf(r, len - 8))
+			return -1;
+
+		switch (type) {
+		case PCAPNG_IDB:
+			if (read_idb(r, len - 12))
+				return -1;
+			break;
+
+		case PCAPNG_EPB:
+			if (len < 32)
+				return -1;
+			*iface   = get32(r, r->buf);
+			*ts      = (uint64_t)get32(r, r->buf + 4) << 32 |
+				   get32(r, r->buf + 8);
+			*caplen  = get32(r, r->buf + 12);
+			*wirelen = get32(r, r->buf + 16);
+			*off     = 20;
+			if (*caplen > len - 32)
+				return -1;
+			return 1;
+
+		case PCAPNG_SPB:
+			if (len < 16)
+				return -1;
+			*iface   = 0;
+			*ts      = 0;
+			*wirelen = get32(r, r->buf);
+			*caplen  = *wirelen < len - 16 ? *wirelen : len - 16;
+			*off     = 4;
+			return 1;
+		}
+	}
+}
+
+int pcap_next_ip(struct pcap_reader *r, struct pcap_pkt *pkt)
+{
+	for (;;) {
+		uint32_t caplen, wirelen, off;
+		const struct pcap_iface *ifc;
+		unsigned int iface;
+		uint64_t ts;
+		int ret, l2;
+
+		ret = read_record(r, &iface, &ts, &caplen, &wirelen, &off);
+		if (ret <= 0)
+			return ret;
+
+		if (iface >= r->nifaces) {
+			r->skipped++;
+			continue;
+		}
+		ifc = &r->ifaces[iface];
+
+		l2 = link_offset(ifc->linktype, r->buf + off, caplen);
+		if (l2 < 0 || (uint32_t)l2 >= caplen) {
+			r->skipped++;
+			continue;
+		}
+
+		pkt->ts_ns  = (unsigned __int128)ts * 1000000000ULL /
+			      ifc->ts_div;
+		pkt->data   = r->buf + off + l2;
+		pkt->caplen = caplen - l2;
+		pkt->len    = ip_len(pkt->data, pkt->caplen,
+				     wirelen > (uint32_t)l2 ? wirelen - l2 :
+							     pkt->caplen);
+		if (pkt->len < pkt->caplen)
+			pkt->caplen = pkt->len;
+		return 1;
+	}
+}
@@ -0,0 +1,33 @@
+/*
+ * Minimal pcap and pcapng reader for the userspace tools.  Hands back
+ * packets with the link layer already stripped, starting at the IPv4 or
+ * IPv6 header, which is what libcake takes.
+ */
+
+#ifndef __PCAPREAD_H
+#define __PCAPREAD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct pcap_pkt {
+	uint64_t	ts_ns;
+	const uint8_t	*data;		/* IP header onwards */
+	uint32_t	caplen;		/* bytes present at data */
+	uint32_t	len;		/* IP length on the wire */
+};
+
+struct pcap_reader;
+
+/* NULL on error, with a message on stderr */
+struct pcap_reader *pcap_open(const char *path);
+void pcap_close(struct pcap_reader *r);
+
+/* Returns 1 and fills *pkt with the next IP packet, 0 at the end of the
+ * file and -1 on a malformed capture.  Non-IP frames are skipped and
+ * counted.  *pkt stays valid until the next call.
+ */
+int pcap_next_ip(struct pcap_reader *r, struct pcap_pkt *pkt);
+uint64_t pcap_skipped(const struct pcap_reader *r);
+
+#endif
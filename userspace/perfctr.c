@@ -0,0 +1,96 @@
+/*
+ * Thin wrapper around perf_event_open(), see perfctr.h.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+const char * const perfctr_names[PERFCTR_MAX] = {
+	"cycles", "instructions", "branch_misses", "llc_misses",
+};
+
+static const uint64_t perfctr_config[PERFCTR_MAX] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static int perfctr_counter(uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size           = sizeof(attr);
+	attr.type           = PERF_TYPE_HARDWARE;
+	attr.config         = config;
+	attr.disabled       = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Counters are opened individually rather than as a group, so that one
+ * the PMU lacks doesn't take the others down with it.
+ */
+void perfctr_open(struct perfctr *pc)
+{
+	int i;
+
+	for (i = 0; i < PERFCTR_MAX; i++)
+		pc->fd[i] = perfctr_counter(perfctr_config[i]);
+}
+
+void perfctr_close(struct perfctr *pc)
+{
+	int i;
+
+	for (i = 0; i < PERFCTR_MAX; i++)
+		if (pc->fd[i] >= 0)
+			close(pc->fd[i]);
+}
+
+static uint64_t perfctr_read(int fd)
+{
+	uint64_t v;
+
+	if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+		return PERFCTR_NONE;
+	return v;
+}
+
+void perfctr_start(struct perfctr *pc)
+{
+	int i;
+
+	for (i = 0; i < PERFCTR_MAX; i++) {
+		if (pc->fd[i] < 0)
+			continue;
+		pc->start[i] = perfctr_read(pc->fd[i]);
+		ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void perfctr_stop(struct perfctr *pc)
+{
+	int i;
+
+	for (i = 0; i < PERFCTR_MAX; i++) {
+		uint64_t v;
+
+		if (pc->fd[i] < 0) {
+			pc->delta[i] = PERFCTR_NONE;
+			continue;
+		}
+		ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		v = perfctr_read(pc->fd[i]);
+		pc->delta[i] = (v == PERFCTR_NONE ||
+				pc->start[i] == PERFCTR_NONE) ?
+			       PERFCTR_NONE : v - pc->start[i];
+	}
+}
@@ -0,0 +1,35 @@
+/*
+ * Thin wrapper around perf_event_open() for the userspace benchmarks:
+ * one group of hardware counters on the calling thread.  Counters the
+ * machine (or container) doesn't offer read back as PERFCTR_NONE.
+ */
+
+#ifndef __PERFCTR_H
+#define __PERFCTR_H
+
+#include <stdint.h>
+
+enum {
+	PERFCTR_CYCLES,
+	PERFCTR_INSTRUCTIONS,
+	PERFCTR_BRANCH_MISSES,
+	PERFCTR_LLC_MISSES,
+	PERFCTR_MAX
+};
+
+#define PERFCTR_NONE	UINT64_MAX
+
+struct perfctr {
+	int		fd[PERFCTR_MAX];
+	uint64_t	start[PERFCTR_MAX];
+	uint64_t	delta[PERFCTR_MAX];
+};
+
+extern const char * const perfctr_names[PERFCTR_MAX];
+
+void perfctr_open(struct perfctr *pc);
+void perfctr_close(struct perfctr *pc);
+void perfctr_start(struct perfctr *pc);
+void perfctr_stop(struct perfctr *pc);
+
+#endif
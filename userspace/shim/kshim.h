@@ -0,0 +1,1151 @@
+/*
+ * Minimal kernel shim for building sch_cake.c in userspace.
+ *
+ * Only what sch_cake.c and codel5.h actually use is provided, with the
+ * semantics of the 4.4 kernel they target.  Every <linux/...> and <net/...>
+ * header the qdisc includes resolves to a stub that pulls in this file.
+ *
+ * Time comes from a virtual clock owned by the caller (shim_now), random
+ * numbers from a seeded generator, so runs are fully deterministic.
+ */
+
+#ifndef __CAKE_KSHIM_H
+#define __CAKE_KSHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* ---- basic types ---- */
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+typedef u8  __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s8  __s8;
+typedef s16 __s16;
+typedef s32 __s32;
+typedef s64 __s64;
+
+typedef u16 __be16;
+typedef u32 __be32;
+typedef u16 __sum16;
+typedef u32 gfp_t;
+typedef u64 netdev_features_t;
+typedef s64 ktime_t;
+
+#define __force
+#define __read_mostly
+#define __init
+#define __exit
+#define __aligned(x)		__attribute__((aligned(x)))
+
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+
+#define U16_MAX			((u16)~0U)
+#define U32_MAX			((u32)~0U)
+#define U64_MAX			((u64)~0ULL)
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(c)		((void)sizeof(char[1 - 2 * !!(c)]))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b) ({ typeof(a) _a = (a); typeof(b) _b = (b); \
+		     _a < _b ? _a : _b; })
+#define max(a, b) ({ typeof(a) _a = (a); typeof(b) _b = (b); \
+		     _a > _b ? _a : _b; })
+#define min_t(t, a, b) ({ t _a = (a); t _b = (b); _a < _b ? _a : _b; })
+#define max_t(t, a, b) ({ t _a = (a); t _b = (b); _a > _b ? _a : _b; })
+#define swap(a, b) \
+	do { typeof(a) _t = (a); (a) = (b); (b) = _t; } while (0)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+/* divide n in place, return the remainder */
+#define do_div(n, base) ({ u32 __base = (base);			\
+			   u32 __rem = (u32)((n) % __base);		\
+			   (n) /= __base;				\
+			   __rem; })
+
+#define BUG_ON(c) do {							\
+	if (unlikely(c)) {						\
+		fprintf(stderr, "BUG at %s:%d\n", __FILE__, __LINE__);	\
+		abort();						\
+	}								\
+} while (0)
+
+#define WARN_ON(c) ({ int __w = !!(c);					\
+		      if (unlikely(__w))				\
+			fprintf(stderr, "WARNING at %s:%d\n",		\
+				__FILE__, __LINE__);			\
+		      __w; })
+
+#define EINVAL			22
+#define ENOMEM			12
+#define MAX_ERRNO		4095
+#define IS_ERR_VALUE(x)		((unsigned long)(x) >= (unsigned long)-MAX_ERRNO)
+#define IS_ERR_OR_NULL(p)	(!(p) || IS_ERR_VALUE((unsigned long)(p)))
+#define ERR_PTR(e)		((void *)(long)(e))
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define htons(x)		((__be16)(x))
+#define ntohs(x)		((u16)(x))
+#define htonl(x)		((__be32)(x))
+#define ntohl(x)		((u32)(x))
+#else
+#define htons(x)		((__be16)__builtin_bswap16(x))
+#define ntohs(x)		((u16)__builtin_bswap16(x))
+#define htonl(x)		((__be32)__builtin_bswap32(x))
+#define ntohl(x)		((u32)__builtin_bswap32(x))
+#endif
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> ((-shift) & 31));
+}
+
+static inline int fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+/* ---- module glue ---- */
+
+struct module;
+#define THIS_MODULE		((struct module *)NULL)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_DESCRIPTION(x)
+#define module_init(fn) \
+	static int (*__shim_module_init)(void) __attribute__((used)) = fn;
+#define module_exit(fn) \
+	static void (*__shim_module_exit)(void) __attribute__((used)) = fn;
+#define module_param_named(name, var, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+
+/* ---- time, randomness ---- */
+
+#define NSEC_PER_USEC		1000L
+#define NSEC_PER_MSEC		1000000L
+#define NSEC_PER_SEC		1000000000L
+#define USEC_PER_SEC		1000000L
+
+extern u64 shim_now;		/* virtual CLOCK_MONOTONIC, in ns */
+extern u64 shim_realtime_base;	/* CLOCK_REALTIME at shim_now == 0 */
+
+static inline u64 ktime_get_ns(void)
+{
+	return shim_now;
+}
+
+static inline ktime_t ktime_get(void)
+{
+	return (ktime_t)shim_now;
+}
+
+static inline ktime_t ktime_get_real(void)
+{
+	return (ktime_t)(shim_realtime_base + shim_now);
+}
+
+static inline s64 ktime_to_ns(ktime_t kt)
+{
+	return kt;
+}
+
+#define HZ			1000
+#define jiffies			((unsigned long)(shim_now / (NSEC_PER_SEC / HZ)))
+
+/* Timers never fire by themselves; the caller runs them with
+ * shim_timer_run() when it wants them to have expired.
+ */
+struct timer_list {
+	unsigned long	expires;
+	void		(*function)(unsigned long);
+	unsigned long	data;
+	bool		pending;
+};
+
+static inline void setup_timer(struct timer_list *timer,
+			       void (*function)(unsigned long),
+			       unsigned long data)
+{
+	timer->function = function;
+	timer->data = data;
+	timer->pending = false;
+}
+
+static inline int timer_pending(const struct timer_list *timer)
+{
+	return timer->pending;
+}
+
+static inline int mod_timer(struct timer_list *timer, unsigned long expires)
+{
+	int was = timer->pending;
+
+	timer->expires = expires;
+	timer->pending = true;
+	return was;
+}
+
+static inline int del_timer_sync(struct timer_list *timer)
+{
+	int was = timer->pending;
+
+	timer->pending = false;
+	return was;
+}
+
+static inline void shim_timer_run(struct timer_list *timer)
+{
+	if (timer->pending) {
+		timer->pending = false;
+		timer->function(timer->data);
+	}
+}
+
+typedef u64 cycles_t;
+cycles_t get_cycles(void);
+
+u32 prandom_u32(void);
+void shim_seed(u32 seed);
+
+static inline u32 reciprocal_scale(u32 val, u32 ep_ro)
+{
+	return (u32)(((u64) val * ep_ro) >> 32);
+}
+
+/* ---- memory ---- */
+
+#define GFP_KERNEL		0x01u
+#define GFP_ATOMIC		0x02u
+#define __GFP_NOWARN		0x10u
+
+/* Largest request kmalloc will satisfy; bigger ones must use vmalloc. */
+#define KMALLOC_MAX_SIZE	(4UL << 20)
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+
+/* bytes asked for, and what the allocators really hand out for them:
+ * kmalloc rounds up to a power of two, vmalloc to whole pages
+ */
+struct shim_mem_stats {
+	u64	kmalloc_bytes;
+	u64	vmalloc_bytes;
+	u64	kmalloc_slab;
+	u64	vmalloc_pages;
+	u64	kmalloc_fails;
+};
+extern struct shim_mem_stats shim_mem;
+
+/* Lower this to play a fragmented machine, where high-order kmalloc
+ * fails long before KMALLOC_MAX_SIZE.
+ */
+extern size_t shim_kmalloc_max;
+
+void *kzalloc(size_t size, gfp_t flags);
+void *vzalloc(size_t size);
+void kfree(const void *p);
+void vfree(const void *p);
+void kvfree(const void *p);
+bool is_vmalloc_addr(const void *p);
+
+/* NUMA: every block remembers the node it was asked for, or node 0; a
+ * "page" is just the block's address
+ */
+#define NUMA_NO_NODE		(-1)
+
+struct page;
+
+void *kzalloc_node(size_t size, gfp_t flags, int node);
+void *vzalloc_node(size_t size, int node);
+int page_to_nid(const struct page *page);
+
+static inline struct page *virt_to_page(const void *p)
+{
+	return (struct page *)p;
+}
+
+static inline struct page *vmalloc_to_page(const void *p)
+{
+	return (struct page *)p;
+}
+
+/* The kernel asks every registered shrinker to give memory back under
+ * pressure; here that only happens when the caller runs shim_shrink().
+ */
+#define SHRINK_STOP		(~0UL)
+#define DEFAULT_SEEKS		2
+
+struct shrink_control {
+	gfp_t		gfp_mask;
+	unsigned long	nr_to_scan;
+};
+
+struct shrinker {
+	unsigned long	(*count_objects)(struct shrinker *,
+					 struct shrink_control *);
+	unsigned long	(*scan_objects)(struct shrinker *,
+					struct shrink_control *);
+	int		seeks;
+};
+
+int register_shrinker(struct shrinker *shrinker);
+void unregister_shrinker(struct shrinker *shrinker);
+
+/* Scan up to nr objects; returns how many were freed. */
+unsigned long shim_shrink(unsigned long nr);
+
+/* ---- locking: everything runs on one thread ---- */
+
+typedef struct {
+	int	unused;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(x)	spinlock_t x
+
+static inline void spin_lock(spinlock_t *lock)
+{
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+}
+
+static inline int spin_trylock(spinlock_t *lock)
+{
+	return 1;
+}
+
+#define spin_lock_bh(lock)	spin_lock(lock)
+#define spin_unlock_bh(lock)	spin_unlock(lock)
+
+typedef struct {
+	int	counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return v->counter;
+}
+
+static inline void atomic_add(int i, atomic_t *v)
+{
+	v->counter += i;
+}
+
+static inline void atomic_sub(int i, atomic_t *v)
+{
+	v->counter -= i;
+}
+
+/* ---- lists ---- */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD(name)	struct list_head name = { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new,
+			      struct list_head *prev, struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new,
+				 struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next)
+{
+	next->prev = prev;
+	prev->next = next;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	__list_del(entry->prev, entry->next);
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move_tail(struct list_head *list,
+				  struct list_head *head)
+{
+	__list_del(list->prev, list->next);
+	list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+/* Move list's entries to the front of head and empty list. */
+static inline void list_splice_init(struct list_head *list,
+				    struct list_head *head)
+{
+	struct list_head *first = list->next, *last = list->prev;
+
+	if (list_empty(list))
+		return;
+	first->prev = head;
+	last->next = head->next;
+	head->next->prev = last;
+	head->next = first;
+	INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+/* ---- hashing ---- */
+
+#define JHASH_INITVAL		0xdeadbeef
+
+#define __jhash_final(a, b, c)			\
+{						\
+	c ^= b; c -= rol32(b, 14);		\
+	a ^= c; a -= rol32(c, 11);		\
+	b ^= a; b -= rol32(a, 25);		\
+	c ^= b; c -= rol32(b, 16);		\
+	a ^= c; a -= rol32(c, 4);		\
+	b ^= a; b -= rol32(a, 14);		\
+	c ^= b; c -= rol32(b, 24);		\
+}
+
+#define __jhash_mix(a, b, c)			\
+{						\
+	a -= c;  a ^= rol32(c, 4);  c += b;	\
+	b -= a;  b ^= rol32(a, 6);  a += c;	\
+	c -= b;  c ^= rol32(b, 8);  b += a;	\
+	a -= c;  a ^= rol32(c, 16); c += b;	\
+	b -= a;  b ^= rol32(a, 19); a += c;	\
+	c -= b;  c ^= rol32(b, 4);  b += a;	\
+}
+
+static inline u32 jhash_3words(u32 a, u32 b, u32 c, u32 initval)
+{
+	initval += JHASH_INITVAL + (3 << 2);
+	a += initval;
+	b += initval;
+	c += initval;
+	__jhash_final(a, b, c);
+	return c;
+}
+
+static inline u32 jhash_2words(u32 a, u32 b, u32 initval)
+{
+	u32 c;
+
+	initval += JHASH_INITVAL + (2 << 2);
+	a += initval;
+	b += initval;
+	c = initval;
+	__jhash_final(a, b, c);
+	return c;
+}
+
+static inline u32 jhash_1word(u32 a, u32 initval)
+{
+	u32 b, c;
+
+	initval += JHASH_INITVAL + (1 << 2);
+	a += initval;
+	b = initval;
+	c = initval;
+	__jhash_final(a, b, c);
+	return c;
+}
+
+u32 jhash2(const u32 *k, u32 length, u32 initval);
+
+/* ---- bits, rcu ---- */
+
+static inline void set_bit(int nr, unsigned long *addr)
+{
+	*addr |= 1UL << nr;
+}
+
+static inline void clear_bit(int nr, unsigned long *addr)
+{
+	*addr &= ~(1UL << nr);
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (*addr >> nr) & 1;
+}
+
+#define __rcu
+#define rcu_access_pointer(p)	(p)
+
+/* ---- network device ---- */
+
+struct sk_buff;
+
+enum netdev_state_t {
+	__LINK_STATE_START,
+};
+
+struct net_device {
+	char		name[16];
+	int		ifindex;
+	unsigned long	state;
+	unsigned int	mtu;
+	unsigned short	hard_header_len;
+
+	/* shim: told about every packet the qdisc frees as a drop */
+	void		(*drop_hook)(struct net_device *dev,
+				     struct sk_buff *skb);
+	void		*priv;
+};
+
+/* ---- sockets: only what cake_tenant() reads ---- */
+
+#define CONFIG_CGROUP_NET_CLASSID	1
+
+struct net {
+	u32		hash_mix;
+};
+
+struct sock {
+	struct net	*sk_net;
+	u32		sk_classid;
+};
+
+static inline struct net *sock_net(const struct sock *sk)
+{
+	return sk->sk_net;
+}
+
+static inline bool sk_fullsock(const struct sock *sk)
+{
+	return true;
+}
+
+static inline u32 net_hash_mix(const struct net *net)
+{
+	return net->hash_mix;
+}
+
+/* ---- sk_buff ---- */
+
+#define ETH_P_IP		0x0800
+#define ETH_P_IPV6		0x86DD
+
+#define NET_XMIT_SUCCESS	0x00
+#define NET_XMIT_DROP		0x01
+#define NET_XMIT_CN		0x02
+
+#define NETIF_F_GSO_MASK	0x00000000ffff0000ULL
+
+struct sk_buff {
+	struct sk_buff		*next;
+	struct sk_buff		*prev;
+	struct net_device	*dev;
+	struct sock		*sk;
+	int			skb_iif;
+
+	unsigned int		len;
+	unsigned int		truesize;
+	__be16			protocol;
+	u16			network_header;
+	u16			hdr_len;	/* L3+L4 headers, for GSO */
+	u16			gso_size;
+
+	char			cb[48] __aligned(8);
+
+	unsigned char		*head;
+	unsigned char		*data;
+	unsigned int		end;		/* buffer capacity */
+
+	/* shim bookkeeping, carried across GSO segmentation */
+	u64			cookie;
+	u16			sim_tin;
+	u16			sim_flow;
+	u8			sim_ecn;	/* ECN field at enqueue */
+	u8			head_frag;	/* see build_skb() */
+};
+
+struct sk_buff_head {
+	struct sk_buff	*next;
+	struct sk_buff	*prev;
+	u32		qlen;
+	spinlock_t	lock;
+};
+
+/* truesize of a packet buffer as the kernel would account it */
+unsigned int shim_truesize(unsigned int len);
+
+struct sk_buff *alloc_skb(unsigned int size, gfp_t flags);
+struct sk_buff *build_skb(void *data, unsigned int frag_size);
+void kfree_skb(struct sk_buff *skb);
+void consume_skb(struct sk_buff *skb);
+int skb_copy_bits(const struct sk_buff *skb, int offset, void *to, int len);
+
+static inline unsigned char *skb_network_header(const struct sk_buff *skb)
+{
+	return skb->data + skb->network_header;
+}
+
+static inline bool skb_is_gso(const struct sk_buff *skb)
+{
+	return skb->gso_size != 0;
+}
+
+static inline netdev_features_t netif_skb_features(struct sk_buff *skb)
+{
+	return 0;
+}
+
+struct sk_buff *skb_gso_segment(struct sk_buff *skb,
+				netdev_features_t features);
+
+/* ---- IP headers and ECN ---- */
+
+struct iphdr {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	u8	version:4,
+		ihl:4;
+#else
+	u8	ihl:4,
+		version:4;
+#endif
+	u8	tos;
+	__be16	tot_len;
+	__be16	id;
+	__be16	frag_off;
+	u8	ttl;
+	u8	protocol;
+	__sum16	check;
+	__be32	saddr;
+	__be32	daddr;
+};
+
+struct ipv6hdr {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	u8	version:4,
+		priority:4;
+#else
+	u8	priority:4,
+		version:4;
+#endif
+	u8	flow_lbl[3];
+	__be16	payload_len;
+	u8	nexthdr;
+	u8	hop_limit;
+	u8	saddr[16];
+	u8	daddr[16];
+};
+
+#define IPPROTO_TCP		6
+#define IPPROTO_UDP		17
+
+static inline struct iphdr *ip_hdr(const struct sk_buff *skb)
+{
+	return (struct iphdr *)skb_network_header(skb);
+}
+
+static inline struct ipv6hdr *ipv6_hdr(const struct sk_buff *skb)
+{
+	return (struct ipv6hdr *)skb_network_header(skb);
+}
+
+enum {
+	INET_ECN_NOT_ECT = 0,
+	INET_ECN_ECT_1 = 1,
+	INET_ECN_ECT_0 = 2,
+	INET_ECN_CE = 3,
+	INET_ECN_MASK = 3,
+};
+
+static inline u8 ipv4_get_dsfield(const struct iphdr *iph)
+{
+	return iph->tos;
+}
+
+static inline u8 ipv6_get_dsfield(const struct ipv6hdr *ipv6h)
+{
+	return ntohs(*(const __be16 *)ipv6h) >> 4;
+}
+
+static inline void ipv4_change_dsfield(struct iphdr *iph, u8 mask, u8 value)
+{
+	u32 check = ntohs(iph->check);
+	u8 dsfield;
+
+	dsfield = (iph->tos & mask) | value;
+	check += iph->tos;
+	if ((check + 1) >> 16)
+		check = (check + 1) & 0xffff;
+	check -= dsfield;
+	check += check >> 16;
+	iph->check = htons(check);
+	iph->tos = dsfield;
+}
+
+static inline void ipv6_change_dsfield(struct ipv6hdr *ipv6h, u8 mask,
+				       u8 value)
+{
+	__be16 *p = (__be16 *)ipv6h;
+
+	*p = (*p & htons((((u16)mask << 4) | 0xf00f))) |
+	     htons((u16)value << 4);
+}
+
+static inline int IP_ECN_set_ce(struct iphdr *iph)
+{
+	u32 check = iph->check;
+	u32 ecn = (iph->tos + 1) & INET_ECN_MASK;
+
+	if (!(ecn & 2))
+		return !ecn;
+
+	check += (u16)htons(0xFFFB) + (u16)htons(ecn);
+	iph->check = (__sum16)(check + (check >= 0xFFFF));
+	iph->tos |= INET_ECN_CE;
+	return 1;
+}
+
+static inline int IP6_ECN_set_ce(struct ipv6hdr *iph)
+{
+	if ((ipv6_get_dsfield(iph) & INET_ECN_MASK) == INET_ECN_NOT_ECT)
+		return 0;
+	*(__be32 *)iph |= htonl(INET_ECN_CE << 20);
+	return 1;
+}
+
+static inline int INET_ECN_set_ce(struct sk_buff *skb)
+{
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		if (skb->network_header + sizeof(struct iphdr) <= skb->len)
+			return IP_ECN_set_ce(ip_hdr(skb));
+		break;
+	case htons(ETH_P_IPV6):
+		if (skb->network_header + sizeof(struct ipv6hdr) <= skb->len)
+			return IP6_ECN_set_ce(ipv6_hdr(skb));
+		break;
+	}
+	return 0;
+}
+
+/* ---- flow dissector ---- */
+
+#define FLOW_DISSECTOR_F_STOP_AT_FLOW_LABEL	0x4
+
+struct flow_keys {
+	u32	src[4];
+	u32	dst[4];
+	u16	sport;
+	u16	dport;
+	u8	ip_proto;
+	u8	family;
+};
+
+bool skb_flow_dissect_flow_keys(const struct sk_buff *skb,
+				struct flow_keys *keys, unsigned int flags);
+u32 flow_hash_from_keys(struct flow_keys *keys);
+
+/* ---- netlink ---- */
+
+struct nlattr {
+	u16	nla_len;
+	u16	nla_type;
+};
+
+#define NLA_ALIGNTO		4
+#define NLA_ALIGN(len)		(((len) + NLA_ALIGNTO - 1) & ~(NLA_ALIGNTO - 1))
+#define NLA_HDRLEN		((int) NLA_ALIGN(sizeof(struct nlattr)))
+
+enum {
+	NLA_UNSPEC,
+	NLA_U8,
+	NLA_U16,
+	NLA_U32,
+	NLA_U64,
+	NLA_STRING,
+	NLA_FLAG,
+	NLA_MSECS,
+	NLA_NESTED,
+	NLA_NESTED_COMPAT,
+	NLA_NUL_STRING,
+	NLA_BINARY,
+	NLA_S8,
+	NLA_S16,
+	NLA_S32,
+	NLA_S64,
+};
+
+struct nla_policy {
+	u16	type;
+	u16	len;
+};
+
+enum {
+	TCA_UNSPEC,
+	TCA_KIND,
+	TCA_OPTIONS,
+	TCA_STATS,
+	TCA_XSTATS,
+};
+
+static inline void *nla_data(const struct nlattr *nla)
+{
+	return (char *)nla + NLA_HDRLEN;
+}
+
+static inline int nla_len(const struct nlattr *nla)
+{
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+static inline u32 nla_get_u32(const struct nlattr *nla)
+{
+	u32 v;
+
+	memcpy(&v, nla_data(nla), sizeof(v));
+	return v;
+}
+
+static inline s32 nla_get_s32(const struct nlattr *nla)
+{
+	return (s32)nla_get_u32(nla);
+}
+
+int nla_parse_nested(struct nlattr **tb, int maxtype,
+		     const struct nlattr *nla,
+		     const struct nla_policy *policy);
+int nla_put(struct sk_buff *skb, int attrtype, int attrlen,
+	    const void *data);
+struct nlattr *nla_nest_start(struct sk_buff *skb, int attrtype);
+int nla_nest_end(struct sk_buff *skb, struct nlattr *start);
+
+static inline int nla_put_u32(struct sk_buff *skb, int attrtype, u32 value)
+{
+	return nla_put(skb, attrtype, sizeof(u32), &value);
+}
+
+/* ---- qdisc core ---- */
+
+#define TCQ_F_CAN_BYPASS	4
+
+struct gnet_stats_basic_packed {
+	u64	bytes;
+	u32	packets;
+};
+
+struct gnet_stats_queue {
+	u32	qlen;
+	u32	backlog;
+	u32	drops;
+	u32	requeues;
+	u32	overlimits;
+};
+
+/* stats are copied into caller-supplied buffers instead of a netlink dump */
+struct gnet_dump {
+	void			*xstats;
+	int			xstats_len;
+	struct gnet_stats_queue	qstats;
+};
+
+int gnet_stats_copy_app(struct gnet_dump *d, void *st, int len);
+int gnet_stats_copy_queue(struct gnet_dump *d, void *cpu_q,
+			  struct gnet_stats_queue *q, u32 qlen);
+
+struct Qdisc;
+struct tcf_proto;
+struct tcmsg {
+	u8	tcm_family;
+	int	tcm_ifindex;
+	u32	tcm_handle;
+	u32	tcm_parent;
+	u32	tcm_info;
+};
+
+struct qdisc_walker {
+	int	stop;
+	int	skip;
+	int	count;
+	int	(*fn)(struct Qdisc *, unsigned long cl, struct qdisc_walker *);
+};
+
+struct Qdisc_class_ops {
+	struct Qdisc	*(*leaf)(struct Qdisc *, unsigned long cl);
+	unsigned long	(*get)(struct Qdisc *, u32 classid);
+	void		(*put)(struct Qdisc *, unsigned long);
+	struct tcf_proto **(*tcf_chain)(struct Qdisc *, unsigned long);
+	unsigned long	(*bind_tcf)(struct Qdisc *, unsigned long, u32 classid);
+	void		(*unbind_tcf)(struct Qdisc *, unsigned long);
+	int		(*dump)(struct Qdisc *, unsigned long, struct sk_buff *,
+				struct tcmsg *);
+	int		(*dump_stats)(struct Qdisc *, unsigned long,
+				      struct gnet_dump *);
+	void		(*walk)(struct Qdisc *, struct qdisc_walker *arg);
+};
+
+struct Qdisc_ops {
+	const struct Qdisc_class_ops *cl_ops;
+	char		id[16];
+	int		priv_size;
+	int		(*enqueue)(struct sk_buff *, struct Qdisc *);
+	struct sk_buff	*(*dequeue)(struct Qdisc *);
+	struct sk_buff	*(*peek)(struct Qdisc *);
+	unsigned int	(*drop)(struct Qdisc *);
+	int		(*init)(struct Qdisc *, struct nlattr *arg);
+	void		(*reset)(struct Qdisc *);
+	void		(*destroy)(struct Qdisc *);
+	int		(*change)(struct Qdisc *, struct nlattr *arg);
+	int		(*dump)(struct Qdisc *, struct sk_buff *);
+	int		(*dump_stats)(struct Qdisc *, struct gnet_dump *);
+	struct module	*owner;
+};
+
+struct netdev_queue {
+	struct Qdisc __rcu		*qdisc;
+	struct Qdisc			*qdisc_sleeping;
+	int				numa_node;
+};
+
+static inline int netdev_queue_numa_node_read(const struct netdev_queue *q)
+{
+	return q ? q->numa_node : NUMA_NO_NODE;
+}
+
+struct Qdisc {
+	const struct Qdisc_ops		*ops;
+	u32				handle;
+	u32				parent;
+	unsigned int			flags;
+	u32				limit;
+	unsigned long			state;
+	struct net_device		*dev;
+	struct netdev_queue		*dev_queue;
+	struct sk_buff_head		q;
+	struct gnet_stats_basic_packed	bstats;
+	struct gnet_stats_queue		qstats;
+	struct sk_buff			*gso_skb;
+
+	/* shim: packets reported gone via qdisc_tree_decrease_qlen() */
+	u64				tree_qlen_dec;
+};
+
+#define QDISC_ALIGNTO		64
+#define QDISC_ALIGN(len)	(((len) + QDISC_ALIGNTO - 1) & \
+				 ~(QDISC_ALIGNTO - 1))
+
+static inline void *qdisc_priv(struct Qdisc *q)
+{
+	return (char *)q + QDISC_ALIGN(sizeof(struct Qdisc));
+}
+
+static inline struct net_device *qdisc_dev(const struct Qdisc *qdisc)
+{
+	return qdisc->dev;
+}
+
+static inline bool netif_running(const struct net_device *dev)
+{
+	return test_bit(__LINK_STATE_START, &dev->state);
+}
+
+enum qdisc_state_t {
+	__QDISC_STATE_SCHED,
+	__QDISC_STATE_DEACTIVATED,
+};
+
+/* shim: the caller sees the bit and polls the qdisc */
+static inline void __netif_schedule(struct Qdisc *q)
+{
+	set_bit(__QDISC_STATE_SCHED, &q->state);
+}
+
+static inline unsigned int psched_mtu(const struct net_device *dev)
+{
+	return dev->mtu + dev->hard_header_len;
+}
+
+struct qdisc_skb_cb {
+	unsigned int		pkt_len;
+	u16			slave_dev_queue_mapping;
+	u16			tc_classid;
+#define QDISC_CB_PRIV_LEN 20
+	unsigned char		data[QDISC_CB_PRIV_LEN];
+};
+
+static inline struct qdisc_skb_cb *qdisc_skb_cb(const struct sk_buff *skb)
+{
+	return (struct qdisc_skb_cb *)skb->cb;
+}
+
+static inline void qdisc_cb_private_validate(const struct sk_buff *skb,
+					     int sz)
+{
+	BUILD_BUG_ON(sizeof(skb->cb) < sizeof(struct qdisc_skb_cb));
+	BUG_ON(sz > QDISC_CB_PRIV_LEN);
+}
+
+static inline unsigned int qdisc_pkt_len(const struct sk_buff *skb)
+{
+	return qdisc_skb_cb(skb)->pkt_len;
+}
+
+static inline void qdisc_qstats_drop(struct Qdisc *sch)
+{
+	sch->qstats.drops++;
+}
+
+static inline int qdisc_drop(struct sk_buff *skb, struct Qdisc *sch)
+{
+	kfree_skb(skb);
+	qdisc_qstats_drop(sch);
+	return NET_XMIT_DROP;
+}
+
+static inline int qdisc_reshape_fail(struct sk_buff *skb, struct Qdisc *sch)
+{
+	qdisc_qstats_drop(sch);
+	kfree_skb(skb);
+	return NET_XMIT_DROP;
+}
+
+static inline void qdisc_tree_decrease_qlen(struct Qdisc *sch,
+					    unsigned int n)
+{
+	sch->tree_qlen_dec += n;
+}
+
+static inline void qdisc_bstats_update(struct Qdisc *sch,
+				       const struct sk_buff *skb)
+{
+	sch->bstats.bytes += qdisc_pkt_len(skb);
+	sch->bstats.packets++;
+}
+
+static inline struct sk_buff *qdisc_peek_dequeued(struct Qdisc *sch)
+{
+	if (!sch->gso_skb) {
+		sch->gso_skb = sch->ops->dequeue(sch);
+		if (sch->gso_skb)
+			sch->q.qlen++;
+	}
+	return sch->gso_skb;
+}
+
+static inline spinlock_t *qdisc_lock(struct Qdisc *qdisc)
+{
+	return &qdisc->q.lock;
+}
+
+/* no hierarchy: every qdisc is its own root */
+static inline spinlock_t *qdisc_root_sleeping_lock(struct Qdisc *qdisc)
+{
+	return qdisc_lock(qdisc);
+}
+
+static inline void sch_tree_lock(const struct Qdisc *q)
+{
+}
+
+static inline void sch_tree_unlock(const struct Qdisc *q)
+{
+}
+
+struct hrtimer {
+	bool		queued;
+};
+
+static inline bool hrtimer_is_queued(const struct hrtimer *timer)
+{
+	return timer->queued;
+}
+
+/* The watchdog never fires by itself; the caller polls the qdisc once
+ * expires has passed, and cancels the watchdog as its firing would.
+ */
+struct qdisc_watchdog {
+	u64		expires;
+	struct hrtimer	timer;
+	struct Qdisc	*qdisc;
+};
+
+static inline void qdisc_watchdog_init(struct qdisc_watchdog *wd,
+				       struct Qdisc *qdisc)
+{
+	wd->expires = 0;
+	wd->timer.queued = false;
+	wd->qdisc = qdisc;
+}
+
+static inline void qdisc_watchdog_schedule_ns(struct qdisc_watchdog *wd,
+					      u64 expires, bool throttle)
+{
+	const struct netdev_queue *txq = wd->qdisc->dev_queue;
+
+	/* as the kernel, while the root is deactivated by a graft; qdiscs
+	 * made without a TX queue (cakebench) have no root to check
+	 */
+	if (txq && txq->qdisc_sleeping &&
+	    test_bit(__QDISC_STATE_DEACTIVATED, &txq->qdisc_sleeping->state))
+		return;
+
+	wd->expires = expires;
+	wd->timer.queued = true;
+}
+
+static inline void qdisc_watchdog_cancel(struct qdisc_watchdog *wd)
+{
+	wd->timer.queued = false;
+}
+
+int register_qdisc(struct Qdisc_ops *qops);
+int unregister_qdisc(struct Qdisc_ops *qops);
+
+/* ---- tracepoints compile to nothing ---- */
+
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+
+#endif /* __CAKE_KSHIM_H */
@@ -0,0 +1,3 @@
+/* userspace shim: sch_cake.c is built as if for this kernel */
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(4, 4, 0)
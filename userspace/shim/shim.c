@@ -0,0 +1,531 @@
+/*
+ * Out-of-line parts of the userspace kernel shim.  See kshim.h.
+ */
+
+#include <time.h>
+#include "kshim.h"
+
+u64 shim_now;
+u64 shim_realtime_base;
+struct shim_mem_stats shim_mem;
+size_t shim_kmalloc_max = KMALLOC_MAX_SIZE;
+
+/* ---- randomness: xorshift32, so that runs are repeatable ---- */
+
+static u32 shim_rnd_state = 2463534242U;
+static u32 shim_hashrnd = 0x5eed1e55U;
+
+void shim_seed(u32 seed)
+{
+	shim_rnd_state = seed ? seed : 2463534242U;
+	shim_hashrnd = prandom_u32();
+}
+
+u32 prandom_u32(void)
+{
+	u32 x = shim_rnd_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return shim_rnd_state = x;
+}
+
+cycles_t get_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (cycles_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+/* ---- memory: remember which allocator each block came from ---- */
+
+struct shim_block {
+	size_t	size;
+	size_t	footprint;
+	bool	vmalloc;
+	int	node;
+} __aligned(16);
+
+static size_t shim_footprint(size_t size, bool vmalloc)
+{
+	size_t n = 8;
+
+	if (vmalloc)
+		return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	while (n < size)
+		n <<= 1;
+	return n;
+}
+
+static void *shim_alloc(size_t size, bool vmalloc, int node)
+{
+	struct shim_block *b = calloc(1, sizeof(*b) + size);
+
+	if (!b)
+		return NULL;
+
+	b->size = size;
+	b->footprint = shim_footprint(size, vmalloc);
+	b->vmalloc = vmalloc;
+	b->node = node == NUMA_NO_NODE ? 0 : node;
+	if (vmalloc) {
+		shim_mem.vmalloc_bytes += size;
+		shim_mem.vmalloc_pages += b->footprint;
+	} else {
+		shim_mem.kmalloc_bytes += size;
+		shim_mem.kmalloc_slab  += b->footprint;
+	}
+	return b + 1;
+}
+
+static void shim_free(const void *p)
+{
+	struct shim_block *b;
+
+	if (!p)
+		return;
+
+	b = (struct shim_block *)p - 1;
+	if (b->vmalloc) {
+		shim_mem.vmalloc_bytes -= b->size;
+		shim_mem.vmalloc_pages -= b->footprint;
+	} else {
+		shim_mem.kmalloc_bytes -= b->size;
+		shim_mem.kmalloc_slab  -= b->footprint;
+	}
+	free(b);
+}
+
+void *kzalloc_node(size_t size, gfp_t flags, int node)
+{
+	if (size > shim_kmalloc_max) {
+		shim_mem.kmalloc_fails++;
+		return NULL;
+	}
+	return shim_alloc(size, false, node);
+}
+
+void *kzalloc(size_t size, gfp_t flags)
+{
+	return kzalloc_node(size, flags, NUMA_NO_NODE);
+}
+
+void *vzalloc_node(size_t size, int node)
+{
+	return shim_alloc(size, true, node);
+}
+
+void *vzalloc(size_t size)
+{
+	return vzalloc_node(size, NUMA_NO_NODE);
+}
+
+int page_to_nid(const struct page *page)
+{
+	return ((const struct shim_block *)page - 1)->node;
+}
+
+bool is_vmalloc_addr(const void *p)
+{
+	return p && ((const struct shim_block *)p - 1)->vmalloc;
+}
+
+void kfree(const void *p)
+{
+	shim_free(p);
+}
+
+void vfree(const void *p)
+{
+	shim_free(p);
+}
+
+void kvfree(const void *p)
+{
+	shim_free(p);
+}
+
+/* ---- memory pressure ---- */
+
+static struct shrinker *shim_shrinker;
+
+int register_shrinker(struct shrinker *shrinker)
+{
+	shim_shrinker = shrinker;
+	return 0;
+}
+
+void unregister_shrinker(struct shrinker *shrinker)
+{
+	if (shim_shrinker == shrinker)
+		shim_shrinker = NULL;
+}
+
+unsigned long shim_shrink(unsigned long nr)
+{
+	struct shrink_control sc = { .gfp_mask = GFP_KERNEL };
+	unsigned long freed;
+
+	if (!shim_shrinker)
+		return 0;
+
+	sc.nr_to_scan = min_t(unsigned long, nr,
+			      shim_shrinker->count_objects(shim_shrinker,
+							   &sc));
+	if (!sc.nr_to_scan)
+		return 0;
+
+	freed = shim_shrinker->scan_objects(shim_shrinker, &sc);
+	return freed == SHRINK_STOP ? 0 : freed;
+}
+
+/* ---- sk_buff ---- */
+
+#define SKB_DATA_ALIGN(x)	(((x) + 63) & ~63U)
+#define SKB_SHINFO_SIZE		320
+#define SKB_STRUCT_SIZE		256
+#define NET_SKB_PAD		64
+#define POISON_FREE		0x6b	/* as in linux/poison.h */
+
+unsigned int shim_truesize(unsigned int len)
+{
+	unsigned int data = SKB_DATA_ALIGN(NET_SKB_PAD + len) +
+			    SKB_SHINFO_SIZE;
+	unsigned int bucket = 64;
+
+	/* kmalloc rounds the data area up to a power of two */
+	while (bucket < data)
+		bucket <<= 1;
+	return bucket + SKB_STRUCT_SIZE;
+}
+
+struct sk_buff *alloc_skb(unsigned int size, gfp_t flags)
+{
+	struct sk_buff *skb = calloc(1, sizeof(*skb));
+
+	if (!skb)
+		return NULL;
+
+	skb->head = calloc(1, size ? size : 1);
+	if (!skb->head) {
+		free(skb);
+		return NULL;
+	}
+	skb->data = skb->head;
+	skb->end = size;
+	skb->truesize = shim_truesize(size);
+	return skb;
+}
+
+/* Wrap a buffer the caller owns; freeing the skb leaves it alone. */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct sk_buff *skb = calloc(1, sizeof(*skb));
+
+	if (!skb)
+		return NULL;
+
+	skb->head = data;
+	skb->data = data;
+	skb->end = frag_size;
+	skb->truesize = shim_truesize(frag_size);
+	skb->head_frag = 1;
+	return skb;
+}
+
+/* Poisoned as slub_debug would, so that a read after the free, e.g. of
+ * skb->sk, goes wrong rather than quietly seeing the old value.
+ */
+static void shim_free_skb(struct sk_buff *skb)
+{
+	if (!skb->head_frag)
+		free(skb->head);
+	memset(skb, POISON_FREE, sizeof(*skb));
+	/* or the compiler drops the memset as a dead store */
+	__asm__ __volatile__("" : : "r" (skb) : "memory");
+	free(skb);
+}
+
+void kfree_skb(struct sk_buff *skb)
+{
+	if (!skb)
+		return;
+	if (skb->dev && skb->dev->drop_hook)
+		skb->dev->drop_hook(skb->dev, skb);
+	shim_free_skb(skb);
+}
+
+void consume_skb(struct sk_buff *skb)
+{
+	if (skb)
+		shim_free_skb(skb);
+}
+
+int skb_copy_bits(const struct sk_buff *skb, int offset, void *to, int len)
+{
+	if (offset < 0 || len < 0 || (unsigned int)(offset + len) > skb->len)
+		return -EINVAL;
+	memcpy(to, skb->data + offset, len);
+	return 0;
+}
+
+/* Split a GSO packet into segments of hdr_len + gso_size bytes, copying
+ * the headers into each.  Lengths in the headers are left alone; only the
+ * sizes matter to the qdisc.
+ */
+struct sk_buff *skb_gso_segment(struct sk_buff *skb,
+				netdev_features_t features)
+{
+	unsigned int hlen = skb->network_header + skb->hdr_len;
+	unsigned int off = hlen;
+	struct sk_buff *segs = NULL, **tail = &segs;
+
+	if (!skb->gso_size || hlen >= skb->len)
+		return ERR_PTR(-EINVAL);
+
+	while (off < skb->len) {
+		unsigned int plen = min(skb->len - off,
+					(unsigned int)skb->gso_size);
+		struct sk_buff *seg = alloc_skb(hlen + plen, GFP_ATOMIC);
+
+		if (!seg) {
+			while (segs) {
+				seg = segs->next;
+				shim_free_skb(segs);
+				segs = seg;
+			}
+			return ERR_PTR(-ENOMEM);
+		}
+
+		memcpy(seg->data, skb->data, hlen);
+		memcpy(seg->data + hlen, skb->data + off, plen);
+		seg->len            = hlen + plen;
+		seg->dev            = skb->dev;
+		seg->skb_iif        = skb->skb_iif;
+		seg->protocol       = skb->protocol;
+		seg->network_header = skb->network_header;
+		seg->hdr_len        = skb->hdr_len;
+		seg->cookie         = skb->cookie;
+		seg->sim_tin        = skb->sim_tin;
+		seg->sim_flow       = skb->sim_flow;
+		seg->sim_ecn        = skb->sim_ecn;
+		memcpy(seg->cb, skb->cb, sizeof(seg->cb));
+
+		*tail = seg;
+		tail = &seg->next;
+		off += plen;
+	}
+	return segs;
+}
+
+/* ---- flow dissector: addresses and ports of TCP/UDP over IPv4/IPv6 ---- */
+
+bool skb_flow_dissect_flow_keys(const struct sk_buff *skb,
+				struct flow_keys *keys, unsigned int flags)
+{
+	const unsigned char *nh = skb_network_header(skb);
+	unsigned int avail = skb->len - skb->network_header;
+	unsigned int thoff;
+	bool ports = true;
+
+	memset(keys, 0, sizeof(*keys));
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP): {
+		const struct iphdr *iph = (const struct iphdr *)nh;
+
+		if (avail < sizeof(*iph))
+			return false;
+		keys->family   = 4;
+		keys->ip_proto = iph->protocol;
+		keys->src[0]   = iph->saddr;
+		keys->dst[0]   = iph->daddr;
+		thoff = iph->ihl * 4;
+		if (iph->frag_off & htons(0x1fff))
+			ports = false;
+		break;
+	}
+	case htons(ETH_P_IPV6): {
+		const struct ipv6hdr *ip6h = (const struct ipv6hdr *)nh;
+
+		if (avail < sizeof(*ip6h))
+			return false;
+		keys->family   = 6;
+		keys->ip_proto = ip6h->nexthdr;
+		memcpy(keys->src, ip6h->saddr, sizeof(keys->src));
+		memcpy(keys->dst, ip6h->daddr, sizeof(keys->dst));
+		thoff = sizeof(*ip6h);
+		break;
+	}
+	default:
+		return false;
+	}
+
+	if (ports && thoff + 4 <= avail &&
+	    (keys->ip_proto == IPPROTO_TCP || keys->ip_proto == IPPROTO_UDP)) {
+		memcpy(&keys->sport, nh + thoff, 2);
+		memcpy(&keys->dport, nh + thoff + 2, 2);
+	}
+	return true;
+}
+
+/* Like the kernel, order the endpoints so both directions hash alike. */
+u32 flow_hash_from_keys(struct flow_keys *keys)
+{
+	int addr = memcmp(keys->dst, keys->src, sizeof(keys->src));
+	u32 hash;
+
+	if (addr < 0 || (addr == 0 && keys->dport < keys->sport)) {
+		u32 t[4];
+		u16 p;
+
+		memcpy(t, keys->src, sizeof(t));
+		memcpy(keys->src, keys->dst, sizeof(t));
+		memcpy(keys->dst, t, sizeof(t));
+		p = keys->sport;
+		keys->sport = keys->dport;
+		keys->dport = p;
+	}
+
+	hash = jhash2((const u32 *)keys, sizeof(*keys) / sizeof(u32),
+		      shim_hashrnd);
+	return hash ? hash : 1;
+}
+
+u32 jhash2(const u32 *k, u32 length, u32 initval)
+{
+	u32 a, b, c;
+
+	a = b = c = JHASH_INITVAL + (length << 2) + initval;
+
+	while (length > 3) {
+		a += k[0];
+		b += k[1];
+		c += k[2];
+		__jhash_mix(a, b, c);
+		length -= 3;
+		k += 3;
+	}
+
+	switch (length) {
+	case 3:
+		c += k[2];
+		/* fall through */
+	case 2:
+		b += k[1];
+		/* fall through */
+	case 1:
+		a += k[0];
+		__jhash_final(a, b, c);
+		break;
+	case 0:
+		break;
+	}
+	return c;
+}
+
+/* ---- netlink ---- */
+
+int nla_parse_nested(struct nlattr **tb, int maxtype,
+		     const struct nlattr *nla,
+		     const struct nla_policy *policy)
+{
+	const char *pos = nla_data(nla);
+	int rem = nla_len(nla);
+
+	memset(tb, 0, sizeof(struct nlattr *) * (maxtype + 1));
+
+	while (rem >= NLA_HDRLEN) {
+		const struct nlattr *a = (const struct nlattr *)pos;
+		int type = a->nla_type & 0x3fff;
+
+		if (a->nla_len < NLA_HDRLEN || a->nla_len > rem)
+			break;
+
+		if (type > 0 && type <= maxtype) {
+			u16 pt = policy ? policy[type].type : NLA_UNSPEC;
+
+			if ((pt == NLA_U32 || pt == NLA_S32) &&
+			    nla_len(a) < (int)sizeof(u32))
+				return -EINVAL;
+			tb[type] = (struct nlattr *)a;
+		}
+
+		pos += NLA_ALIGN(a->nla_len);
+		rem -= NLA_ALIGN(a->nla_len);
+	}
+	return 0;
+}
+
+int nla_put(struct sk_buff *skb, int attrtype, int attrlen, const void *data)
+{
+	unsigned int total = NLA_ALIGN(NLA_HDRLEN + attrlen);
+	struct nlattr *nla;
+
+	if (skb->len + total > skb->end)
+		return -EINVAL;
+
+	nla = (struct nlattr *)(skb->data + skb->len);
+	memset(nla, 0, total);
+	nla->nla_type = attrtype;
+	nla->nla_len = NLA_HDRLEN + attrlen;
+	memcpy(nla_data(nla), data, attrlen);
+	skb->len += total;
+	return 0;
+}
+
+struct nlattr *nla_nest_start(struct sk_buff *skb, int attrtype)
+{
+	struct nlattr *start = (struct nlattr *)(skb->data + skb->len);
+
+	if (nla_put(skb, attrtype, 0, NULL))
+		return NULL;
+	return start;
+}
+
+int nla_nest_end(struct sk_buff *skb, struct nlattr *start)
+{
+	start->nla_len = (skb->data + skb->len) - (unsigned char *)start;
+	return skb->len;
+}
+
+/* ---- stats ---- */
+
+int gnet_stats_copy_app(struct gnet_dump *d, void *st, int len)
+{
+	if (d->xstats)
+		memcpy(d->xstats, st, min(len, d->xstats_len));
+	d->xstats_len = len;
+	return 0;
+}
+
+int gnet_stats_copy_queue(struct gnet_dump *d, void *cpu_q,
+			  struct gnet_stats_queue *q, u32 qlen)
+{
+	d->qstats = *q;
+	d->qstats.qlen = qlen;
+	return 0;
+}
+
+/* ---- qdisc registry ---- */
+
+static struct Qdisc_ops *shim_qdisc_ops;
+
+int register_qdisc(struct Qdisc_ops *qops)
+{
+	shim_qdisc_ops = qops;
+	return 0;
+}
+
+int unregister_qdisc(struct Qdisc_ops *qops)
+{
+	if (shim_qdisc_ops == qops)
+		shim_qdisc_ops = NULL;
+	return 0;
+}
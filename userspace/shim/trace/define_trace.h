@@ -0,0 +1 @@
+/* userspace shim: tracepoints are empty inlines, nothing to create */
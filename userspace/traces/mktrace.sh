@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# mktrace.sh - synthetic variable-capacity link traces for cakesim -T
+#
+# Traces are in Mahimahi format: one line per packet delivery opportunity,
+# each the time in milliseconds at which the link can carry one 1500 byte
+# packet.  Several lines may share a millisecond; the trace repeats once
+# its last line has been reached.
+#
+#	traces/mktrace.sh lte-driving 30 1 > traces/lte-driving.trace
+#
+# Models:
+#   lte-driving     1-40 Mbit random walk every 100 ms, with handover gaps
+#   lte-stationary  ~20 Mbit with slow fading and 1 ms TTI grants
+#   wifi            ~28 Mbit in A-MPDU bursts separated by contention gaps
+#
+# The shipped traces were made with mawk; other awks draw different
+# random numbers, so regenerating them gives similar but not equal files.
+
+set -e
+
+usage() {
+	echo "usage: $0 lte-driving|lte-stationary|wifi seconds [seed]" >&2
+	exit 2
+}
+
+[ $# -ge 2 ] || usage
+case $1 in
+lte-driving|lte-stationary|wifi) ;;
+*) usage ;;
+esac
+
+awk -v model="$1" -v secs="$2" -v seed="${3:-1}" '
+# Poisson-distributed count with the given mean, by inversion
+function poisson(mean,    k, p, l) {
+	l = exp(-mean)
+	k = 0
+	p = rand()
+	while (p > l) {
+		k++
+		p *= rand()
+	}
+	return k
+}
+
+# opportunities per ms for a rate in Mbit
+function per_ms(mbit) {
+	return mbit * 1e6 / 8 / 1500 / 1000
+}
+
+function emit(ms, n,    i) {
+	for (i = 0; i < n; i++)
+		print ms
+}
+
+BEGIN {
+	srand(seed)
+	end = secs * 1000
+
+	if (model == "lte-driving") {
+		mbit = 10
+		gap = 0
+		for (ms = 1; ms <= end; ms++) {
+			if (ms % 100 == 0) {
+				# log-space walk, pulled back towards 12 Mbit
+				step = 0.1 * log(12 / mbit) + (rand() - 0.5) * 0.8
+				mbit *= exp(step)
+				if (mbit < 1) mbit = 1
+				if (mbit > 40) mbit = 40
+				if (rand() < 0.01)
+					gap = 200 + int(rand() * 300)
+			}
+			if (gap > 0) {
+				gap--
+				continue
+			}
+			emit(ms, poisson(per_ms(mbit)))
+		}
+	} else if (model == "lte-stationary") {
+		for (ms = 1; ms <= end; ms++) {
+			mbit = 20 * (1 + 0.3 * sin(2 * 3.14159265 * ms / 4000))
+			emit(ms, poisson(per_ms(mbit)))
+		}
+	} else {
+		# a burst every few ms; contention stretches the gap between
+		ms = 1
+		while (ms <= end) {
+			burst = 8 + int(rand() * 24)
+			emit(ms, burst)
+			ms += 1 + int(burst * 1500 * 8 / 30e3 * (0.5 + rand()))
+		}
+	}
+}'
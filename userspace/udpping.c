@@ -0,0 +1,144 @@
+/*
+ * udpping - UDP round-trip probe for the namespace benchmarks
+ *
+ *	udpping -s [-p port]				echo server
+ *	udpping [-p port] [-Q tos] [-i ms] [-t secs] host	client
+ *
+ * The client sends a small timestamped datagram every interval with the
+ * given TOS byte and prints each RTT in milliseconds, one per line, as
+ * replies arrive.  Lost probes are counted on stderr at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "util.h"
+
+struct probe {
+	uint64_t	seq;
+	uint64_t	sent_ns;
+};
+
+static int server(int fd)
+{
+	char buf[2048];
+
+	for (;;) {
+		struct sockaddr_storage from;
+		socklen_t flen = sizeof(from);
+		ssize_t len = recvfrom(fd, buf, sizeof(buf), 0,
+				       (struct sockaddr *)&from, &flen);
+
+		if (len > 0)
+			sendto(fd, buf, len, 0, (struct sockaddr *)&from,
+			       flen);
+	}
+	return 0;
+}
+
+static int client(int fd, const struct sockaddr_in *to, int tos,
+		  double interval_ms, double secs)
+{
+	uint64_t interval = interval_ms * 1e6, start = now_ns();
+	uint64_t end = start + secs * 1e9, next = start;
+	uint64_t sent = 0, received = 0;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	if (tos && setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)))
+		perror("IP_TOS");
+
+	/* keep listening one second past the last probe for stragglers */
+	while (now_ns() < end + 1000000000ULL) {
+		uint64_t t = now_ns();
+		int timeout;
+
+		if (t >= next && t < end) {
+			struct probe p = { .seq = sent++, .sent_ns = t };
+
+			sendto(fd, &p, sizeof(p), 0,
+			       (const struct sockaddr *)to, sizeof(*to));
+			next += interval;
+		}
+
+		timeout = t < end ? (int)((next > t ? next - t : 0) / 1000000)
+				  : 100;
+		if (poll(&pfd, 1, timeout) > 0) {
+			struct probe p;
+
+			if (recv(fd, &p, sizeof(p), 0) == sizeof(p)) {
+				printf("%.3f\n", (now_ns() - p.sent_ns) / 1e6);
+				received++;
+			}
+		}
+	}
+	fflush(stdout);
+	fprintf(stderr, "udpping: %llu sent, %llu lost\n",
+		(unsigned long long)sent,
+		(unsigned long long)(sent - received));
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: udpping -s [-p port]\n"
+		"       udpping [-p port] [-Q tos] [-i ms] [-t secs] host\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in sa = { .sin_family = AF_INET };
+	double interval = 100, secs = 10;
+	int c, fd, srv = 0, port = 7007, tos = 0;
+
+	while ((c = getopt(argc, argv, "sp:Q:i:t:h")) != -1) {
+		switch (c) {
+		case 's':
+			srv = 1;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'Q':
+			tos = strtol(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 't':
+			secs = atof(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (srv != (optind == argc) || interval <= 0)
+		usage();
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	sa.sin_port = htons(port);
+	if (srv) {
+		sa.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+			perror("bind");
+			return 1;
+		}
+		return server(fd);
+	}
+
+	if (inet_pton(AF_INET, argv[optind], &sa.sin_addr) != 1)
+		usage();
+	return client(fd, &sa, tos, interval, secs);
+}
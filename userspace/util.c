@@ -0,0 +1,164 @@
+/*
+ * Helpers shared by the userspace tools, see util.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <math.h>
+#include <netinet/in.h>
+#include "util.h"
+
+const char * const diffserv_names[CAKE_DIFFSERV_NAMES] = {
+	[1] = "besteffort", "precedence", "diffserv8", "diffserv4",
+};
+const char * const flow_names[CAKE_FLOW_NAMES] = {
+	"none", "srchost", "dsthost", "hosts", "flows",
+	"dual-srchost", "dual-dsthost", "triple-isolate", "tenants",
+};
+
+int lookup(const char *name, const char * const *names, int n)
+{
+	char *end;
+	long v;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (names[i] && !strcmp(name, names[i]))
+			return i;
+	v = strtol(name, &end, 10);
+	return *name && !*end && v >= 0 && v < 0x10000 ? v : -1;
+}
+
+double parse_rate(const char *s)
+{
+	static const struct { const char *sfx; double mul; } units[] = {
+		{ "", 1 }, { "k", 1e3 }, { "m", 1e6 }, { "g", 1e9 },
+		{ "bit", 1 }, { "kbit", 1e3 }, { "mbit", 1e6 },
+		{ "gbit", 1e9 }, { "bps", 8 }, { "kbps", 8e3 },
+		{ "mbps", 8e6 }, { "gbps", 8e9 },
+	};
+	char *end;
+	double v = strtod(s, &end);
+	unsigned int i;
+
+	if (end == s)
+		return -1;
+	for (i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+		if (!strcasecmp(end, units[i].sfx))
+			return v < 0 ? -1 : v * units[i].mul;
+	return -1;
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ---- random numbers ---- */
+
+static uint32_t rnd_state = 1;
+
+void rnd_seed(uint32_t seed)
+{
+	rnd_state = seed ? seed : 1;
+}
+
+uint32_t rnd(void)
+{
+	uint32_t x = rnd_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return rnd_state = x;
+}
+
+double rnd_exp(double mean)
+{
+	return -mean * log((rnd() + 1.0) / 4294967297.0);
+}
+
+/* ---- samples ---- */
+
+void samples_add(struct samples *s, uint32_t v)
+{
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->v = realloc(s->v, s->cap * sizeof(*s->v));
+		if (!s->v) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void samples_sort(struct samples *s)
+{
+	if (s->n)
+		qsort(s->v, s->n, sizeof(*s->v), cmp_u32);
+}
+
+uint32_t percentile(const struct samples *s, double p)
+{
+	if (!s->n)
+		return 0;
+	return s->v[(size_t)(p * (s->n - 1) + 0.5)];
+}
+
+/* ---- packets ---- */
+
+unsigned int build_pkt(uint8_t *p, const struct tuple *t, uint8_t tos,
+		       unsigned int len)
+{
+	unsigned int hl = t->v6 ? 40 : 20;
+
+	memset(p, 0, len);
+	if (t->v6) {
+		p[0] = 0x60 | tos >> 4;
+		p[1] = tos << 4;
+		p[4] = (len - 40) >> 8;
+		p[5] = len - 40;
+		p[6] = t->proto;
+		p[7] = 64;
+		memcpy(p + 8, t->src, 16);
+		memcpy(p + 24, t->dst, 16);
+	} else {
+		p[0] = 0x45;
+		p[1] = tos;
+		p[2] = len >> 8;
+		p[3] = len;
+		p[8] = 64;
+		p[9] = t->proto;
+		memcpy(p + 12, t->src, 4);
+		memcpy(p + 16, t->dst, 4);
+	}
+	p[hl]     = t->sport >> 8;
+	p[hl + 1] = t->sport;
+	p[hl + 2] = t->dport >> 8;
+	p[hl + 3] = t->dport;
+	if (t->proto == IPPROTO_TCP)
+		p[hl + 12] = 0x50;		/* data offset */
+	return len;
+}
+
+void tuple_v4(uint8_t *addr, uint32_t host)
+{
+	addr[0] = 10;
+	addr[1] = host >> 16;
+	addr[2] = host >> 8;
+	addr[3] = host;
+}
@@ -0,0 +1,69 @@
+/*
+ * Helpers shared by the userspace tools: mode names, option parsing,
+ * the random generator and latency samples, and building test packets.
+ */
+
+#ifndef __UTIL_H
+#define __UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Indexed by the diffserv and flow mode enums in sch_cake.c, which
+ * libcake.c checks these sizes against.
+ */
+#define CAKE_DIFFSERV_NAMES	5
+#define CAKE_FLOW_NAMES		9
+
+extern const char * const diffserv_names[CAKE_DIFFSERV_NAMES];
+extern const char * const flow_names[CAKE_FLOW_NAMES];
+
+/* Index of name in names[], or name itself if it is a plain number;
+ * -1 if it is neither.
+ */
+int lookup(const char *name, const char * const *names, int n);
+
+/* tc-style rate in bits/s, e.g. 64k, 20mbit, 1.5gbit or 10mbps; -1 on
+ * an unknown unit.
+ */
+double parse_rate(const char *s);
+
+/* CLOCK_MONOTONIC */
+uint64_t now_ns(void);
+
+/* xorshift32; the state must not be 0, so rnd_seed(0) seeds 1 */
+void rnd_seed(uint32_t seed);
+uint32_t rnd(void);
+double rnd_exp(double mean);
+
+struct samples {
+	uint32_t	*v;
+	size_t		n, cap;
+};
+
+void samples_add(struct samples *s, uint32_t v);
+void samples_sort(struct samples *s);
+/* after samples_sort(); 0 with no samples */
+uint32_t percentile(const struct samples *s, double p);
+
+/* The addresses and ports of a test packet; v4 addresses take the first
+ * four bytes of src and dst.
+ */
+struct tuple {
+	uint8_t		v6;
+	uint8_t		proto;
+	uint16_t	sport, dport;
+	uint8_t		src[16], dst[16];
+};
+
+/* An IPv4 or IPv6 header of len bytes in all, the TCP or UDP ports after
+ * it and zeroes for the rest.  tos is the TOS byte or traffic class,
+ * DSCP and ECN together.  Returns len.
+ */
+unsigned int build_pkt(uint8_t *p, const struct tuple *t, uint8_t tos,
+		       unsigned int len);
+
+/* 10.a.b.c in the first four bytes of addr */
+void tuple_v4(uint8_t *addr, uint32_t host);
+
+#endif